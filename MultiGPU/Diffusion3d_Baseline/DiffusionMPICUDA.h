@@ -80,6 +80,43 @@
 	#define ENV_LOCAL_RANK "MV2_COMM_WORLD_LOCAL_RANK"
 #endif
 
+/* halo exchange */
+#define HALO_P2P 0 // Isend/Irecv through host staging buffers
+#define HALO_SHM 1 // read faces of same-node neighbors from MPI shared memory
+#define HALO_RMA 2 // MPI_Put into the neighbor ghost window, PSCW synchronization
+#define HALO_NBR 3 // MPI_Ineighbor_alltoallw over a distributed graph topology
+#define HALO_MODE HALO_SHM // default, override with '-halo p2p|shm|rma|nbr'
+#define LEFT  0 // neighbor rank-1 (bottom)
+#define RIGHT 1 // neighbor rank+1 (top)
+
+typedef struct {
+	int mode;                 // HALO_P2P, HALO_SHM, HALO_RMA or HALO_NBR
+	int rank, nbr[2];         // neighbors {rank-1,rank+1}, MPI_PROC_NULL at the ends
+	unsigned int count;       // REALs per face: Nx*Ny*RADIUS
+	REAL *send[2], *recv[2];  // host staging buffers
+	MPI_Request send_req[2], recv_req[2];
+	double wait_time;         // seconds blocked waiting on neighbors
+	/* intra-node path */
+	MPI_Comm node_comm;       // ranks sharing this node
+	MPI_Win shm_win;          // send buffers of all node ranks
+	int shm[2];               // face is read directly from the neighbor
+	int ack[2];               // neighbor still has to release our send buffer
+	MPI_Request ack_req[2];   // our release of the neighbor's send buffer, in flight
+	REAL *peer[2];            // neighbor send buffer facing us
+	/* one-sided path */
+	MPI_Win rma_win;          // our receive buffers, target of the neighbor puts
+	MPI_Group rma_group;      // the (up to two) neighbors
+	int epoch;                // access/exposure epochs are open
+	/* neighborhood collective path */
+	MPI_Comm graph_comm;      // graph of the decomposition, edges to face neighbors
+	MPI_Datatype face[2];     // subarray of a face inside the [LEFT|RIGHT] buffers
+	int degree, staged;       // number of neighbors, faces staged this stage
+	int counts[2];            // per neighbor, in graph order
+	MPI_Aint displs[2];
+	MPI_Datatype types[2];
+	MPI_Request coll_req;
+} Halo;
+
 /******************/
 /* Host functions */
 /******************/
@@ -99,6 +136,18 @@ void Print3D(REAL *u, const unsigned int nx, const unsigned int ny, const unsign
 void Save3D(REAL *u, const unsigned int nx, const unsigned int ny, const unsigned int nz);
 void SaveBinary3D(REAL *u, const unsigned int nx, const unsigned int ny, const unsigned int nz, const char *name);
 
+const char* GetOption(int argc, char** argv, const char* name, const char* fallback);
+
+int HaloMode(const char* name);
+const char* HaloModeName(int mode);
+void InitializeHalo(Halo *h, int mode, int rank, int numberOfProcesses, unsigned int nx, unsigned int ny);
+void FinalizeHalo(Halo *h);
+void HaloBegin(Halo *h);
+REAL *HaloSendBuffer(Halo *h, int side);
+void HaloSend(Halo *h, int side);
+REAL *HaloRecv(Halo *h, int side);
+void HaloEnd(Halo *h);
+
 /*******************/
 /* Device wrappers */
 /*******************/
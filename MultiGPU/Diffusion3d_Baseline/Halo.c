@@ -0,0 +1,394 @@
+//
+//  Halo.c
+//  Diffusion3d-GPU-MPI
+//
+//  Created by Manuel Diaz on 7/26/16.
+//  Copyright © 2016 Manuel Diaz. All rights reserved.
+//
+
+#include "DiffusionMPICUDA.h"
+
+#define checkCuda(error) __checkCuda(error, __FILE__, __LINE__)
+
+/*********************************************/
+/* A method for checking error in CUDA calls */
+/*********************************************/
+inline void __checkCuda(cudaError_t error, const char *file, const int line)
+{
+	#if defined(DEBUG) || defined(_DEBUG)
+	if (error != cudaSuccess)
+	{
+		printf("checkCuda error at %s:%i: %s\n", file, line, cudaGetErrorString(cudaGetLastError()));
+		exit(-1);
+	}
+	#endif
+
+	return;
+}
+
+/* Tag of a message travelling towards 'side': 1 going up, 5 going down */
+#define TAG(side) ((side)==RIGHT ? 1 : 5)
+/* Tag used to release a send buffer read through shared memory */
+#define ACK(side) (TAG(side)+1)
+
+/********************************************/
+/* Halo modes selectable from the arguments */
+/********************************************/
+int HaloMode(const char* name)
+{
+	if (strcmp(name,"p2p") == 0) return HALO_P2P;
+	if (strcmp(name,"shm") == 0) return HALO_SHM;
+	if (strcmp(name,"rma") == 0) return HALO_RMA;
+	if (strcmp(name,"nbr") == 0) return HALO_NBR;
+
+	printf("Unknown halo mode '%s', use p2p, shm, rma or nbr\n", name);
+	exit(1);
+}
+
+const char* HaloModeName(int mode)
+{
+	switch (mode) {
+		case HALO_P2P: return "Isend/Irecv";
+		case HALO_SHM: return "Shared memory + Isend/Irecv";
+		case HALO_RMA: return "MPI_Put + PSCW";
+		case HALO_NBR: return "MPI_Ineighbor_alltoallw";
+	}
+	return "unknown";
+}
+
+/*************************************************************/
+/* Sets up neighbors, staging buffers and the selected path  */
+/*************************************************************/
+void InitializeHalo(Halo *h, int mode, int rank, int numberOfProcesses, unsigned int nx, unsigned int ny)
+{
+	int s;
+	const size_t bytes = sizeof(REAL)*nx*ny*RADIUS;
+
+	h->mode = mode;
+	h->rank = rank;
+	h->count = nx*ny*RADIUS;
+	h->nbr[LEFT ] = rank > 0 ? rank-1 : MPI_PROC_NULL;
+	h->nbr[RIGHT] = rank < numberOfProcesses-1 ? rank+1 : MPI_PROC_NULL;
+	h->wait_time = 0.;
+	h->epoch = 0;
+	h->coll_req = MPI_REQUEST_NULL;
+
+	for (s = 0; s < 2; s++)
+	{
+		h->send_req[s] = h->recv_req[s] = h->ack_req[s] = MPI_REQUEST_NULL;
+		h->shm[s] = h->ack[s] = 0;
+		h->peer[s] = NULL;
+	}
+
+	switch (mode) {
+		case HALO_P2P: {
+			for (s = 0; s < 2; s++)
+			{
+				checkCuda(cudaHostAlloc((void**)&h->send[s], bytes, cudaHostAllocPortable));
+				checkCuda(cudaHostAlloc((void**)&h->recv[s], bytes, cudaHostAllocPortable));
+			}
+			break;
+		}
+		case HALO_SHM: {
+			// Every rank of the node exposes its two send buffers in one shared window
+			MPI_Info info;
+			REAL *base;
+			MPI_CHECK(MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &h->node_comm));
+			MPI_CHECK(MPI_Info_create(&info));
+			MPI_CHECK(MPI_Info_set(info, "alloc_shared_noncontig", "true"));
+			MPI_CHECK(MPI_Win_allocate_shared(2*bytes, sizeof(REAL), info, h->node_comm, &base, &h->shm_win));
+			MPI_CHECK(MPI_Info_free(&info));
+			MPI_CHECK(MPI_Win_lock_all(MPI_MODE_NOCHECK, h->shm_win));
+			h->send[LEFT ] = base;
+			h->send[RIGHT] = base + h->count;
+			checkCuda(cudaHostRegister(base, 2*bytes, cudaHostRegisterPortable));
+
+			// Find which neighbors live on this node
+			MPI_Group world_group, node_group;
+			int node_nbr[2];
+			MPI_CHECK(MPI_Comm_group(MPI_COMM_WORLD, &world_group));
+			MPI_CHECK(MPI_Comm_group(h->node_comm, &node_group));
+			MPI_CHECK(MPI_Group_translate_ranks(world_group, 2, h->nbr, node_group, node_nbr));
+			MPI_CHECK(MPI_Group_free(&world_group));
+			MPI_CHECK(MPI_Group_free(&node_group));
+
+			for (s = 0; s < 2; s++)
+			{
+				checkCuda(cudaHostAlloc((void**)&h->recv[s], bytes, cudaHostAllocPortable));
+
+				if (h->nbr[s] == MPI_PROC_NULL || node_nbr[s] == MPI_UNDEFINED) continue;
+
+				MPI_Aint size; int disp_unit; REAL *peer_base;
+				MPI_CHECK(MPI_Win_shared_query(h->shm_win, node_nbr[s], &size, &disp_unit, &peer_base));
+
+				// The neighbor's buffer facing us is its opposite side
+				h->peer[s] = peer_base + (s == RIGHT ? 0 : h->count);
+				h->shm[s] = 1;
+				checkCuda(cudaHostRegister(h->peer[s], bytes, cudaHostRegisterPortable));
+			}
+			break;
+		}
+		case HALO_RMA: {
+			// Our receive buffers are the window the neighbors put into
+			REAL *base;
+			MPI_CHECK(MPI_Win_allocate(2*bytes, sizeof(REAL), MPI_INFO_NULL, MPI_COMM_WORLD, &base, &h->rma_win));
+			h->recv[LEFT ] = base;
+			h->recv[RIGHT] = base + h->count;
+			checkCuda(cudaHostRegister(base, 2*bytes, cudaHostRegisterPortable));
+
+			for (s = 0; s < 2; s++)
+			{
+				checkCuda(cudaHostAlloc((void**)&h->send[s], bytes, cudaHostAllocPortable));
+			}
+
+			// Synchronize only with the neighbors
+			MPI_Group world_group;
+			int n = 0, nbrs[2];
+			for (s = 0; s < 2; s++) if (h->nbr[s] != MPI_PROC_NULL) nbrs[n++] = h->nbr[s];
+			MPI_CHECK(MPI_Comm_group(MPI_COMM_WORLD, &world_group));
+			MPI_CHECK(MPI_Group_incl(world_group, n, nbrs, &h->rma_group));
+			MPI_CHECK(MPI_Group_free(&world_group));
+			break;
+		}
+		case HALO_NBR: {
+			// Both faces live in one buffer so each is a subarray of it
+			REAL *base;
+			checkCuda(cudaHostAlloc((void**)&base, 2*bytes, cudaHostAllocPortable));
+			h->send[LEFT ] = base;
+			h->send[RIGHT] = base + h->count;
+			checkCuda(cudaHostAlloc((void**)&base, 2*bytes, cudaHostAllocPortable));
+			h->recv[LEFT ] = base;
+			h->recv[RIGHT] = base + h->count;
+
+			int sizes[3]    = {2*RADIUS, (int)ny, (int)nx};
+			int subsizes[3] = {  RADIUS, (int)ny, (int)nx};
+			for (s = 0; s < 2; s++)
+			{
+				int starts[3] = {s*RADIUS, 0, 0};
+				MPI_CHECK(MPI_Type_create_subarray(3, sizes, subsizes, starts, MPI_ORDER_C, MPI_CUSTOM_REAL, &h->face[s]));
+				MPI_CHECK(MPI_Type_commit(&h->face[s]));
+			}
+
+			// The decomposition only enters through the list of face neighbors
+			int nbrs[2];
+			h->degree = 0;
+			for (s = 0; s < 2; s++)
+			{
+				if (h->nbr[s] == MPI_PROC_NULL) continue;
+				nbrs[h->degree] = h->nbr[s];
+				h->counts[h->degree] = 1;
+				h->displs[h->degree] = 0;
+				h->types[h->degree] = h->face[s];
+				h->degree++;
+			}
+			MPI_CHECK(MPI_Dist_graph_create_adjacent(MPI_COMM_WORLD, h->degree, nbrs, MPI_UNWEIGHTED,
+				h->degree, nbrs, MPI_UNWEIGHTED, MPI_INFO_NULL, 0, &h->graph_comm));
+			break;
+		}
+	}
+
+	if (DEBUG) printf("Halo rank %d (%s): left %s, right %s\n", rank, HaloModeName(mode),
+		h->shm[LEFT ] ? "shared memory" : "remote", h->shm[RIGHT] ? "shared memory" : "remote");
+}
+
+/*****************************************/
+/* Releases buffers and the halo windows */
+/*****************************************/
+void FinalizeHalo(Halo *h)
+{
+	int s;
+
+	switch (h->mode) {
+		case HALO_P2P: {
+			for (s = 0; s < 2; s++)
+			{
+				checkCuda(cudaFreeHost(h->send[s]));
+				checkCuda(cudaFreeHost(h->recv[s]));
+			}
+			break;
+		}
+		case HALO_SHM: {
+			// Neighbors must be done with our buffers before the window goes away
+			for (s = 0; s < 2; s++)
+			{
+				if (h->ack[s]) MPI_CHECK(MPI_Recv(NULL, 0, MPI_BYTE, h->nbr[s], ACK(s), MPI_COMM_WORLD, MPI_STATUS_IGNORE));
+				MPI_CHECK(MPI_Wait(&h->ack_req[s], MPI_STATUS_IGNORE));
+				if (h->shm[s]) checkCuda(cudaHostUnregister(h->peer[s]));
+				checkCuda(cudaFreeHost(h->recv[s]));
+			}
+			checkCuda(cudaHostUnregister(h->send[LEFT]));
+			MPI_CHECK(MPI_Win_unlock_all(h->shm_win));
+			MPI_CHECK(MPI_Win_free(&h->shm_win));
+			MPI_CHECK(MPI_Comm_free(&h->node_comm));
+			break;
+		}
+		case HALO_RMA: {
+			for (s = 0; s < 2; s++)
+			{
+				checkCuda(cudaFreeHost(h->send[s]));
+			}
+			checkCuda(cudaHostUnregister(h->recv[LEFT]));
+			MPI_CHECK(MPI_Group_free(&h->rma_group));
+			MPI_CHECK(MPI_Win_free(&h->rma_win));
+			break;
+		}
+		case HALO_NBR: {
+			checkCuda(cudaFreeHost(h->send[LEFT]));
+			checkCuda(cudaFreeHost(h->recv[LEFT]));
+			for (s = 0; s < 2; s++)
+			{
+				MPI_CHECK(MPI_Type_free(&h->face[s]));
+			}
+			MPI_CHECK(MPI_Comm_free(&h->graph_comm));
+			break;
+		}
+	}
+}
+
+/**************************************************/
+/* Opens the halo exchange of a Runge-Kutta stage */
+/**************************************************/
+void HaloBegin(Halo *h)
+{
+	int s;
+
+	if (h->mode == HALO_RMA)
+	{
+		// Expose our ghost buffers to the neighbors and gain access to theirs
+		if (h->nbr[LEFT] == MPI_PROC_NULL && h->nbr[RIGHT] == MPI_PROC_NULL) return;
+		MPI_CHECK(MPI_Win_post(h->rma_group, 0, h->rma_win));
+		MPI_CHECK(MPI_Win_start(h->rma_group, 0, h->rma_win));
+		h->epoch = 1;
+		return;
+	}
+	if (h->mode == HALO_NBR)
+	{
+		// The collective starts once every face has been staged
+		h->staged = 0;
+		return;
+	}
+
+	for (s = 0; s < 2; s++)
+	{
+		if (h->nbr[s] == MPI_PROC_NULL) continue;
+
+		// Over shared memory only a zero-byte 'ready' notification travels
+		MPI_CHECK(MPI_Irecv(h->recv[s], h->shm[s] ? 0 : h->count, MPI_CUSTOM_REAL, h->nbr[s], TAG(1-s), MPI_COMM_WORLD, &h->recv_req[s]));
+	}
+}
+
+/****************************************************/
+/* Returns the host buffer where a face is staged   */
+/****************************************************/
+REAL *HaloSendBuffer(Halo *h, int side)
+{
+	// Wait until the neighbor has read the previous stage from our buffer
+	if (h->ack[side])
+	{
+		h->wait_time -= MPI_Wtime();
+		MPI_CHECK(MPI_Recv(NULL, 0, MPI_BYTE, h->nbr[side], ACK(side), MPI_COMM_WORLD, MPI_STATUS_IGNORE));
+		h->wait_time += MPI_Wtime();
+		h->ack[side] = 0;
+	}
+
+	// and our release of its buffer, posted at the end of the previous stage, has gone out
+	MPI_CHECK(MPI_Wait(&h->ack_req[side], MPI_STATUS_IGNORE));
+	return h->send[side];
+}
+
+/**************************************/
+/* Hands a staged face to the neighbor */
+/**************************************/
+void HaloSend(Halo *h, int side)
+{
+	if (h->mode == HALO_RMA)
+	{
+		// Our face lands in the neighbor's ghost buffer of the opposite side
+		MPI_Aint disp = side == RIGHT ? 0 : h->count;
+		MPI_CHECK(MPI_Put(h->send[side], h->count, MPI_CUSTOM_REAL, h->nbr[side], disp, h->count, MPI_CUSTOM_REAL, h->rma_win));
+	}
+	else if (h->mode == HALO_NBR)
+	{
+		if (++h->staged == h->degree)
+		{
+			MPI_CHECK(MPI_Ineighbor_alltoallw(h->send[LEFT], h->counts, h->displs, h->types,
+				h->recv[LEFT], h->counts, h->displs, h->types, h->graph_comm, &h->coll_req));
+		}
+	}
+	else if (h->shm[side])
+	{
+		MPI_CHECK(MPI_Win_sync(h->shm_win));
+		MPI_CHECK(MPI_Isend(NULL, 0, MPI_CUSTOM_REAL, h->nbr[side], TAG(side), MPI_COMM_WORLD, &h->send_req[side]));
+		h->ack[side] = 1;
+	}
+	else
+	{
+		MPI_CHECK(MPI_Isend(h->send[side], h->count, MPI_CUSTOM_REAL, h->nbr[side], TAG(side), MPI_COMM_WORLD, &h->send_req[side]));
+	}
+}
+
+/*********************************************************/
+/* Waits for a neighbor face and returns where to read it */
+/*********************************************************/
+REAL *HaloRecv(Halo *h, int side)
+{
+	h->wait_time -= MPI_Wtime();
+
+	if (h->mode == HALO_RMA)
+	{
+		// Both faces were put already: close our access, then wait for theirs
+		if (h->epoch)
+		{
+			MPI_CHECK(MPI_Win_complete(h->rma_win));
+			MPI_CHECK(MPI_Win_wait(h->rma_win));
+			h->epoch = 0;
+		}
+	}
+	else if (h->mode == HALO_NBR)
+	{
+		MPI_CHECK(MPI_Wait(&h->coll_req, MPI_STATUS_IGNORE));
+	}
+	else
+	{
+		MPI_CHECK(MPI_Wait(&h->recv_req[side], MPI_STATUS_IGNORE));
+		if (h->shm[side]) MPI_CHECK(MPI_Win_sync(h->shm_win));
+	}
+
+	h->wait_time += MPI_Wtime();
+	return h->shm[side] ? h->peer[side] : h->recv[side];
+}
+
+/****************************************************************/
+/* Completes the stage, call once received faces are on device  */
+/****************************************************************/
+void HaloEnd(Halo *h)
+{
+	int s;
+
+	h->wait_time -= MPI_Wtime();
+
+	if (h->mode == HALO_RMA)
+	{
+		if (h->epoch)
+		{
+			MPI_CHECK(MPI_Win_complete(h->rma_win));
+			MPI_CHECK(MPI_Win_wait(h->rma_win));
+			h->epoch = 0;
+		}
+	}
+	else if (h->mode == HALO_NBR)
+	{
+		MPI_CHECK(MPI_Wait(&h->coll_req, MPI_STATUS_IGNORE));
+	}
+	else for (s = 0; s < 2; s++)
+	{
+		if (h->nbr[s] == MPI_PROC_NULL) continue;
+
+		// Release the neighbor's send buffer we have just read, completed by the next stage
+		if (h->shm[s]) MPI_CHECK(MPI_Isend(NULL, 0, MPI_BYTE, h->nbr[s], ACK(1-s), MPI_COMM_WORLD, &h->ack_req[s]));
+
+		MPI_CHECK(MPI_Wait(&h->send_req[s], MPI_STATUS_IGNORE));
+	}
+
+	h->wait_time += MPI_Wtime();
+}
@@ -222,6 +222,18 @@ void Merge_domains(REAL *h_s_q, REAL *h_q, unsigned int n, unsigned int Nx, unsi
 	}
 }
 
+/***********************************************************/
+/* Returns the value of an optional '-name value' argument */
+/***********************************************************/
+const char* GetOption(int argc, char** argv, const char* name, const char* fallback)
+{
+  int i;
+  for (i = 1; i < argc-1; i++) {
+    if (strcmp(argv[i],name) == 0) return argv[i+1];
+  }
+  return fallback;
+}
+
 /******************************/
 /* Function to initialize MPI */
 /******************************/
@@ -0,0 +1,5 @@
+# Compare halo exchange engines over localhost ranks
+make
+for mode in p2p shm rma nbr; do
+  mpirun -np 2 ./Diffusion3d.run 1.00 2.00 2.00 2.00 400 200 200 1000 64 4 1 -halo $mode | grep -E "Halo|Kernel time"
+done
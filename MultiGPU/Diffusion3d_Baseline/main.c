@@ -31,9 +31,9 @@ int main(int argc, char** argv)
 {
 	REAL K, L, W, H;
     unsigned int max_iters, Nx, Ny, Nz, blockX, blockY, blockZ;
-    int rank, numberOfProcesses;
+    int rank, numberOfProcesses, haloMode;
     
-    if (argc == 12)
+    if (argc >= 12 && argc%2 == 0)
     {
         K = atof(argv[1]);			// Heat Conduction
         L = atof(argv[2]);			// domain lenght
@@ -46,10 +46,12 @@ int main(int argc, char** argv)
         blockX = atoi(argv[9]); 	// block size in the i-direction
         blockY = atoi(argv[10]); 	// block size in the j-direction
         blockZ = atoi(argv[11]); 	// block size in the k-direction
+        const char* halo = GetOption(argc,argv,"-halo",NULL);
+        haloMode = halo ? HaloMode(halo) : HALO_MODE;
     }
     else
     {
-        printf("Usage: %s K L W H Nx Ny NZ max_iters block_x block_y block_z\n", argv[0]);
+        printf("Usage: %s K L W H Nx Ny NZ max_iters block_x block_y block_z [-halo p2p|shm|rma|nbr]\n", argv[0]);
         exit(1);
     }
 
@@ -104,14 +106,7 @@ int main(int argc, char** argv)
     if (DEBUG) printf("SubDomain %d Initialized\n", rank);
 
 	// Allocate left/right receive/send buffers
-	REAL *l_u_send_buffer; l_u_send_buffer = (REAL*)malloc(sizeof(REAL)*Nx*Ny*RADIUS);
-	REAL *r_u_send_buffer; r_u_send_buffer = (REAL*)malloc(sizeof(REAL)*Nx*Ny*RADIUS);
-	REAL *l_u_recv_buffer; l_u_recv_buffer = (REAL*)malloc(sizeof(REAL)*Nx*Ny*RADIUS);
-	REAL *r_u_recv_buffer; r_u_recv_buffer = (REAL*)malloc(sizeof(REAL)*Nx*Ny*RADIUS);
-	checkCuda(cudaHostAlloc((void**)&l_u_send_buffer, sizeof(REAL)*Nx*Ny*RADIUS, cudaHostAllocPortable));
-	checkCuda(cudaHostAlloc((void**)&r_u_send_buffer, sizeof(REAL)*Nx*Ny*RADIUS, cudaHostAllocPortable));
-	checkCuda(cudaHostAlloc((void**)&l_u_recv_buffer, sizeof(REAL)*Nx*Ny*RADIUS, cudaHostAllocPortable));
-	checkCuda(cudaHostAlloc((void**)&r_u_recv_buffer, sizeof(REAL)*Nx*Ny*RADIUS, cudaHostAllocPortable));
+	Halo halo; InitializeHalo(&halo,haloMode,rank,numberOfProcesses,Nx,Ny);
 	if (DEBUG) printf("Send/Receive buffers allocated in rank %d\n", rank);
 
 	// Initialize GPU streams
@@ -169,7 +164,6 @@ int main(int argc, char** argv)
 	//MPI_Status status;
 	MPI_Status status[numberOfProcesses];
 	MPI_Request gather_send_request[numberOfProcesses];
-	MPI_Request r_u_send_request[numberOfProcesses], l_u_send_request[numberOfProcesses], r_u_recv_request[numberOfProcesses], l_u_recv_request[numberOfProcesses];
 
 	// Initialize time variables
     int it =0;
@@ -200,8 +194,11 @@ int main(int argc, char** argv)
 		// Runge Kutta Steps 1-3
 		for (unsigned int step = 1; step <= 3; step++) // 3 runge kutta steps!!
 		{
+			// Post receives of this stage
+			HaloBegin(&halo);
+
 	       	// Compute right boundary on devices 0-2, send to devices 1-(n-1)
-			if (rank < numberOfProcesses-1)
+			if (halo.nbr[RIGHT] != MPI_PROC_NULL)
 			{
 				unsigned int kstart = _Nz;
 				unsigned int kstop = _Nz+RADIUS;
@@ -210,14 +207,14 @@ int main(int argc, char** argv)
 
 				CopyBoundaryRegionToGhostCellAsync(numBlocksHalo2D_XY, threadsPerBlock3D, r_send_stream, d_s_Lu, d_r_u_send_buffer, Nx, Ny, _NZ, pitch, gc_pitch, 0);
 
-				checkCuda(cudaMemcpy2DAsync(r_u_send_buffer, dt_size*Nx, d_r_u_send_buffer, pitch_gc_bytes, dt_size*Nx, Ny*RADIUS, cudaMemcpyDefault, r_send_stream));
+				checkCuda(cudaMemcpy2DAsync(HaloSendBuffer(&halo,RIGHT), dt_size*Nx, d_r_u_send_buffer, pitch_gc_bytes, dt_size*Nx, Ny*RADIUS, cudaMemcpyDefault, r_send_stream));
 				checkCuda(cudaStreamSynchronize(r_send_stream));
 				// if (rank==0) printGPUmem(1, 1, r_send_stream, pitch, Nx, Ny, _NZ, 0, _NZ, d_s_Lu);
 				// if (rank==0) printGPUmem(1, 1, r_send_stream, pitch, Nx, Ny, RADIUS, 0, RADIUS, d_r_u_send_buffer);
 
-				MPI_CHECK(MPI_Isend(r_u_send_buffer, Nx*Ny*RADIUS, MPI_CUSTOM_REAL, rank+1, 1, MPI_COMM_WORLD, &r_u_send_request[rank]));
+				HaloSend(&halo,RIGHT);
 			}
-			if (rank > 0)
+			if (halo.nbr[LEFT] != MPI_PROC_NULL)
 			{
 				unsigned int kstart = RADIUS;
 				unsigned int kstop = 2*RADIUS;
@@ -226,79 +223,45 @@ int main(int argc, char** argv)
 
 				CopyBoundaryRegionToGhostCellAsync(numBlocksHalo2D_XY, threadsPerBlock3D, l_send_stream, d_s_Lu, d_l_u_send_buffer, Nx, Ny, _NZ, pitch, gc_pitch, 1);
 
-				checkCuda(cudaMemcpy2DAsync(l_u_send_buffer, dt_size*Nx, d_l_u_send_buffer, pitch_gc_bytes, dt_size*Nx, Ny*RADIUS, cudaMemcpyDefault, l_send_stream));
+				checkCuda(cudaMemcpy2DAsync(HaloSendBuffer(&halo,LEFT), dt_size*Nx, d_l_u_send_buffer, pitch_gc_bytes, dt_size*Nx, Ny*RADIUS, cudaMemcpyDefault, l_send_stream));
 				checkCuda(cudaStreamSynchronize(l_send_stream));
 				// if (rank==1) printGPUmem(1, 1, l_send_stream, pitch, Nx, Ny, _NZ, 0, _NZ, d_s_Lu);
 				// if (rank==1) printGPUmem(1, 1, l_send_stream, pitch, Nx, Ny, RADIUS, 0, RADIUS, d_l_u_send_buffer);
 
-				MPI_CHECK(MPI_Isend(l_u_send_buffer, Nx*Ny*RADIUS, MPI_CUSTOM_REAL, rank-1, 5, MPI_COMM_WORLD, &l_u_send_request[rank]));
+				HaloSend(&halo,LEFT);
 			}
 
-			// Compute inner points for device 0
-			if (rank == 0)
+			// Compute inner points, boundary planes facing a neighbor were done above
 			{
-				unsigned int kstart = RADIUS;
-				unsigned int kstop = _Nz;
+				unsigned int kstart = halo.nbr[LEFT ] != MPI_PROC_NULL ? 2*RADIUS : RADIUS;
+				unsigned int kstop  = halo.nbr[RIGHT] != MPI_PROC_NULL ? _Nz : _Nz+RADIUS;
 
 				Call_Diff_(numBlocks3D, threadsPerBlock3D, computeStream, pitch, Nx, Ny, _NZ, kstart, kstop, kx, ky, kz, d_s_u, d_s_Lu);
 			}
-			// Compute inner points for device 1 and (n-2)
-			if (rank > 0 && rank < numberOfProcesses-1)
-			{
-				unsigned int kstart = 2*RADIUS;
-				unsigned int kstop = _Nz;
-
-				Call_Diff_(numBlocks3D, threadsPerBlock3D, computeStream, pitch, Nx, Ny, _NZ, kstart, kstop, kx, ky, kz, d_s_u, d_s_Lu);
-			}
-			// Compute inner points for device (n-1)
-			if (rank == numberOfProcesses-1)
-			{
-				unsigned int kstart = 2*RADIUS;
-				unsigned int kstop = _Nz+RADIUS;
-
-				Call_Diff_(numBlocks3D, threadsPerBlock3D, computeStream, pitch, Nx, Ny, _NZ, kstart, kstop, kx, ky, kz, d_s_u, d_s_Lu);
-			}
-
-			// Receive data from 0-2
-			if (rank < numberOfProcesses-1)
-			{
-				MPI_CHECK(MPI_Irecv(r_u_recv_buffer, Nx*Ny*RADIUS, MPI_CUSTOM_REAL, rank+1, 5, MPI_COMM_WORLD, &r_u_recv_request[rank]));
-			}
-			// Receive data from 1-(n-1)
-			if (rank > 0)
-			{
-				MPI_CHECK(MPI_Irecv(l_u_recv_buffer, Nx*Ny*RADIUS, MPI_CUSTOM_REAL, rank-1, 1, MPI_COMM_WORLD, &l_u_recv_request[rank]));
-			}
 
 			// Receive data from 0-2
-			if (rank < numberOfProcesses-1)
+			if (halo.nbr[RIGHT] != MPI_PROC_NULL)
 			{
-				MPI_CHECK(MPI_Wait(&r_u_recv_request[rank], MPI_STATUS_IGNORE));
+				REAL *r_u_recv_buffer = HaloRecv(&halo,RIGHT);
 
 				checkCuda(cudaMemcpy2DAsync(d_r_u_recv_buffer, pitch_gc_bytes, r_u_recv_buffer, dt_size*Nx, dt_size*Nx, Ny*RADIUS, cudaMemcpyDefault, r_recv_stream));
 				CopyGhostCellToBoundaryRegionAsync(numBlocksHalo2D_XY, threadsPerBlock3D, r_recv_stream, d_s_Lu, d_r_u_recv_buffer, Nx, Ny, _NZ, pitch, gc_pitch, 0);
 			}
 			// Receive data from 1-(n-1)
-			if (rank > 0)
+			if (halo.nbr[LEFT] != MPI_PROC_NULL)
 			{
-				MPI_CHECK(MPI_Wait(&l_u_recv_request[rank], MPI_STATUS_IGNORE));
+				REAL *l_u_recv_buffer = HaloRecv(&halo,LEFT);
 
 				checkCuda(cudaMemcpy2DAsync(d_l_u_recv_buffer, pitch_gc_bytes, l_u_recv_buffer, dt_size*Nx, dt_size*Nx, Ny*RADIUS, cudaMemcpyDefault, l_recv_stream));
 				CopyGhostCellToBoundaryRegionAsync(numBlocksHalo2D_XY, threadsPerBlock3D, l_recv_stream, d_s_Lu, d_l_u_recv_buffer, Nx, Ny, _NZ, pitch, gc_pitch, 1);
 			}
 
-			if (rank < numberOfProcesses-1)
-			{
-				MPI_CHECK(MPI_Wait(&r_u_send_request[rank], MPI_STATUS_IGNORE));
-			}
-			if (rank > 0)
-			{
-				MPI_CHECK(MPI_Wait(&l_u_send_request[rank], MPI_STATUS_IGNORE));
-			}
-
 			// No need to swap pointers
 			Call_sspRK(numBlocks3D_RK, threadsPerBlock3D_RK, computeStream, step, pitch, Nx, Ny, _NZ, dt, d_s_u, d_s_uo, d_s_Lu);
 			checkCuda(cudaDeviceSynchronize());
+
+			// Faces are on the device, release neighbors and finish sends
+			HaloEnd(&halo);
 		}
 	}
 
@@ -342,13 +305,21 @@ int main(int argc, char** argv)
     	if (DEBUG) printf("Solution saved in Host rank %d\n", rank);
 	}
 
+	// Slowest rank waiting on its neighbors
+	double halo_timer = 0;
+	MPI_CHECK(MPI_Reduce(&halo.wait_time, &halo_timer, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD));
+
 	// Final Report
 	if (rank == 0)
 	{
 		float gflops = CalcGflops(compute_timer, it, Nx, Ny, NZ);
 		PrintSummary("Diffusion-3D MPI-GPU-FD4", "Pitched Memory", compute_timer, HtD_timer, DtH_timer, gflops, it, Nx, Ny, NZ);
+		printf("Halo exchange                                :  %s\n", HaloModeName(haloMode));
+		printf("Halo wait time (max over ranks)              :  %lf seconds\n", halo_timer);
+		printf("===================================================================\n");
 	}
 
+	FinalizeHalo(&halo);
 	FinalizeMPI();
 
 	// Free device memory
@@ -371,11 +342,6 @@ int main(int argc, char** argv)
 		}
 	}
 
-	checkCuda(cudaFreeHost(l_u_send_buffer));
-	checkCuda(cudaFreeHost(l_u_recv_buffer));
-	checkCuda(cudaFreeHost(r_u_send_buffer));
-	checkCuda(cudaFreeHost(r_u_recv_buffer));
-
 	// Force Reset Device
 	checkCuda(cudaDeviceReset());
 
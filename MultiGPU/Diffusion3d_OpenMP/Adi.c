@@ -0,0 +1,297 @@
+//
+//  Adi.c
+//  Diffusion3d-MPI-OpenMP
+//
+//  Created by Manuel Diaz on 7/26/16.
+//  Copyright © 2016 Manuel Diaz. All rights reserved.
+//
+
+#include "DiffusionMPI.h"
+
+/*****************************************************************/
+/* Douglas ADI in delta form: the step                           */
+/*   (1-theta dt Ax)(1-theta dt Ay)(1-theta dt Az) du = dt L u   */
+/* keeps the FD4 Laplacian L on the right, so steady states and  */
+/* the spatial order are those of the explicit schemes, while    */
+/* the factors are the FD2 second differences, tridiagonal along */
+/* their lines. Since L never exceeds 4/3 of its FD2 counterpart */
+/* a theta of at least 2/3 is stable for any dt. The x and y     */
+/* lines lie within a slab; the z lines cross ranks and are      */
+/* solved by partition: every rank solves its segment with the   */
+/* neighbors at zero, which leaves the first and last plane of   */
+/* each segment coupled to those of the next ranks only. That    */
+/* block tridiagonal system, 2x2 blocks the same on every line,  */
+/* is solved by parallel cyclic reduction: at level k each rank  */
+/* trades its two planes with ranks r-2^k and r+2^k, and after   */
+/* log2(P) levels it holds its own; one more exchange with the   */
+/* neighbors corrects the segments                               */
+/*****************************************************************/
+
+#define TAG_PCR(level) (100+(level)) // apart from the halo tags
+#define TAG_ENDS 99
+
+/* Thomas elimination of n rows of (1+2r)x_i - r(x_{i-1}+x_{i+1}) */
+static void Factor(REAL r, unsigned int n, REAL *c, REAL *inv)
+{
+	for (unsigned int i = 0; i < n; i++)
+	{
+		inv[i] = 1/(1+2*r+(i > 0 ? r*c[i-1] : 0));
+		c[i] = -r*inv[i];
+	}
+}
+
+/* Solution of the first n rows with right-hand side r*e_0, whose rows are a prefix of any longer elimination */
+static void Response(REAL r, unsigned int n, const REAL *c, const REAL *inv, REAL *x)
+{
+	x[0] = r*inv[0];
+	for (unsigned int i = 1; i < n; i++) x[i] = r*x[i-1]*inv[i];
+	for (int i = n-2; i >= 0; i--) x[i] -= c[i]*x[i+1];
+}
+
+void InitializeAdi(Adi *A, const Decomposition *d, int rank, unsigned int nx, unsigned int ny,
+	REAL K, REAL dx, REAL dy, REAL dz, REAL dt)
+{
+	memset(A, 0, sizeof(Adi));
+	A->rank = rank;
+	A->nx = nx;
+	A->ny = ny;
+	A->dt = dt;
+	A->rx = ADI_THETA*dt*K/(dx*dx);
+	A->ry = ADI_THETA*dt*K/(dy*dy);
+	A->rz = ADI_THETA*dt*K/(dz*dz);
+
+	// Lines along x and y hold the interior points, the fixed ones around them stay put
+	A->cx = (REAL*)malloc(sizeof(REAL)*nx); A->ix = (REAL*)malloc(sizeof(REAL)*nx);
+	A->cy = (REAL*)malloc(sizeof(REAL)*ny); A->iy = (REAL*)malloc(sizeof(REAL)*ny);
+	Factor(A->rx, nx-6, A->cx, A->ix);
+	Factor(A->ry, ny-6, A->cy, A->iy);
+	AdiPartition(A, d);
+}
+
+/* 2x2 blocks, row major */
+static void Multiply(const double *a, const double *b, double *c)
+{
+	const double c0 = a[0]*b[0]+a[1]*b[2], c1 = a[0]*b[1]+a[1]*b[3];
+	const double c2 = a[2]*b[0]+a[3]*b[2], c3 = a[2]*b[1]+a[3]*b[3];
+	c[0] = c0; c[1] = c1; c[2] = c2; c[3] = c3;
+}
+
+static void Invert(const double *a, double *b)
+{
+	const double det = a[0]*a[3]-a[1]*a[2];
+	const double b0 = a[3]/det, b1 = -a[1]/det, b2 = -a[2]/det, b3 = a[0]/det;
+	b[0] = b0; b[1] = b1; b[2] = b2; b[3] = b3;
+}
+
+/*****************************************************************/
+/* The z part of a decomposition, again after every rebalance:   */
+/* the local elimination and responses, and the weights of the   */
+/* cyclic reduction. Rank r's first and last planes obey         */
+/*   X_r + A_r X_{r-1} + C_r X_{r+1} = P_r,  X = (first, last)   */
+/* and every level replaces the couplings at distance s by those */
+/* at 2s. The blocks only depend on the plane counts, so every   */
+/* rank reduces all of them, O(P log P) scalars, and keeps its   */
+/* own weights                                                   */
+/*****************************************************************/
+void AdiPartition(Adi *A, const Decomposition *d)
+{
+	const int P = d->size;
+	const size_t XY = (size_t)A->nx*A->ny;
+	unsigned int longest = 0;
+	for (int r = 0; r < P; r++) longest = MAX(longest, d->nz[r]);
+
+	free(A->cz); free(A->iz); free(A->g); free(A->h);
+	free(A->alpha); free(A->gamma); free(A->ends[0]); free(A->ends[1]); free(A->below); free(A->above);
+	A->size = P;
+	A->m = d->nz[A->rank];
+	A->cz = (REAL*)malloc(sizeof(REAL)*longest);
+	A->iz = (REAL*)malloc(sizeof(REAL)*longest);
+	A->g = (REAL*)malloc(sizeof(REAL)*longest);
+	A->h = (REAL*)malloc(sizeof(REAL)*A->m);
+	Factor(A->rz, longest, A->cz, A->iz);
+	for (A->levels = 0; (1 << A->levels) < P; A->levels++);
+	A->alpha = (double*)calloc(4*(A->levels+1), sizeof(double));
+	A->gamma = (double*)calloc(4*(A->levels+1), sizeof(double));
+	A->ends[0] = (REAL*)malloc(sizeof(REAL)*2*XY);
+	A->ends[1] = (REAL*)malloc(sizeof(REAL)*2*XY);
+	A->below = (REAL*)malloc(sizeof(REAL)*2*XY);
+	A->above = (REAL*)malloc(sizeof(REAL)*2*XY);
+
+	// x = p + x_{-1} g + x_m h on a segment of m planes, h being g reversed:
+	// the first plane takes g_0 of the last one below and g_{m-1} of the first one above
+	double *a = (double*)calloc(4*P, sizeof(double)), *b = (double*)calloc(4*P, sizeof(double)), *c = (double*)calloc(4*P, sizeof(double));
+	double *a1 = (double*)malloc(sizeof(double)*4*P), *b1 = (double*)malloc(sizeof(double)*4*P), *c1 = (double*)malloc(sizeof(double)*4*P);
+	for (int r = 0; r < P; r++)
+	{
+		Response(A->rz, d->nz[r], A->cz, A->iz, A->g);
+		const double g0 = A->g[0], gm = A->g[d->nz[r]-1];
+		b[4*r] = b[4*r+3] = 1;
+		if (r > 0) { a[4*r+1] = -g0; a[4*r+3] = -gm; }
+		if (r < P-1) { c[4*r] = -gm; c[4*r+2] = -g0; }
+	}
+	for (int k = 0, s = 1; k < A->levels; k++, s *= 2)
+	{
+		for (int r = 0; r < P; r++)
+		{
+			double alpha[4] = {0, 0, 0, 0}, gamma[4] = {0, 0, 0, 0}, t[4];
+			memcpy(b1+4*r, b+4*r, sizeof(t));
+			memset(a1+4*r, 0, sizeof(t)); memset(c1+4*r, 0, sizeof(t));
+			if (r-s >= 0)
+			{
+				Invert(b+4*(r-s), t); Multiply(a+4*r, t, alpha);
+				for (int i = 0; i < 4; i++) alpha[i] = -alpha[i];
+				Multiply(alpha, a+4*(r-s), a1+4*r);
+				Multiply(alpha, c+4*(r-s), t);
+				for (int i = 0; i < 4; i++) b1[4*r+i] += t[i];
+			}
+			if (r+s < P)
+			{
+				Invert(b+4*(r+s), t); Multiply(c+4*r, t, gamma);
+				for (int i = 0; i < 4; i++) gamma[i] = -gamma[i];
+				Multiply(gamma, c+4*(r+s), c1+4*r);
+				Multiply(gamma, a+4*(r+s), t);
+				for (int i = 0; i < 4; i++) b1[4*r+i] += t[i];
+			}
+			if (r == A->rank) { memcpy(A->alpha+4*k, alpha, sizeof(alpha)); memcpy(A->gamma+4*k, gamma, sizeof(gamma)); }
+		}
+		SWAP(double*, a, a1); SWAP(double*, b, b1); SWAP(double*, c, c1);
+	}
+	Invert(b+4*A->rank, A->inverse);
+	free(a); free(b); free(c); free(a1); free(b1); free(c1);
+
+	Response(A->rz, A->m, A->cz, A->iz, A->g);
+	for (unsigned int k = 0; k < A->m; k++) A->h[k] = A->g[A->m-1-k];
+}
+
+/* Trades n planes with the ranks at distance s below and above */
+static void Trade(const REAL *send, REAL *below, REAL *above, size_t n, int rank, int size, int s, int tag)
+{
+	const int lo = rank-s >= 0 ? rank-s : MPI_PROC_NULL, hi = rank+s < size ? rank+s : MPI_PROC_NULL;
+	MPI_Request req[4];
+	MPI_CHECK(MPI_Irecv(below, (int)n, MPI_CUSTOM_REAL, lo, tag, solverComm, &req[0]));
+	MPI_CHECK(MPI_Irecv(above, (int)n, MPI_CUSTOM_REAL, hi, tag, solverComm, &req[1]));
+	MPI_CHECK(MPI_Isend(send, (int)n, MPI_CUSTOM_REAL, lo, tag, solverComm, &req[2]));
+	MPI_CHECK(MPI_Isend(send, (int)n, MPI_CUSTOM_REAL, hi, tag, solverComm, &req[3]));
+	MPI_CHECK(MPI_Waitall(4, req, MPI_STATUSES_IGNORE));
+}
+
+/*****************************************************************/
+/* Parallel cyclic reduction of the interface planes: leaves the */
+/* last plane of the rank below in 'below' and the first plane   */
+/* of the rank above in 'above'                                  */
+/*****************************************************************/
+static void SolveInterfaces(Adi *A, const REAL *d)
+{
+	const size_t XY = (size_t)A->nx*A->ny;
+	const int r = A->rank, P = A->size;
+
+	memcpy(A->ends[0], d+RADIUS*XY, sizeof(REAL)*XY);
+	memcpy(A->ends[0]+XY, d+(RADIUS+A->m-1)*XY, sizeof(REAL)*XY);
+	for (int k = 0, s = 1; k < A->levels; k++, s *= 2)
+	{
+		Trade(A->ends[0], A->below, A->above, 2*XY, r, P, s, TAG_PCR(k));
+
+		// Ranks past either end weigh zero, their buffers are never read
+		const double *w = A->alpha+4*k, *v = A->gamma+4*k;
+		const REAL *x = A->ends[0], *lo = r-s >= 0 ? A->below : NULL, *hi = r+s < P ? A->above : NULL;
+		REAL *y = A->ends[1];
+		#pragma omp parallel for simd schedule(static)
+		for (size_t o = 0; o < XY; o++)
+		{
+			REAL f = x[o], l = x[XY+o];
+			if (lo) { f += w[0]*lo[o]+w[1]*lo[XY+o]; l += w[2]*lo[o]+w[3]*lo[XY+o]; }
+			if (hi) { f += v[0]*hi[o]+v[1]*hi[XY+o]; l += v[2]*hi[o]+v[3]*hi[XY+o]; }
+			y[o] = f; y[XY+o] = l;
+		}
+		SWAP(REAL*, A->ends[0], A->ends[1]);
+	}
+
+	// This rank's planes, then the last one below and the first one above
+	const double *b = A->inverse;
+	REAL *x = A->ends[0];
+	#pragma omp parallel for simd schedule(static)
+	for (size_t o = 0; o < XY; o++)
+	{
+		const REAL f = x[o], l = x[XY+o];
+		x[o] = b[0]*f+b[1]*l;
+		x[XY+o] = b[2]*f+b[3]*l;
+	}
+	const int lo = r > 0 ? r-1 : MPI_PROC_NULL, hi = r < P-1 ? r+1 : MPI_PROC_NULL;
+	MPI_Request req[4];
+	MPI_CHECK(MPI_Irecv(A->below, (int)XY, MPI_CUSTOM_REAL, lo, TAG_ENDS, solverComm, &req[0]));
+	MPI_CHECK(MPI_Irecv(A->above, (int)XY, MPI_CUSTOM_REAL, hi, TAG_ENDS, solverComm, &req[1]));
+	MPI_CHECK(MPI_Isend(x, (int)XY, MPI_CUSTOM_REAL, lo, TAG_ENDS, solverComm, &req[2]));
+	MPI_CHECK(MPI_Isend(x+XY, (int)XY, MPI_CUSTOM_REAL, hi, TAG_ENDS, solverComm, &req[3]));
+	MPI_CHECK(MPI_Waitall(4, req, MPI_STATUSES_IGNORE));
+}
+
+/*****************************************************************/
+/* One step on the slab u of _nz planes, d its scratch: returns  */
+/* max|du| of this rank and leaves the ghost planes of u updated */
+/* from the neighbors, if there is a halo h                      */
+/*****************************************************************/
+REAL AdiStep(Adi *A, Halo *h, REAL *u, REAL *d, REAL kx, REAL ky, REAL kz, unsigned int _nz)
+{
+	const unsigned int nx = A->nx, ny = A->ny, m = A->m;
+	const size_t XY = (size_t)nx*ny;
+
+	// dt L u, then the x, y and local z lines
+	Compute_Laplace3d(u, d, kx, ky, kz, nx, ny, _nz, RADIUS, _nz-RADIUS);
+	Compute_ThomasX(d, A->cx, A->ix, A->rx, A->dt, nx, ny, RADIUS, _nz-RADIUS);
+	Compute_ThomasY(d, A->cy, A->iy, A->ry, nx, ny, RADIUS, _nz-RADIUS);
+	Compute_ThomasZ(d, A->cz, A->iz, A->rz, nx, ny, RADIUS, m);
+
+	// Couple the segments, the domain ends stay fixed
+	const REAL *last = NULL, *first = NULL;
+	if (A->size > 1)
+	{
+		SolveInterfaces(A, d);
+		if (A->rank > 0) last = A->below;
+		if (A->rank < A->size-1) first = A->above;
+	}
+
+	REAL change = 0;
+	unsigned int k;
+	#pragma omp parallel for reduction(max:change) schedule(static)
+	for (k = 0; k < m; k++)
+	{
+		const REAL g = A->g[k], hk = A->h[k];
+		for (unsigned int j = 3; j < ny-3; j++)
+		{
+			REAL * __restrict__ q = u+XY*(RADIUS+k)+nx*j;
+			const REAL * __restrict__ p = d+XY*(RADIUS+k)+nx*j;
+			#pragma omp simd reduction(max:change)
+			for (unsigned int i = 3; i < nx-3; i++)
+			{
+				const REAL du = p[i]+(last ? g*last[i+nx*j] : 0)+(first ? hk*first[i+nx*j] : 0);
+				q[i] += du;
+				change = MAX(change, fabs(du));
+			}
+		}
+	}
+
+	// The neighbors' boundary planes become this rank's ghosts
+	if (h == NULL) return change;
+	HaloBegin(h);
+	for (int s = 0; s < 2; s++)
+	{
+		if (h->nbr[s] == MPI_PROC_NULL) continue;
+		CopyBoundaryRegionToGhostCell(u, HaloSendBuffer(h,s), nx, ny, _nz, s);
+		HaloSend(h,s);
+	}
+	for (int s = 0; s < 2; s++)
+	{
+		if (h->nbr[s] == MPI_PROC_NULL) continue;
+		CopyGhostCellToBoundaryRegion(u, HaloRecv(h,s), nx, ny, _nz, s);
+	}
+	HaloEnd(h);
+	return change;
+}
+
+void FinalizeAdi(Adi *A)
+{
+	free(A->cx); free(A->ix); free(A->cy); free(A->iy);
+	free(A->cz); free(A->iz); free(A->g); free(A->h);
+	free(A->alpha); free(A->gamma); free(A->ends[0]); free(A->ends[1]); free(A->below); free(A->above);
+	memset(A, 0, sizeof(Adi));
+}
@@ -0,0 +1,203 @@
+//
+//  Balance.c
+//  Diffusion3d-MPI-OpenMP
+//
+//  Created by Manuel Diaz on 7/26/16.
+//  Copyright © 2016 Manuel Diaz. All rights reserved.
+//
+
+#include "DiffusionMPI.h"
+
+/* A slab needs its two boundary regions apart from each other */
+#define MIN_PLANES (2*RADIUS)
+
+/*****************************************************/
+/* Global offsets of the subdomains from their sizes */
+/*****************************************************/
+static void SetOffsets(Decomposition *d)
+{
+	int r;
+	d->z0[0] = 0;
+	for (r = 1; r < d->size; r++) d->z0[r] = d->z0[r-1] + d->nz[r-1];
+}
+
+/*********************************************/
+/* Even split of Nz planes, remainder spread */
+/*********************************************/
+void InitializeDecomposition(Decomposition *d, int numberOfProcesses, unsigned int Nz)
+{
+	int r;
+	d->size = numberOfProcesses;
+	d->Nz = Nz;
+	d->min = MIN_PLANES;
+	d->nz = (unsigned int*)malloc(sizeof(unsigned int)*numberOfProcesses);
+	d->z0 = (unsigned int*)malloc(sizeof(unsigned int)*numberOfProcesses);
+	d->busy = (double*)malloc(sizeof(double)*numberOfProcesses);
+
+	for (r = 0; r < numberOfProcesses; r++)
+	{
+		d->nz[r] = Nz/numberOfProcesses + (r < (int)(Nz%numberOfProcesses) ? 1 : 0);
+		d->busy[r] = 0.;
+	}
+	SetOffsets(d);
+}
+
+void FinalizeDecomposition(Decomposition *d)
+{
+	free(d->nz);
+	free(d->z0);
+	free(d->busy);
+}
+
+/***********************************************************/
+/* Slab thickness proportional to weights (e.g. planes/s)  */
+/***********************************************************/
+void WeightedDecomposition(Decomposition *d, const double *weights)
+{
+	int r, n = d->size;
+	unsigned int total = 0;
+	double sum = 0., *share = (double*)malloc(sizeof(double)*n);
+
+	for (r = 0; r < n; r++) sum += weights[r];
+
+	// Floor of each share, but never thinner than d->min
+	for (r = 0; r < n; r++)
+	{
+		share[r] = d->Nz*weights[r]/sum;
+		d->nz[r] = MAX(d->min, (unsigned int)share[r]);
+		total += d->nz[r];
+	}
+
+	// Hand out missing planes by largest remainder, take excess from the thickest
+	while (total < d->Nz)
+	{
+		int best = 0;
+		for (r = 1; r < n; r++) if (share[r]-d->nz[r] > share[best]-d->nz[best]) best = r;
+		d->nz[best]++; total++;
+	}
+	while (total > d->Nz)
+	{
+		int best = 0;
+		for (r = 1; r < n; r++) if (d->nz[r] > d->nz[best]) best = r;
+		d->nz[best]--; total--;
+	}
+
+	free(share);
+	SetOffsets(d);
+}
+
+/*********************************************/
+/* Load imbalance: slowest over mean, minus 1 */
+/*********************************************/
+double Imbalance(const double *busy, int n)
+{
+	int r;
+	double max = 0., mean = 0.;
+	for (r = 0; r < n; r++) { max = MAX(max,busy[r]); mean += busy[r]/n; }
+	return mean > 0. ? max/mean-1. : 0.;
+}
+
+/*********************************************************/
+/* Global planes a rank is authoritative for, [lo,hi)    */
+/*********************************************************/
+static void Owned(const Decomposition *d, int r, unsigned int *lo, unsigned int *hi)
+{
+	// The end ranks also own the fixed boundary planes of the domain
+	*lo = r == 0 ? 0 : d->z0[r]+RADIUS;
+	*hi = r == d->size-1 ? d->Nz+2*RADIUS : d->z0[r]+RADIUS+d->nz[r];
+}
+
+/*************************************************************/
+/* Re-partitions by measured throughput, keeps the old one   */
+/*************************************************************/
+int Repartition(Decomposition *d, double busy, Decomposition *old)
+{
+	int r, n = d->size;
+
+	// Everybody learns how long everybody computed
+	MPI_CHECK(MPI_Allgather(&busy, 1, MPI_DOUBLE, d->busy, 1, MPI_DOUBLE, solverComm));
+	if (Imbalance(d->busy, n) < BALANCE_TOLERANCE) return 0;
+
+	// Keep the old partition around to know who holds what
+	InitializeDecomposition(old, n, d->Nz);
+	memcpy(old->nz, d->nz, sizeof(unsigned int)*n);
+	memcpy(old->z0, d->z0, sizeof(unsigned int)*n);
+	memcpy(old->busy, d->busy, sizeof(double)*n);
+
+	double *throughput = (double*)malloc(sizeof(double)*n);
+	for (r = 0; r < n; r++) throughput[r] = d->busy[r] > 0. ? d->nz[r]/d->busy[r] : 1.;
+	WeightedDecomposition(d, throughput);
+	free(throughput);
+
+	if (memcmp(old->nz, d->nz, sizeof(unsigned int)*n) == 0)
+	{
+		FinalizeDecomposition(old);
+		return 0;
+	}
+	return 1;
+}
+
+void ReportRepartition(const Decomposition *old, const Decomposition *d, const char *units)
+{
+	int r;
+	printf("Rebalance: imbalance %.1f%%, %s per rank", 100*Imbalance(old->busy,old->size), units);
+	for (r = 0; r < d->size; r++) printf(" %u->%u", old->nz[r], d->nz[r]);
+	printf("\n");
+}
+
+/*************************************************************/
+/* Re-partitions the planes and migrates them between ranks  */
+/*************************************************************/
+int Rebalance(Decomposition *d, int rank, double busy, REAL **q, REAL **qo, REAL **Lq, unsigned int nx, unsigned int ny)
+{
+	int r, n = d->size;
+	Decomposition old;
+	if (!Repartition(d, busy, &old)) return 0;
+
+	// Every rank needs its new planes plus ghosts; whoever owned them sends them
+	int *sendcounts = (int*)calloc(n,sizeof(int)), *sdispls = (int*)calloc(n,sizeof(int));
+	int *recvcounts = (int*)calloc(n,sizeof(int)), *rdispls = (int*)calloc(n,sizeof(int));
+	unsigned int lo, hi, need_lo, need_hi;
+
+	Owned(&old, rank, &lo, &hi);
+	for (r = 0; r < n; r++)
+	{
+		need_lo = MAX(d->z0[r], lo); need_hi = MIN(d->z0[r]+d->nz[r]+2*RADIUS, hi);
+		if (need_lo < need_hi) { sendcounts[r] = need_hi-need_lo; sdispls[r] = need_lo-old.z0[rank]; }
+	}
+	for (r = 0; r < n; r++)
+	{
+		Owned(&old, r, &lo, &hi);
+		need_lo = MAX(d->z0[rank], lo); need_hi = MIN(d->z0[rank]+d->nz[rank]+2*RADIUS, hi);
+		if (need_lo < need_hi) { recvcounts[r] = need_hi-need_lo; rdispls[r] = need_lo-d->z0[rank]; }
+	}
+
+	MPI_Datatype plane;
+	MPI_CHECK(MPI_Type_contiguous(nx*ny, MPI_CUSTOM_REAL, &plane));
+	MPI_CHECK(MPI_Type_commit(&plane));
+
+	// Re-allocate the subdomain arrays at their new thickness
+	const size_t _NZ = d->nz[rank]+2*RADIUS;
+	REAL *u = (REAL*)malloc(sizeof(REAL)*nx*ny*_NZ);
+	#pragma omp parallel for schedule(static)
+	for (unsigned int k = 0; k < _NZ; k++) memset(u+nx*ny*k, 0, sizeof(REAL)*nx*ny); // first touch
+	MPI_CHECK(MPI_Alltoallv(*q, sendcounts, sdispls, plane, u, recvcounts, rdispls, plane, solverComm));
+	MPI_CHECK(MPI_Type_free(&plane));
+	free(*q); free(*qo); free(*Lq);
+	*q = u;
+	*qo = (REAL*)malloc(sizeof(REAL)*nx*ny*_NZ);
+	*Lq = (REAL*)malloc(sizeof(REAL)*nx*ny*_NZ);
+
+	#pragma omp parallel for schedule(static)
+	for (unsigned int k = 0; k < _NZ; k++)
+	{
+		memset(*qo+nx*ny*k, 0, sizeof(REAL)*nx*ny);
+		memset(*Lq+nx*ny*k, 0, sizeof(REAL)*nx*ny);
+	}
+
+	if (rank == 0) ReportRepartition(&old, d, "planes");
+
+	free(sendcounts); free(sdispls); free(recvcounts); free(rdispls);
+	FinalizeDecomposition(&old);
+	return 1;
+}
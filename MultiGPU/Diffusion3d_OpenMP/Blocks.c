@@ -0,0 +1,260 @@
+//
+//  Blocks.c
+//  Diffusion3d-MPI-OpenMP
+//
+//  Created by Manuel Diaz on 7/26/16.
+//  Copyright © 2016 Manuel Diaz. All rights reserved.
+//
+
+#include "DiffusionMPI.h"
+
+/* Tag of a message carrying block g, clear of the halo tags */
+#define TAG(g) (16+(g))
+
+/* Rank holding block g */
+static int Owner(const Decomposition *d, unsigned int g)
+{
+	int r;
+	for (r = 0; r < d->size-1; r++) if (g < d->z0[r]+d->nz[r]) break;
+	return r;
+}
+
+static void AllocateBlock(Block *b, unsigned int nx, unsigned int ny)
+{
+	const size_t n = (size_t)nx*ny*(b->nz+2*RADIUS);
+	b->u  = (REAL*)malloc(sizeof(REAL)*n);
+	b->uo = (REAL*)malloc(sizeof(REAL)*n);
+	b->Lu = (REAL*)malloc(sizeof(REAL)*n);
+	memset(b->uo, 0, sizeof(REAL)*n);
+	memset(b->Lu, 0, sizeof(REAL)*n);
+}
+
+static void FreeBlock(Block *b)
+{
+	free(b->u); free(b->uo); free(b->Lu);
+	b->u = b->uo = b->Lu = NULL;
+}
+
+/**************************************************************/
+/* Splits Nz into blocksPerRank blocks per rank, owns its run */
+/**************************************************************/
+void InitializeBlocks(BlockSet *s, int rank, int numberOfProcesses, int blocksPerRank, const REAL *h_u, unsigned int nx, unsigned int ny, unsigned int Nz)
+{
+	Decomposition planes;
+	int g;
+
+	s->rank = rank;
+	s->nx = nx;
+	s->ny = ny;
+	s->count = numberOfProcesses*blocksPerRank;
+
+	// Blocks are slabs of the global domain, thick enough to hold both boundary regions
+	InitializeDecomposition(&planes, s->count, Nz);
+	if (Nz < s->count*planes.min)
+	{
+		if (rank == 0) printf("Nz = %u is too thin for %u blocks of at least %u planes\n", Nz, s->count, planes.min);
+		fflush(stdout);
+		MPI_Abort(solverComm, 1);
+	}
+	s->b = (Block*)malloc(sizeof(Block)*s->count);
+	for (g = 0; g < (int)s->count; g++)
+	{
+		s->b[g].z0 = planes.z0[g];
+		s->b[g].nz = planes.nz[g];
+		s->b[g].u = s->b[g].uo = s->b[g].Lu = NULL;
+	}
+	FinalizeDecomposition(&planes);
+
+	// Ranks start with the same number of blocks, moved later a whole block at a time
+	InitializeDecomposition(&s->owner, numberOfProcesses, s->count);
+	s->owner.min = 1;
+
+	// Each block is first touched by the thread most likely to update it
+	const int first = s->owner.z0[rank], last = first+s->owner.nz[rank];
+	#pragma omp parallel for schedule(static,1)
+	for (g = first; g < last; g++)
+	{
+		AllocateBlock(&s->b[g], nx, ny);
+		Init_subdomain(h_u, s->b[g].u, s->b[g].z0, nx, ny, s->b[g].nz);
+	}
+}
+
+void FinalizeBlocks(BlockSet *s)
+{
+	unsigned int g;
+	for (g = 0; g < s->count; g++) FreeBlock(&s->b[g]);
+	free(s->b);
+	FinalizeDecomposition(&s->owner);
+}
+
+/**************************************************************/
+/* One SSP-RK3 step over the owned blocks as a task graph,    */
+/* returns max|u^(n+1)-u^n| over them                         */
+/**************************************************************/
+REAL BlockStep(BlockSet *s, Halo *h, REAL kx, REAL ky, REAL kz, REAL dt)
+{
+	const unsigned int first = s->owner.z0[s->rank], last = first+s->owner.nz[s->rank]-1;
+	const unsigned int nx = s->nx, ny = s->ny;
+	Block *b = s->b;
+
+	// Tasks of a block are chained through its arrays, MPI calls through the halo
+	// itself so one thread at a time talks to MPI and sends always precede receives.
+	// Blocks facing another rank go first; the interior ones, the copies between
+	// blocks and the next stage of blocks already updated overlap the exchange.
+	#pragma omp parallel
+	#pragma omp single
+	{
+		unsigned int g, step, i;
+		int side;
+
+		// Runge Kutta Step 0
+		for (g = first; g <= last; g++)
+		{
+			Block *bg = &b[g];
+			#pragma omp task firstprivate(bg) depend(in: bg->u[0]) depend(out: bg->uo[0])
+			memcpy(bg->uo, bg->u, sizeof(REAL)*nx*ny*(bg->nz+2*RADIUS));
+		}
+
+		// Runge Kutta Steps 1-3
+		for (step = 1; step <= 3; step++)
+		{
+			#pragma omp task depend(inout: h[0])
+			HaloBegin(h);
+
+			// Edge blocks, then the ones in between
+			for (i = 0; i <= last-first; i++)
+			{
+				g = i == 0 ? first : i == 1 ? last : first+i-1;
+				Block *bg = &b[g];
+				#pragma omp task firstprivate(bg) depend(in: bg->u[0]) depend(out: bg->Lu[0]) priority(i < 2 ? 1 : 0)
+				Compute_Laplace3d(bg->u, bg->Lu, kx, ky, kz, nx, ny, bg->nz+2*RADIUS, RADIUS, bg->nz+RADIUS);
+			}
+
+			// Pack and send faces as soon as the edge blocks are done
+			for (side = 0; side < 2; side++)
+			{
+				if (h->nbr[side] == MPI_PROC_NULL) continue;
+				Block *bg = &b[side == LEFT ? first : last];
+				#pragma omp task firstprivate(bg,side) depend(in: bg->Lu[0]) depend(inout: h[0]) priority(1)
+				{
+					CopyBoundaryRegionToGhostCell(bg->Lu, HaloSendBuffer(h,side), nx, ny, bg->nz+2*RADIUS, side);
+					HaloSend(h,side);
+				}
+			}
+
+			// Receive faces from the neighbor ranks
+			for (side = 0; side < 2; side++)
+			{
+				if (h->nbr[side] == MPI_PROC_NULL) continue;
+				Block *bg = &b[side == LEFT ? first : last];
+				#pragma omp task firstprivate(bg,side) depend(inout: bg->Lu[0]) depend(inout: h[0])
+				CopyGhostCellToBoundaryRegion(bg->Lu, HaloRecv(h,side), nx, ny, bg->nz+2*RADIUS, side);
+			}
+
+			// Blocks of this rank fill each other's ghosts directly
+			for (g = first; g < last; g++)
+			{
+				Block *lo = &b[g], *hi = &b[g+1];
+				#pragma omp task firstprivate(lo,hi) depend(inout: lo->Lu[0]) depend(inout: hi->Lu[0])
+				{
+					CopyBoundaryRegionToGhostCell(lo->Lu, hi->Lu, nx, ny, lo->nz+2*RADIUS, RIGHT);
+					CopyBoundaryRegionToGhostCell(hi->Lu, lo->Lu+nx*ny*(lo->nz+RADIUS), nx, ny, hi->nz+2*RADIUS, LEFT);
+				}
+			}
+
+			// Faces are unpacked, release neighbors and finish sends
+			#pragma omp task depend(inout: h[0])
+			HaloEnd(h);
+
+			for (g = first; g <= last; g++)
+			{
+				Block *bg = &b[g];
+				#pragma omp task firstprivate(bg,step) depend(inout: bg->u[0]) depend(in: bg->uo[0]) depend(in: bg->Lu[0])
+				bg->change = Compute_sspRK(bg->u, bg->uo, bg->Lu, step, dt, nx, ny, bg->nz+2*RADIUS);
+			}
+		}
+	}
+
+	REAL change = 0;
+	for (unsigned int g = first; g <= last; g++) change = fmax(change, b[g].change);
+	return change;
+}
+
+/**************************************************************/
+/* Re-partitions by throughput and migrates whole blocks      */
+/**************************************************************/
+int RebalanceBlocks(BlockSet *s, double busy)
+{
+	Decomposition old;
+	unsigned int g;
+	int from, to, n = 0;
+
+	if (!Repartition(&s->owner, busy, &old)) return 0;
+
+	// Only u travels: uo is refreshed at step 0 and Lu recomputed every stage
+	MPI_Request *req = (MPI_Request*)malloc(sizeof(MPI_Request)*s->count);
+	for (g = 0; g < s->count; g++)
+	{
+		from = Owner(&old, g); to = Owner(&s->owner, g);
+		if (from == to) continue;
+
+		Block *bg = &s->b[g];
+		const int size = s->nx*s->ny*(bg->nz+2*RADIUS);
+		if (s->rank == from) MPI_CHECK(MPI_Isend(bg->u, size, MPI_CUSTOM_REAL, to, TAG(g), solverComm, &req[n++]));
+		if (s->rank == to)
+		{
+			AllocateBlock(bg, s->nx, s->ny);
+			MPI_CHECK(MPI_Irecv(bg->u, size, MPI_CUSTOM_REAL, from, TAG(g), solverComm, &req[n++]));
+		}
+	}
+	MPI_CHECK(MPI_Waitall(n, req, MPI_STATUSES_IGNORE));
+	free(req);
+
+	for (g = 0; g < s->count; g++)
+	{
+		if (Owner(&old, g) == s->rank && Owner(&s->owner, g) != s->rank) FreeBlock(&s->b[g]);
+	}
+
+	if (s->rank == 0) ReportRepartition(&old, &s->owner, "blocks");
+	FinalizeDecomposition(&old);
+	return 1;
+}
+
+/* Interior planes each rank holds */
+void BlockPlanes(const BlockSet *s, unsigned int *planes)
+{
+	unsigned int g;
+	for (int r = 0; r < s->owner.size; r++) planes[r] = 0;
+	for (g = 0; g < s->count; g++) planes[Owner(&s->owner, g)] += s->b[g].nz;
+}
+
+/**************************************************************/
+/* Gathers every block into the global domain on rank 0       */
+/**************************************************************/
+void GatherBlocks(BlockSet *s, REAL *h_u)
+{
+	unsigned int g;
+
+	for (g = 0; g < s->count; g++)
+	{
+		Block *bg = &s->b[g];
+		const int owner = Owner(&s->owner, g), size = s->nx*s->ny*(bg->nz+2*RADIUS);
+
+		if (s->rank == 0)
+		{
+			if (owner == 0)
+			{
+				Merge_domains(bg->u, h_u, bg->z0, s->nx, s->ny, bg->nz);
+				continue;
+			}
+			REAL *h_s_recvbuff = (REAL*)malloc(sizeof(REAL)*size);
+			MPI_CHECK(MPI_Recv(h_s_recvbuff, size, MPI_CUSTOM_REAL, owner, TAG(g), solverComm, MPI_STATUS_IGNORE));
+			Merge_domains(h_s_recvbuff, h_u, bg->z0, s->nx, s->ny, bg->nz);
+			free(h_s_recvbuff);
+		}
+		else if (s->rank == owner)
+		{
+			MPI_CHECK(MPI_Send(bg->u, size, MPI_CUSTOM_REAL, 0, TAG(g), solverComm));
+		}
+	}
+}
@@ -0,0 +1,158 @@
+//
+//  Cache.c
+//  Diffusion3d-MPI-OpenMP
+//
+//  Created by Manuel Diaz on 7/26/16.
+//  Copyright © 2016 Manuel Diaz. All rights reserved.
+//
+
+#include "DiffusionMPI.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifndef CODE_VERSION
+	#define CODE_VERSION "unknown"
+#endif
+
+/*****************************************************************/
+/* Result store: <root>/<key>/ holds the states reached by runs  */
+/* of one configuration, <iterations>.fld with a line of         */
+/* diagnostics in <iterations>.txt, and config.txt, the text the */
+/* key hashes. Results do not depend on ranks, blocks or the     */
+/* -halo path (bit for bit), so these stay out of the key; its   */
+/* radius is the stencil's RADIUS. The key names the default     */
+/* scheme and step only: runs with RKL2 or ADI, -dt or -tend are */
+/* never cached                                                  */
+/*****************************************************************/
+
+/* FNV-1a, 64 bits */
+static uint64_t Hash(uint64_t h, const void *data, size_t n)
+{
+	const unsigned char *p = (const unsigned char*)data;
+	for (size_t i = 0; i < n; i++) { h ^= p[i]; h *= 1099511628211ULL; }
+	return h;
+}
+
+int CacheKey(Cache *c, const char *root, REAL K, REAL L, REAL W, REAL H, unsigned int nx, unsigned int ny, unsigned int nz, const char *icFile)
+{
+	char ic[64];
+	if (icFile)
+	{
+		// The initial condition by content, wherever it lives
+		Field f;
+		if (!OpenField(&f, icFile, 0)) return 0;
+		const FieldHeader *h = f.header;
+		uint64_t key = Hash(14695981039346656037ULL, &h->nx, 3*sizeof(uint32_t));
+		key = Hash(key, f.data, (size_t)h->bytes*h->nx*h->ny*h->nz);
+		sprintf(ic, "field %u bytes %016llx", h->bytes, (unsigned long long)key);
+		CloseField(&f);
+	}
+	else
+	{
+		sprintf(ic, "Init_domain 1");
+	}
+
+	snprintf(c->config, sizeof(c->config),
+		"scheme SSP-RK3 FD4, REAL %d bytes, radius %d, code %s\nK %.17g L %.17g W %.17g H %.17g\nNx %u Ny %u Nz %u CFL 0.8\nIC %s\n",
+		(int)sizeof(REAL), RADIUS, CODE_VERSION, (double)K, (double)L, (double)W, (double)H, nx, ny, nz, ic);
+	c->key = Hash(14695981039346656037ULL, c->config, strlen(c->config));
+	snprintf(c->root, sizeof(c->root), "%s", root);
+	snprintf(c->dir, sizeof(c->dir), "%s/%016llx", root, (unsigned long long)c->key);
+	return 1;
+}
+
+/*****************************************************************/
+/* Latest stored state not past max_iters, 0 if there is none    */
+/*****************************************************************/
+int CacheLookup(const Cache *c, int max_iters, char *field)
+{
+	char name[CACHE_PATH], config[sizeof(c->config)];
+	int best = 0, iters;
+
+	// A key collision is a miss
+	snprintf(name, sizeof(name), "%s/config.txt", c->dir);
+	FILE *pFile = fopen(name, "r");
+	if (pFile == NULL) return 0;
+	size_t n = fread(config, 1, sizeof(config)-1, pFile);
+	config[n] = '\0';
+	fclose(pFile);
+	if (strcmp(config, c->config) != 0) return 0;
+
+	DIR *d = opendir(c->dir);
+	if (d == NULL) return 0;
+	for (struct dirent *e = readdir(d); e; e = readdir(d))
+	{
+		char suffix[8];
+		if (sscanf(e->d_name, "%d.%7s", &iters, suffix) == 2 && strcmp(suffix, "fld") == 0 && iters <= max_iters && iters > best) best = iters;
+	}
+	closedir(d);
+	if (best > 0) snprintf(field, CACHE_PATH, "%s/%d.fld", c->dir, best);
+	return best;
+}
+
+static int CopyFile(const char *from, const char *to)
+{
+	char buffer[1<<16];
+	ssize_t n;
+	int in = open(from, O_RDONLY), out = open(to, O_WRONLY|O_CREAT|O_TRUNC, 0644), ok = in >= 0 && out >= 0;
+	while (ok && (n = read(in, buffer, sizeof(buffer))) > 0) ok = write(out, buffer, n) == n;
+	if (in >= 0) close(in);
+	if (out >= 0) close(out);
+	return ok;
+}
+
+/*****************************************************************/
+/* Keeps a state, written aside and renamed so that concurrent   */
+/* runs never see half of it                                     */
+/*****************************************************************/
+void CacheStore(const Cache *c, const char *field, int iters, const char *diagnostics)
+{
+	char name[CACHE_PATH], temp[CACHE_PATH];
+
+	mkdir(c->root, 0755);
+	mkdir(c->dir, 0755);
+	snprintf(name, sizeof(name), "%s/config.txt", c->dir);
+	FILE *pFile = fopen(name, "w");
+	if (pFile == NULL)
+	{
+		printf("Unable to store results in %s\n", c->dir);
+		return;
+	}
+	fputs(c->config, pFile);
+	fclose(pFile);
+
+	snprintf(name, sizeof(name), "%s/%d.txt", c->dir, iters);
+	pFile = fopen(name, "w");
+	fputs(diagnostics, pFile);
+	fclose(pFile);
+
+	snprintf(name, sizeof(name), "%s/%d.fld", c->dir, iters);
+	snprintf(temp, sizeof(temp), "%s/%d.fld.%d", c->dir, iters, (int)getpid());
+	if (CopyFile(field, temp)) rename(temp, name);
+	else unlink(temp);
+}
+
+/*****************************************************************/
+/* A hit: the stored state becomes result.fld and result.bin     */
+/*****************************************************************/
+int CacheRestore(const Cache *c, const char *field, int iters)
+{
+	char name[CACHE_PATH], line[256];
+	Field f;
+
+	if (!CopyFile(field, "result.fld") || !OpenField(&f, "result.fld", 0)) return 0;
+	const FieldHeader *h = f.header;
+	REAL *fallback = h->bytes == sizeof(REAL) ? NULL : (REAL*)malloc(sizeof(REAL)*h->nx*h->ny*h->nz);
+	if (WRITE) SaveBinary3D(FieldView(&f, fallback), h->nx, h->ny, h->nz, "result.bin");
+	free(fallback);
+	CloseField(&f);
+
+	printf("Result cache hit                             :  %s\n", field);
+	snprintf(name, sizeof(name), "%s/%d.txt", c->dir, iters);
+	FILE *pFile = fopen(name, "r");
+	while (pFile && fgets(line, sizeof(line), pFile)) printf("Stored: %s", line);
+	if (pFile) fclose(pFile);
+	return 1;
+}
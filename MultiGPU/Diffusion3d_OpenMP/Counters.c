@@ -0,0 +1,212 @@
+//
+//  Counters.c
+//  Diffusion3d-MPI-OpenMP
+//
+//  Created by Manuel Diaz on 7/26/16.
+//  Copyright © 2016 Manuel Diaz. All rights reserved.
+//
+
+#include "DiffusionMPI.h"
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/*****************************************************************/
+/* Hardware counters per solver phase: every OpenMP thread gets  */
+/* one perf_event_open group, opened by the master thread on the */
+/* thread's id and read by it as one record around each phase,   */
+/* so the counts cover the whole team. Events the PMU, the       */
+/* hypervisor or perf_event_paranoid refuse are left out; with   */
+/* none at all the counters switch off and the solver runs as    */
+/* usual. FLOP and byte rates are those the kernels perform by   */
+/* construction, generic perf events have no FP operation count. */
+/* With RAPL the node's energy is read around each phase too     */
+/*****************************************************************/
+
+static const struct { uint32_t type; uint64_t config; } Events[COUNTER_EVENTS] = {
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+};
+
+static const char *PhaseName[COUNTER_PHASES] = {"rk copy", "laplacian", "pack", "exchange", "unpack", "rk update", "step (tasks)"};
+
+static int Open(int e, pid_t tid, int group)
+{
+	struct perf_event_attr a;
+	memset(&a, 0, sizeof(a));
+	a.size = sizeof(a);
+	a.type = Events[e].type;
+	a.config = Events[e].config;
+	a.read_format = PERF_FORMAT_GROUP;
+	a.exclude_kernel = 1; // all perf_event_paranoid allows without privileges
+	a.exclude_hv = 1;
+	return syscall(__NR_perf_event_open, &a, tid, -1, group, 0);
+}
+
+void InitializeCounters(Counters *C, int on, int rank, Energy *E)
+{
+	int e, t;
+	memset(C, 0, sizeof(Counters));
+	C->threads = omp_get_max_threads();
+	for (e = 0; e < COUNTER_EVENTS; e++) C->slot[e] = -1;
+	if (!on) return;
+
+	pid_t *tid = (pid_t*)malloc(sizeof(pid_t)*C->threads);
+	#pragma omp parallel
+	tid[omp_get_thread_num()] = syscall(SYS_gettid);
+
+	// The events of the first thread decide the layout of every group
+	C->fd = (int*)malloc(sizeof(int)*C->threads*COUNTER_EVENTS);
+	for (t = 0; t < C->threads*COUNTER_EVENTS; t++) C->fd[t] = -1;
+	int error = 0;
+	for (e = 0; e < COUNTER_EVENTS; e++)
+	{
+		int fd = Open(e, tid[0], C->events > 0 ? C->fd[0] : -1);
+		if (fd < 0) { if (error == 0) error = errno; continue; }
+		C->fd[C->events] = fd;
+		C->slot[e] = C->events++;
+	}
+	for (t = 1; t < C->threads && C->events > 0; t++)
+	{
+		int *fd = C->fd+t*COUNTER_EVENTS;
+		for (e = 0; e < COUNTER_EVENTS; e++)
+		{
+			if (C->slot[e] < 0) continue;
+			fd[C->slot[e]] = Open(e, tid[t], C->slot[e] > 0 ? fd[0] : -1);
+			if (fd[C->slot[e]] < 0) { error = errno; C->events = 0; break; }
+		}
+	}
+	free(tid);
+
+	if (C->events == 0)
+	{
+		if (rank == 0) printf("Hardware counters unavailable (%s), running without them\n", strerror(error));
+		FinalizeCounters(C);
+		return;
+	}
+	if (rank == 0 && C->slot[0] < 0) printf("Hardware counters unavailable (%s), counting CPU time only\n", strerror(error));
+	C->start = (uint64_t*)malloc(sizeof(uint64_t)*C->threads*COUNTER_EVENTS);
+	C->now = (uint64_t*)malloc(sizeof(uint64_t)*C->threads*COUNTER_EVENTS);
+	C->read = (unsigned char*)malloc(C->threads);
+	C->energy = E->on ? E : NULL;
+	C->on = 1;
+}
+
+/* Counts of every thread, read as one group each; a failed read clears the thread's flag */
+static void Read(Counters *C, uint64_t *counts)
+{
+	uint64_t record[1+COUNTER_EVENTS];
+	for (int t = 0; t < C->threads; t++)
+	{
+		if (read(C->fd[t*COUNTER_EVENTS], record, sizeof(uint64_t)*(1+C->events)) <= 0 || (int)record[0] < C->events)
+		{
+			C->read[t] = 0;
+			continue;
+		}
+		for (int i = 0; i < C->events; i++) counts[t*COUNTER_EVENTS+i] = record[1+i];
+	}
+}
+
+void CountersBegin(Counters *C, int phase)
+{
+	if (!C->on) return;
+	C->phase = phase;
+	if (C->energy) C->e0 = EnergySample(C->energy);
+	memset(C->read, 1, C->threads);
+	Read(C, C->start);
+	C->t0 = MPI_Wtime();
+}
+
+/* flops and bytes are those of the work just done, for the rates */
+void CountersEnd(Counters *C, double flops, double bytes)
+{
+	if (!C->on) return;
+	const int p = C->phase;
+	const uint64_t *now = C->now;
+
+	C->time[p] += MPI_Wtime()-C->t0;
+	Read(C, C->now);
+	if (C->energy) C->joules[p] += EnergySample(C->energy)-C->e0;
+	// Threads whose counts could not be read around the phase leave it out
+	for (int e = 0; e < COUNTER_EVENTS; e++)
+	{
+		if (C->slot[e] < 0) continue;
+		for (int t = 0; t < C->threads; t++)
+		{
+			if (C->read[t]) C->count[p][e] += now[t*COUNTER_EVENTS+C->slot[e]]-C->start[t*COUNTER_EVENTS+C->slot[e]];
+		}
+	}
+	C->flops[p] += flops;
+	C->bytes[p] += bytes;
+	C->calls[p]++;
+}
+
+/*****************************************************************/
+/* One line per phase and rank, gathered on rank 0               */
+/*****************************************************************/
+void ReportCounters(const Counters *C, int rank, int numberOfProcesses)
+{
+	// calls, time, CPU time, IPC, LLC miss ratio, DRAM estimate, GFLOP/s, GB/s, joules, -1 where unknown
+	enum { FIELDS = 9 };
+	double row[COUNTER_PHASES][FIELDS], *all = NULL;
+	int on = C->on, any = 0;
+
+	MPI_CHECK(MPI_Allreduce(&on, &any, 1, MPI_INT, MPI_MAX, solverComm));
+	if (!any) return;
+
+	int has[COUNTER_EVENTS];
+	for (int e = 0; e < COUNTER_EVENTS; e++) has[e] = C->slot[e] >= 0;
+	for (int p = 0; p < COUNTER_PHASES; p++)
+	{
+		const double *n = C->count[p], time = C->time[p];
+		row[p][0] = C->calls[p];
+		row[p][1] = time;
+		row[p][2] = has[4] ? n[4]*1e-9 : -1;
+		row[p][3] = has[0] && has[1] && n[0] > 0 ? n[1]/n[0] : -1;
+		row[p][4] = has[2] && has[3] && n[2] > 0 ? 100*n[3]/n[2] : -1;
+		row[p][5] = has[3] && time > 0 ? 64*n[3]/time*1e-9 : -1; // a line per miss
+		row[p][6] = C->flops[p] > 0 && time > 0 ? C->flops[p]/time*1e-9 : -1;
+		row[p][7] = C->bytes[p] > 0 && time > 0 ? C->bytes[p]/time*1e-9 : -1;
+		row[p][8] = C->energy ? C->joules[p] : -1; // of the whole node
+	}
+	if (rank == 0) all = (double*)malloc(sizeof(row)*numberOfProcesses);
+	MPI_CHECK(MPI_Gather(row, COUNTER_PHASES*FIELDS, MPI_DOUBLE, all, COUNTER_PHASES*FIELDS, MPI_DOUBLE, 0, solverComm));
+	if (rank != 0) return;
+
+	printf("Counters per phase, user space of all threads ('-' where unavailable)\n");
+	printf("%-13s %4s %8s %10s %10s %6s %7s %8s %8s %8s %9s\n", "phase", "rank", "calls", "time s", "CPU s", "IPC", "LLC %", "LLC GB/s", "GFLOP/s", "GB/s", "node J");
+	for (int p = 0; p < COUNTER_PHASES; p++)
+	{
+		for (int r = 0; r < numberOfProcesses; r++)
+		{
+			const double *f = all+(r*COUNTER_PHASES+p)*FIELDS;
+			char v[7][16];
+			if (f[0] == 0) continue;
+			for (int i = 0; i < 7; i++)
+			{
+				if (f[2+i] < 0) sprintf(v[i], "-");
+				else sprintf(v[i], i == 1 ? "%.2f" : i == 0 || i == 6 ? "%.4f" : "%.1f", f[2+i]);
+			}
+			printf("%-13s %4d %8.0f %10.4f %10s %6s %7s %8s %8s %8s %9s\n", PhaseName[p], r, f[0], f[1], v[0], v[1], v[2], v[3], v[4], v[5], v[6]);
+		}
+	}
+	free(all);
+}
+
+void FinalizeCounters(Counters *C)
+{
+	if (C->fd) for (int t = 0; t < C->threads*COUNTER_EVENTS; t++) if (C->fd[t] >= 0) close(C->fd[t]);
+	free(C->fd);
+	free(C->start);
+	free(C->now);
+	free(C->read);
+	C->fd = NULL;
+	C->start = C->now = NULL;
+	C->read = NULL;
+	C->energy = NULL;
+	C->on = 0;
+}
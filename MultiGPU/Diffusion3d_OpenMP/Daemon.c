@@ -0,0 +1,274 @@
+//
+//  Daemon.c
+//  Diffusion3d-MPI-OpenMP
+//
+//  Created by Manuel Diaz on 7/26/16.
+//  Copyright © 2016 Manuel Diaz. All rights reserved.
+//
+
+#include "DiffusionMPI.h"
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+/*****************************************************************/
+/* Long-lived single-rank solver: jobs arrive on a Unix socket   */
+/* (Diffusion3d.submit), wait in a queue and run one at a time.  */
+/* The OpenMP team stays up between jobs and solvers of finished */
+/* jobs are kept, arrays paged in, for the next job on the same  */
+/* grid. Jobs read and write files as the daemon's owner, so the */
+/* socket is private and only that user is served. One request   */
+/* per connection, answered in text lines:                       */
+/*   run K L W H Nx Ny Nz max_iters [-integrator name] [-dt dt]  */
+/*       [-tend T] [-ic field] [-o field] [-progress N]          */
+/*   status                                                      */
+/*   shutdown          (once the queue is empty)                 */
+/*****************************************************************/
+
+typedef struct {
+	int fd;                   // client waiting for the answer
+	int id;
+	char line[DAEMON_LINE];
+} Job;
+
+typedef struct {
+	Solver *idle[DAEMON_QUEUE];
+	int count;
+	size_t bytes, budget;
+	int hits, misses;
+} Pool;
+
+static size_t SolverBytes(const Solver *s)
+{
+	return (s->slab.um ? 5 : 3)*sizeof(REAL)*s->nx*s->ny*(s->nz+2*RADIUS);
+}
+
+/* An idle solver of this grid, or a new one */
+static Solver *Acquire(Pool *p, double K, double L, double W, double H, unsigned int nx, unsigned int ny, unsigned int nz,
+	const char *integrator, double dt, const char *ic, int *pooled)
+{
+	for (int i = 0; i < p->count; i++)
+	{
+		Solver *s = p->idle[i];
+		if (s->nx != nx || s->ny != ny || s->nz != nz) continue;
+
+		// A bad IC leaves the solver in the pool, with the arrays of its new integrator
+		const size_t bytes = SolverBytes(s);
+		const int reset = SolverReset(s, K, L, W, H, integrator, dt, ic);
+		p->bytes += SolverBytes(s)-bytes;
+		if (!reset) return NULL;
+		p->idle[i] = p->idle[--p->count];
+		p->bytes -= SolverBytes(s);
+		*pooled = 1; p->hits++;
+		return s;
+	}
+	*pooled = 0; p->misses++;
+	return SolverCreate(K, L, W, H, nx, ny, nz, integrator, dt, ic);
+}
+
+/* Keeps a solver for later jobs, the oldest go first when over budget */
+static void Release(Pool *p, Solver *s)
+{
+	p->idle[p->count++] = s;
+	p->bytes += SolverBytes(s);
+	while (p->count > 0 && (p->bytes > p->budget || p->count == DAEMON_QUEUE))
+	{
+		p->bytes -= SolverBytes(p->idle[0]);
+		SolverDestroy(p->idle[0]);
+		memmove(p->idle, p->idle+1, sizeof(Solver*)*(--p->count));
+	}
+}
+
+/* Peers of another user are refused */
+static int Trusted(int fd)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+	return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == getuid();
+}
+
+/* Reads one line, the request, from a fresh connection; a silent client times out */
+static int ReadLine(int fd, char *line, size_t size)
+{
+	size_t n = 0;
+	while (n < size-1)
+	{
+		ssize_t r = read(fd, line+n, 1);
+		if (r < 0) return 0;
+		if (r == 0 || line[n] == '\n') break;
+		n++;
+	}
+	line[n] = '\0';
+	return n > 0;
+}
+
+static void RunJob(Pool *pool, const Job *job)
+{
+	char line[DAEMON_LINE], *argv[32];
+	int argc = 0;
+
+	strcpy(line, job->line);
+	for (char *tok = strtok(line, " \t"); tok && argc < 32; tok = strtok(NULL, " \t")) argv[argc++] = tok;
+	if (argc < 9 || argc%2 == 0)
+	{
+		dprintf(job->fd, "error: run K L W H Nx Ny Nz max_iters [-integrator ssprk3|rkl2|adi] [-dt dt] [-tend T] [-ic field] [-o field] [-progress N]\n");
+		return;
+	}
+
+	const double K = atof(argv[1]), L = atof(argv[2]), W = atof(argv[3]), H = atof(argv[4]);
+	const unsigned int nx = atoi(argv[5]), ny = atoi(argv[6]), nz = atoi(argv[7]);
+	const int max_iters = atoi(argv[8]);
+	const char *integrator = GetOption(argc,argv,"-integrator",INTEGRATOR);
+	const double dt = atof(GetOption(argc,argv,"-dt","0"));
+	const char *tEndOption = GetOption(argc,argv,"-tend",NULL);
+	const char *ic = GetOption(argc,argv,"-ic",NULL);
+	const char *out = GetOption(argc,argv,"-o",NULL);
+	const int progress = atoi(GetOption(argc,argv,"-progress","0"));
+	int pooled;
+
+	double setup_timer = -omp_get_wtime();
+	Solver *s = Acquire(pool, K, L, W, H, nx, ny, nz, integrator, dt, ic, &pooled);
+	setup_timer += omp_get_wtime();
+	if (s == NULL)
+	{
+		dprintf(job->fd, "error: unable to set up a %u x %u x %u run%s%s\n", nx, ny, nz, ic ? " from " : "", ic ? ic : "");
+		return;
+	}
+
+	// The driver's time loop, max_iters counts from t=0
+	const double tEnd = tEndOption ? atof(tEndOption) : (double)s->slab.dt*max_iters;
+	const long it0 = s->it;
+	double compute_timer = -omp_get_wtime();
+	int streaming = progress > 0;
+	while (streaming && s->t < (REAL)tEnd)
+	{
+		SolverStep(s, 1);
+
+		// A client that stops reading costs one timeout, then the job runs on without its lines
+		if (s->it%progress == 0 && dprintf(job->fd, "step %ld t %g\n", s->it, (double)s->t) < 0) streaming = 0;
+	}
+	SolverAdvanceTo(s, tEnd);
+	compute_timer += omp_get_wtime();
+
+	if (out) SolverSave(s, out);
+	float gflops = CalcGflops(compute_timer, s->it-it0, s->slab.stages, nx, ny, nz+2*RADIUS);
+	dprintf(job->fd, "done job %d: %ld steps, t %g, setup %.4f s (%s), compute %.4f s, %.2f GFLOPS%s%s\n",
+		job->id, s->it, (double)s->t, setup_timer, pooled ? "pooled" : "allocated", compute_timer, gflops,
+		out ? ", saved to " : "", out ? out : "");
+	Release(pool, s);
+}
+
+int main(int argc, char** argv)
+{
+	char socketPath[sizeof(((struct sockaddr_un*)0)->sun_path)];
+	const char *path = GetOption(argc,argv,"-socket",NULL);
+	const int budget = atoi(GetOption(argc,argv,"-pool",DAEMON_POOL));
+	Job queue[DAEMON_QUEUE];
+	int head = 0, queued = 0, jobs = 0, stop = 0;
+	Pool pool = {{NULL}, 0, 0, (size_t)budget<<20, 0, 0};
+
+	if (path == NULL)
+	{
+		if (!DaemonSocket(socketPath, sizeof(socketPath))) return 1;
+		path = socketPath;
+	}
+
+	// A socket left by an earlier daemon is replaced, anything else is not ours to remove
+	struct stat st;
+	if (lstat(path, &st) == 0 && !S_ISSOCK(st.st_mode))
+	{
+		printf("%s exists and is not a socket\n", path);
+		return 1;
+	}
+
+	struct sockaddr_un addr;
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		printf("Socket path %s is too long\n", path);
+		return 1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(path);
+	const mode_t mask = umask(077); // created for this user alone
+	const int bound = lfd >= 0 && bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+	umask(mask);
+	if (!bound || chmod(path, 0600) != 0 || listen(lfd, DAEMON_QUEUE) != 0)
+	{
+		printf("Unable to listen on %s\n", path);
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN); // clients may leave before their answer
+	printf("Listening on %s, %d OpenMP threads, %d MB solver pool\n", path, omp_get_max_threads(), budget);
+	fflush(stdout);
+
+	while (!stop || queued > 0)
+	{
+		// Take every waiting request before running the next job
+		struct pollfd p = {lfd, POLLIN, 0};
+		if (!stop && poll(&p, 1, queued > 0 ? 0 : -1) > 0)
+		{
+			char line[DAEMON_LINE];
+			int fd = accept(lfd, NULL, NULL);
+			if (fd < 0) continue;
+			if (!Trusted(fd))
+			{
+				dprintf(fd, "error: the daemon serves its own user only\n");
+				close(fd);
+				continue;
+			}
+
+			// Neither a silent client nor one that stops reading holds up the queue
+			struct timeval timeout = {DAEMON_TIMEOUT, 0};
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+			setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+			if (!ReadLine(fd, line, sizeof(line))) { close(fd); continue; }
+
+			if (strncmp(line, "run ", 4) == 0 && queued < DAEMON_QUEUE)
+			{
+				Job *job = &queue[(head+queued++)%DAEMON_QUEUE];
+				job->fd = fd; job->id = ++jobs;
+				strcpy(job->line, line);
+				dprintf(fd, "queued job %d, %d ahead\n", job->id, queued-1);
+				continue;
+			}
+			if (strcmp(line, "status") == 0)
+			{
+				dprintf(fd, "done: %d jobs queued, %d received, pool %d solvers %.1f MB, %d pooled and %d allocated runs\n",
+					queued, jobs, pool.count, pool.bytes/1e6, pool.hits, pool.misses);
+			}
+			else if (strcmp(line, "shutdown") == 0)
+			{
+				dprintf(fd, "done: shutting down after %d queued jobs\n", queued);
+				stop = 1;
+			}
+			else
+			{
+				dprintf(fd, "error: %s\n", queued < DAEMON_QUEUE ? "unknown request" : "queue full");
+			}
+			close(fd);
+			continue;
+		}
+
+		if (queued > 0)
+		{
+			Job *job = &queue[head];
+			head = (head+1)%DAEMON_QUEUE; queued--;
+			RunJob(&pool, job);
+			close(job->fd);
+		}
+	}
+
+	while (pool.count > 0) SolverDestroy(pool.idle[--pool.count]);
+	close(lfd);
+	unlink(path);
+	printf("%d jobs, %d on pooled solvers\n", jobs, pool.hits);
+	return 0;
+}
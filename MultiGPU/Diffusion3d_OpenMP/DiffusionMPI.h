@@ -0,0 +1,581 @@
+//
+//  DiffusionMPI.h
+//  Diffusion3d-MPI-OpenMP
+//
+//  Created by Manuel Diaz on 7/26/16.
+//  Copyright © 2016 Manuel Diaz. All rights reserved.
+//
+
+#ifndef _DIFFUSION_MPI_H__
+#define _DIFFUSION_MPI_H__
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <mpi.h>
+#include <omp.h>
+
+// Testing :
+// A grid of n subgrids
+  /* bottom
+  +-------+ 
+  | 0 (0) | mpi_rank (socket)
+  +-------+
+  | 1 (1) |
+  +-------+
+     ...
+  +-------+
+  | n (n) |
+  +-------+
+    top */
+
+/*************/
+/* Constants */
+/*************/
+#define DEBUG 0 // Display all error messages
+#define WRITE 1 // Write solution to file
+#define RADIUS 3 // gosh cells
+#define FLOPS 8.0 // Double Precision
+#define FLOPS_LAPLACE 26.0 // per point of the FD4 Laplacian, for the counters
+#define FLOPS_UPDATE 5.0 // per point of an RK stage update
+#define FLOPS_RKL2 10.0 // per point of an RKL2 stage update
+#define FLOPS_ADI 18.0 // per point of the three line solves and the update of an ADI step
+#define ROOT 0 // Define root process
+
+/* Define macros */
+#define I2D(n,i,j) ((i)+(n)*(j)) // transfrom a 2D array index pair into linear index memory
+#define DIVIDE_INTO(x,y) (((x)+(y)-1)/(y)) // define No. of blocks/warps
+#define GAUSSIAN_DISTRIBUTION(x,y,z) 1.0*exp(-((x*x)+(y*y)+(z*z))/0.1)
+#define SWAP(T, a, b) do { T tmp = a; a = b; b = tmp; } while (0)
+#define MIN(a,b) (((a)<(b))?(a):(b))
+#define MAX(a,b) (((a)>(b))?(a):(b))
+#define MPI_CHECK(call) \
+    if((call) != MPI_SUCCESS) { printf("MPI error calling \""#call"\"\n"); exit(-1); }
+
+/* use floats of dobles */
+#define USE_FLOAT false // set false to use real
+#if USE_FLOAT
+	#define REAL	float
+	#define MPI_CUSTOM_REAL MPI_FLOAT
+#else
+	#define REAL	double
+	#define MPI_CUSTOM_REAL MPI_DOUBLE
+#endif
+
+/* halo exchange */
+#define HALO_P2P 0 // Isend/Irecv through host staging buffers
+#define HALO_SHM 1 // read faces of same-node neighbors from MPI shared memory
+#define HALO_RMA 2 // MPI_Put into the neighbor ghost window, PSCW synchronization
+#define HALO_NBR 3 // MPI_Ineighbor_alltoallw over a distributed graph topology
+#define HALO_MODE HALO_SHM // default, override with '-halo p2p|shm|rma|nbr'
+#define FACE_THREADS 0 // one communicating thread per face, override with '-facethreads 0|1'
+#define BALANCE 0 // iterations between load rebalancing (0: static), override with '-balance N'
+#define BALANCE_TOLERANCE 0.05 // rebalance only above 5% imbalance
+#define BLOCKS 0 // z-blocks per rank run by the task scheduler (0: one slab), override with '-blocks B'
+#define IO_SERVERS "0" // ranks that write output (0: rank 0 gathers), override with '-ioservers k|node'
+#define IO_DEPTH 8 // output pieces in flight per rank before the solver waits on its server
+#define OUTPUT 0 // iterations between snapshots (0: final result only), override with '-output N'
+#define OUTPUT_FORMAT "bin" // gathered float dumps, or 'vtk' pieces written by every rank, override with '-format bin|vtk'
+#define SAMPLE_EVERY 1 // iterations between samples when '-samples file' lists samplers, override with '-sampleevery N'
+#define PREVIEW 0 // iterations between coarse previews (0: none), override with '-preview N'
+#define PREVIEW_LEVELS 3 // 2x, 4x and 8x coarser levels, override with '-previewlevels L'
+#define PREVIEW_LEVELS_MAX 7
+#define PREVIEW_REDUCE "mean" // coarse cells keep the mean or the max of their cells, override with '-previewreduce mean|max'
+#define INTEGRATOR_SSPRK3 0 // three-stage strong-stability-preserving Runge-Kutta, steps below the explicit limit
+#define INTEGRATOR_RKL2 1 // Runge-Kutta-Legendre super-time-steps, see SuperStep.c
+#define INTEGRATOR_ADI 2 // Douglas alternating direction implicit steps, see Adi.c
+#define INTEGRATOR "ssprk3" // or 'rkl2', super-time-stepping with the stages a step of '-dt' needs, or 'adi', implicit steps of any '-dt', override with '-integrator ssprk3|rkl2|adi'
+#define STS_SAFETY 0.9 // RKL2 steps stay below 90% of their stability limit
+#define ADI_THETA 1.0 // implicit weight of the ADI factors, at least 2/3 for any dt with FD2 factors on the FD4 residual
+#define STEADY_TOL 0 // stop once max|u^(n+1)-u^n|/dt falls below (0: run to tEnd), override with '-steady tol'
+#define COUNTERS 0 // hardware counters per solver phase through perf_event_open, override with '-counters 0|1'
+#define COUNTER_EVENTS 5 // cycles, instructions, LLC references, LLC misses, task clock
+#define COUNTER_PHASES 7
+#define PHASE_COPY 0 // uo = u
+#define PHASE_LAPLACE 1
+#define PHASE_PACK 2
+#define PHASE_EXCHANGE 3 // halo calls, waits included
+#define PHASE_UNPACK 4
+#define PHASE_UPDATE 5 // RK stage update
+#define PHASE_STEP 6 // whole steps, when face threads or block tasks overlap the phases
+#define ENERGY 0 // package and DRAM energy through RAPL, per phase with '-counters 1', override with '-energy 0|1'
+#define ENERGY_PATH "/sys/class/powercap" // RAPL zones intel-rapl:<package>[:<subzone>]
+#define ENERGY_PATH_MAX 320
+#define ENERGY_ZONES 16
+#define STATUS 0 // iterations between telemetry updates of STATUS_FILE (0: none), override with '-status N'
+#define STATUS_FILE "status.prom" // Prometheus text format, rewritten in place by rank 0
+#define STATUS_VALUES (7+COUNTER_PHASES) // timers and memory of a rank
+#define PROFILE 0 // per-peer communication matrices through PMPI, override with '-profile 0|1'
+#define PROFILE_FILE "comm_matrix.txt" // written at MPI_Finalize by rank 0 of MPI_COMM_WORLD
+#define PROFILE_PHASES 5
+#define PROFILE_SETUP 0 // before the time loop
+#define PROFILE_HALO 1 // Runge-Kutta steps
+#define PROFILE_BALANCE 2 // plane and block migration
+#define PROFILE_OUTPUT 3 // snapshots, samples, previews, results and the I/O servers
+#define PROFILE_OTHER 4 // monitors, telemetry and reports
+#define PROFILE_BINS 32 // message size histogram, powers of 2
+#define PROFILE_REQUESTS 256 // requests in flight tracked to their peer
+#define PROFILE_MAPS 8 // communicators and windows with their ranks mapped to MPI_COMM_WORLD
+#define PLAN 0 // 1: print the performance model's plan and exit, 2: plan, then run and compare, override with '-plan 0|1|2'
+#define MODEL_STREAM_MB 64 // per array of the bandwidth probe
+#define MODEL_TILE_MB 64 // largest working set of the kernel probe, rows of the grid's planes are dropped beyond
+#define MODEL_PLANES 16 // planes of its thicker tile
+#define MODEL_REPEATS 5 // probes keep their best run
+#define MODEL_TASKS 1000
+#define MODEL_PINGS 20 // round trips per ping-pong
+#define MODEL_BLOCKS 64 // most blocks per rank considered
+#define MODEL_TOLERANCE 0.05 // fewer ranks are recommended within 5% of the fastest plan
+#define DAEMON_SOCKET "diffusion3d.sock" // where the solver daemon listens, in $XDG_RUNTIME_DIR or /tmp/diffusion3d-<uid>, override with '-socket path'
+#define DAEMON_TIMEOUT 5 // seconds a client may stay silent before its connection is dropped
+#define DAEMON_POOL "1024" // MB of idle solver arrays the daemon keeps for later jobs, override with '-pool MB'
+#define DAEMON_QUEUE 64 // jobs waiting in the daemon
+#define DAEMON_LINE 1024 // longest request or answer line
+#define CACHE_DIR NULL // result store, none by default, override with '-cache dir'
+#define CACHE_PATH 512 // longest path in the store
+#define OOC_RING 8 // planes per RK stage held in memory by the out-of-core sweep, power of 2
+#define OOC_PREFETCH 16 // planes the out-of-core sweep asks the kernel to read ahead
+#define LEFT  0 // neighbor rank-1 (bottom)
+#define RIGHT 1 // neighbor rank+1 (top)
+
+typedef struct {
+	int mode;                 // HALO_P2P, HALO_SHM, HALO_RMA or HALO_NBR
+	int rank, nbr[2];         // neighbors {rank-1,rank+1}, MPI_PROC_NULL at the ends
+	unsigned int count;       // REALs per face: Nx*Ny*RADIUS
+	REAL *send[2], *recv[2];  // host staging buffers
+	MPI_Request send_req[2], recv_req[2];
+	double wait_time;         // seconds blocked waiting on neighbors
+	/* intra-node path */
+	MPI_Comm node_comm;       // ranks sharing this node
+	MPI_Win shm_win;          // send buffers of all node ranks
+	int shm[2];               // face is read directly from the neighbor
+	int ack[2];               // neighbor still has to release our send buffer
+	MPI_Request ack_req[2];   // our release of the neighbor's send buffer, in flight
+	REAL *peer[2];            // neighbor send buffer facing us
+	/* one-sided path */
+	MPI_Win rma_win;          // our receive buffers, target of the neighbor puts
+	MPI_Group rma_group;      // the (up to two) neighbors
+	int epoch;                // access/exposure epochs are open
+	/* neighborhood collective path */
+	MPI_Comm graph_comm;      // graph of the decomposition, edges to face neighbors
+	MPI_Datatype face[2];     // subarray of a face inside the [LEFT|RIGHT] buffers
+	int degree, staged;       // number of neighbors, faces staged this stage
+	int counts[2];            // per neighbor, in graph order
+	MPI_Aint displs[2];
+	MPI_Datatype types[2];
+	MPI_Request coll_req;
+} Halo;
+
+/* slab decomposition along z */
+typedef struct {
+	int size;                 // number of ranks
+	unsigned int Nz;          // global interior planes (or blocks)
+	unsigned int min;         // thinnest subdomain allowed
+	unsigned int *nz;         // interior planes (or blocks) per rank
+	unsigned int *z0;         // global plane of each subdomain's first (ghost) plane, or first block
+	double *busy;             // seconds each rank computed in the last interval
+} Decomposition;
+
+/* overdecomposition: several z-blocks per rank */
+typedef struct {
+	unsigned int z0, nz;      // global plane of the first (ghost) plane, interior planes
+	REAL *u, *uo, *Lu;        // with RADIUS ghost planes each side, NULL unless owned
+	REAL change;              // max|u^(n+1)-u^n| of the last step
+} Block;
+
+typedef struct {
+	int rank;
+	unsigned int nx, ny;
+	unsigned int count;       // blocks over all ranks
+	Block *b;                 // every block of the domain, bottom to top
+	Decomposition owner;      // contiguous run of blocks owned by each rank
+} BlockSet;
+
+/* output offload to I/O server ranks */
+typedef struct {
+	int servers;              // I/O server ranks in the job, 0 if rank 0 gathers and writes
+	int server;               // world rank our output goes to (solver ranks)
+	int clients;              // solver ranks writing through us (server ranks)
+	unsigned int nx, ny, Nz;
+	int slot;                 // next staging slot of the ring
+	int header[IO_DEPTH][4];  // {iteration, first plane, last plane+1, final}
+	float *stage[IO_DEPTH];   // pieces converted to float, as SaveBinary3D writes them
+	size_t size[IO_DEPTH];    // capacity of each slot
+	MPI_Request req[IO_DEPTH][2];
+	double wait_time;         // seconds the solver waited for a free slot
+} IO;
+
+/* self-describing field file: a header page, then the planes page-aligned */
+#define FIELD_MAGIC "FIELD3D" // 8 bytes with the terminating zero
+#define FIELD_VERSION 2 // 2 adds the scheme and physics, version 1 files are still read
+#define FIELD_SCHEME "SSP-RK3 FD4" // discretization recorded in field files
+#define FIELD_SCHEME_RKL2 "RKL2 FD4" // that of super-time-stepped runs
+#define FIELD_SCHEME_ADI "Douglas ADI FD4" // that of ADI runs
+
+typedef struct {
+	char magic[8];            // FIELD_MAGIC
+	uint32_t version;         // FIELD_VERSION
+	uint32_t offset;          // bytes before the data, a multiple of the page size
+	uint32_t nx, ny, nz;      // cells stored, fixed boundary planes included
+	uint32_t bytes;           // per value: 4 float, 8 double
+	uint32_t halo;            // fixed boundary planes on each z end (RADIUS)
+	uint32_t ranks;           // slabs of the run that wrote it, their nz follow the header
+	double time;              // simulation time of the data
+	int64_t step;             // iterations taken to reach it
+	double dt;                // time step of the last iteration
+	char scheme[16];          // discretization, FIELD_SCHEME (version 2)
+	double K, L, W, H;        // conductivity and domain (version 2)
+} FieldHeader;
+
+typedef struct {
+	FieldHeader *header;      // in the mapping, updates go straight to the file
+	uint32_t *planes;         // interior planes per rank, header->ranks of them
+	void *data;               // first value, page aligned
+	size_t length;            // bytes mapped
+	int fd;
+} Field;
+
+/* plane, line and probe samplers, see Sample.c */
+typedef struct {
+	char spec[64];            // the line that defined it
+	size_t first, stride;     // points in a z-plane: first, first+stride, ...
+	unsigned int m;           // points per z-plane
+	int k;                    // the only z-plane sampled, -1 for all of them
+	size_t points;            // floats per record
+	int fd;                   // sample_<n>.bin
+} Sampler;
+
+typedef struct {
+	int count;
+	Sampler *s;
+	unsigned int nx, ny, Nz;
+	int records;              // sample times written so far
+	double bytes;             // written by this rank
+	float *buffer;            // extracted samples of one sampler and piece
+	size_t size;
+	FILE *times;              // rank 0 only
+} Samples;
+
+/* coarse preview pyramid, see Preview.c */
+typedef struct {
+	int levels;               // level l is 2^l times coarser
+	int max;                  // reduce cells to their max instead of their mean
+	int rank, size;
+	unsigned int nx[PREVIEW_LEVELS_MAX+1], ny[PREVIEW_LEVELS_MAX+1], nz[PREVIEW_LEVELS_MAX+1];
+	unsigned int *lo[PREVIEW_LEVELS_MAX+1], *hi[PREVIEW_LEVELS_MAX+1]; // planes owned by every rank
+	float *level[PREVIEW_LEVELS_MAX+1]; // our planes of each coarse level
+	unsigned int planes[PREVIEW_LEVELS_MAX+1]; // their capacity
+	float *extra;             // plane of the level below received from the next rank
+	float *pair;              // fine planes converted to float
+	int count;                // previews written
+	double bytes;             // written by this rank
+} Preview;
+
+/* RAPL energy zones of a node, see Energy.c */
+typedef struct {
+	int fd;                   // energy_uj, kept open
+	int dram;                 // 0 package, 1 DRAM
+	double range;             // microjoules at which the counter wraps
+	double last;              // last reading, microjoules
+} Zone;
+
+typedef struct {
+	int on;                   // zones open on this rank
+	int reader;               // this rank reads its node's zones
+	int error;                // errno of the last zone that could not be read
+	int zones;
+	Zone zone[ENERGY_ZONES];
+	double joules[2];         // package and DRAM since the start
+	double loop[2];           // those of the time loop
+} Energy;
+
+/* hardware counters per phase, see Counters.c */
+typedef struct {
+	int on;                   // 0 when off or no event could be opened
+	int threads;
+	int events;               // events per thread group
+	int slot[COUNTER_EVENTS]; // position of each event in the groups, -1 if unavailable
+	int *fd;                  // [thread][slot], group leaders in slot 0
+	uint64_t *start, *now;    // [thread][slot] counts
+	unsigned char *read;      // [thread] 1 while every read of the open phase succeeded
+	int phase;                // open phase and its start
+	double t0;
+	double count[COUNTER_PHASES][COUNTER_EVENTS]; // summed over threads
+	double time[COUNTER_PHASES], flops[COUNTER_PHASES], bytes[COUNTER_PHASES];
+	int calls[COUNTER_PHASES];
+	Energy *energy;           // node energy read around each phase, NULL without RAPL
+	double e0, joules[COUNTER_PHASES];
+} Counters;
+
+/* cumulative timers of the time loop, published by the telemetry */
+typedef struct {
+	double halo;              // waiting on neighbors
+	double output, samples, previews;
+} Timers;
+
+/* telemetry, see Status.c */
+typedef struct {
+	int every;                // iterations between updates, 0: off
+	int rank, size;
+	MPI_Request request[2];   // reductions in flight
+	int pending;
+	double local[2*STATUS_VALUES], global[2*STATUS_VALUES]; // values and their negatives, max over ranks
+	double resident, total;   // memory of this rank and of all
+	int it, it0, last_it;     // step of the reduction in flight, first and last published
+	REAL t, tEnd, dt;
+	double start, wall, last_wall; // wall clock of the loop
+} Status;
+
+/* steady-state monitor, see Steady.c */
+typedef struct {
+	double tol;               // residual below which the run is steady
+	MPI_Request request;      // reduction of the last step, in flight
+	int pending;
+	double local, global;     // its buffers
+	int it;                   // its step and time
+	REAL t;
+	double first, last;       // residuals of the history
+	int first_it, last_it;
+	int reached;              // step the tolerance was met, 0 if not yet
+	FILE *history;            // rank 0 only
+} Monitor;
+
+/* alternating direction implicit steps, see Adi.c */
+typedef struct {
+	int rank, size;
+	unsigned int nx, ny;
+	REAL rx, ry, rz;          // theta*dt*K/h^2 of the FD2 factors
+	REAL dt;
+	REAL *cx, *ix, *cy, *iy;  // Thomas elimination of the x and y lines
+	unsigned int m;           // interior planes of this rank, its part of the z lines
+	REAL *cz, *iz;            // elimination of the local z system
+	REAL *g, *h;              // its response to a unit value past either end
+	int levels;               // cyclic reduction steps of the interface system, ceil(log2 size)
+	double *alpha, *gamma;    // [level][2x2] weights of the ranks 2^level below and above
+	double inverse[4];        // the 2x2 block of this rank left after the last level
+	REAL *ends[2];            // first and last plane of the segment, this level and the next
+	REAL *below, *above;      // those of the ranks 2^level below and above
+} Adi;
+
+/* a rank's slab and its time step, see Step.c */
+typedef struct {
+	int integrator;           // INTEGRATOR_*, -1 until chosen
+	int stages;               // Laplacians per step
+	int faceThreads;          // a thread per face exchanges it, the others share the inner planes
+	unsigned int nx, ny, nz;  // nz planes of this rank, RADIUS ghost planes each z end
+	REAL kx, ky, kz, dt;      // numerical conductivities K/(12*h^2)
+	REAL *u, *uo, *Lu;
+	REAL *um, *L0;            // RKL2: the stage before last and L(Y_0)
+	int primed;               // um carries the fixed x and y boundary of u
+	Adi adi;                  // ADI: line solve factors
+} Slab;
+
+/* machine parameters of the performance model, see Model.c */
+typedef struct {
+	double bw, node_bw;       // copy bandwidth of a rank alone and of every rank of a node at once, bytes/s
+	double laplace, update;   // thread-seconds per cell of the Laplacian and the RK update on planes of the grid
+	double call;              // seconds per kernel call, the parallel region
+	double task;              // seconds per task
+	double latency, mpi_bw;   // ping-pong between ranks 0 and 1, seconds and bytes/s
+	int measured_mpi;         // 0 on a single rank, faces then cost a copy
+	double cache;             // last-level cache per node, 0 if unknown
+	int threads, cores;       // threads per rank, cores per node
+	int node_ranks;           // ranks per node of the probing job
+	double probe_time;
+} Machine;
+
+/* single-rank solver state, see Solver.c */
+typedef struct {
+	unsigned int nx, ny, nz;  // nz without the fixed boundary planes
+	double K, L, W, H;        // recorded in saved fields
+	REAL dx, dy, dz;
+	REAL t;
+	long it;
+	Decomposition d;          // a single slab
+	Slab slab;                // its ghost planes are the fixed boundary
+} Solver;
+
+/* content-addressed result store, see Cache.c */
+typedef struct {
+	char config[512];         // canonical text of the configuration
+	uint64_t key;             // its hash
+	char root[CACHE_PATH-64];
+	char dir[CACHE_PATH-32];  // root/key
+} Cache;
+
+extern MPI_Comm solverComm;
+
+/******************/
+/* Host functions */
+/******************/
+int InitializeMPI(int* argc, char*** argv, int* rank, int* numberOfProcesses, int required);
+void FinalizeMPI();
+
+void Init_domain(const int IC, REAL *h_u, const REAL dx, const REAL dy, const REAL dz, unsigned int nx, unsigned int ny, unsigned int nz);
+void Init_subdomain(const REAL *h_q, REAL *h_s_q, unsigned int z0, unsigned int nx, unsigned int ny, unsigned int nz);
+void Merge_domains(REAL *h_s_q, REAL *h_q, unsigned int z0, unsigned int nx, unsigned int ny, unsigned int nz);
+
+float CalcGflops(float computeTimeInSeconds, unsigned int iterations, unsigned int stages, unsigned int nx, unsigned int ny, unsigned int nz);
+void PrintSummary(const char* kernelName, const char* optimization, double computeTimeInSeconds, float gflops, const int computeIterations, const int stages, unsigned int nx, unsigned int ny, unsigned int nz, int numberOfProcesses, int numberOfThreads);
+// void CalcError(REAL *uOld, REAL *uNew, const REAL t, const REAL h, unsigned int nx, unsigned int ny, unsigned int nz);
+
+void Print2D(REAL *u, const unsigned int nx, const unsigned int ny);
+void Print3D(REAL *u, const unsigned int nx, const unsigned int ny, const unsigned int nz);
+void Save3D(REAL *u, const unsigned int nx, const unsigned int ny, const unsigned int nz);
+void SaveBinary3D(const REAL *u, const unsigned int nx, const unsigned int ny, const unsigned int nz, const char *name);
+
+const char* GetOption(int argc, char** argv, const char* name, const char* fallback);
+int DaemonSocket(char *path, size_t size);
+
+int HaloMode(const char* name);
+const char* HaloModeName(int mode);
+void InitializeHalo(Halo *h, int mode, int rank, int numberOfProcesses, unsigned int nx, unsigned int ny);
+void FinalizeHalo(Halo *h);
+void HaloBegin(Halo *h);
+REAL *HaloSendBuffer(Halo *h, int side);
+void HaloSend(Halo *h, int side);
+REAL *HaloRecv(Halo *h, int side);
+void HaloEnd(Halo *h);
+
+void InitializeDecomposition(Decomposition *d, int numberOfProcesses, unsigned int Nz);
+void FinalizeDecomposition(Decomposition *d);
+void WeightedDecomposition(Decomposition *d, const double *weights);
+double Imbalance(const double *busy, int n);
+int Repartition(Decomposition *d, double busy, Decomposition *old);
+void ReportRepartition(const Decomposition *old, const Decomposition *d, const char *units);
+int Rebalance(Decomposition *d, int rank, double busy, REAL **q, REAL **qo, REAL **Lq, unsigned int nx, unsigned int ny);
+
+void InitializeBlocks(BlockSet *s, int rank, int numberOfProcesses, int blocksPerRank, const REAL *h_u, unsigned int nx, unsigned int ny, unsigned int Nz);
+void FinalizeBlocks(BlockSet *s);
+REAL BlockStep(BlockSet *s, Halo *h, REAL kx, REAL ky, REAL kz, REAL dt);
+int RebalanceBlocks(BlockSet *s, double busy);
+void GatherBlocks(BlockSet *s, REAL *h_u);
+void BlockPlanes(const BlockSet *s, unsigned int *planes);
+
+int InitializeIO(IO *io, const char *servers, int *rank, int *numberOfProcesses, unsigned int nx, unsigned int ny, unsigned int Nz);
+void IOServer(IO *io);
+void IOPost(IO *io, const REAL *q, unsigned int z0, unsigned int nz, int iteration, int final);
+void FinalizeIO(IO *io);
+
+int CreateField(Field *f, const char *name, unsigned int nx, unsigned int ny, unsigned int nz, unsigned int bytes, unsigned int ranks, const unsigned int *planes);
+int OpenField(Field *f, const char *name, int writable);
+void CloseField(Field *f);
+int FieldMatches(const Field *f, const char *name, unsigned int nx, unsigned int ny, unsigned int nz);
+const REAL *FieldView(const Field *f, REAL *fallback);
+void ReadFieldPlanes(const Field *f, REAL *dst, unsigned int k0, unsigned int n);
+void WriteField(const char *name, const REAL *u, unsigned int nx, unsigned int ny, unsigned int nz, unsigned int ranks, const unsigned int *planes, const FieldHeader *run);
+void DescribeRun(FieldHeader *run, int integrator, double K, double L, double W, double H, double dt);
+void CopyRun(FieldHeader *h, const FieldHeader *run);
+int FieldContinues(const Field *f, const char *name, const FieldHeader *run);
+
+void PieceExtent(unsigned int z0, unsigned int nz, unsigned int Nz, unsigned int *k0, unsigned int *k1);
+void WriteImagePiece(const char *name, const REAL *u, unsigned int nx, unsigned int ny, unsigned int NZ,
+	unsigned int k0, unsigned int k1, REAL dx, REAL dy, REAL dz);
+void WriteImageIndex(const char *base, int pieces, const unsigned int *k0, const unsigned int *k1,
+	unsigned int nx, unsigned int ny, unsigned int NZ, REAL dx, REAL dy, REAL dz);
+
+int InitializeSamples(Samples *S, const char *spec, int rank, unsigned int nx, unsigned int ny, unsigned int Nz);
+void SamplePiece(Samples *S, const REAL *q, unsigned int z0, unsigned int nz);
+void SampleRecord(Samples *S, int it, REAL t);
+void FinalizeSamples(Samples *S);
+
+void InitializePreview(Preview *P, int levels, int max, int rank, int numberOfProcesses, unsigned int nx, unsigned int ny, unsigned int Nz);
+void WritePreview(Preview *P, const REAL *h_s_u, const BlockSet *set, const Decomposition *decomp, int blocks, int it);
+void FinalizePreview(Preview *P);
+
+void InitializeCounters(Counters *C, int on, int rank, Energy *E);
+void CountersBegin(Counters *C, int phase);
+void CountersEnd(Counters *C, double flops, double bytes);
+void ReportCounters(const Counters *C, int rank, int numberOfProcesses);
+void FinalizeCounters(Counters *C);
+
+void InitializeEnergy(Energy *E, int on, int rank);
+double EnergySample(Energy *E);
+void EnergyBegin(Energy *E);
+void EnergyEnd(Energy *E);
+void ReportEnergy(const Energy *E, double seconds, double cellUpdates, int rank);
+void FinalizeEnergy(Energy *E);
+
+void InitializeStatus(Status *S, int every, int rank, int size, int it0);
+void StatusStep(Status *S, int it, REAL t, REAL tEnd, REAL dt, const Timers *T, const Counters *C);
+void FinalizeStatus(Status *S, int it, REAL t, REAL tEnd, REAL dt, const Timers *T, const Counters *C);
+
+void ProfileEnable(void);
+void ProfilePhase(int phase);
+void ProfileShared(int rank, double bytes);
+
+void CalibrateMachine(Machine *m, int rank, int numberOfProcesses, unsigned int nx, unsigned int ny);
+double PredictStep(const Machine *m, int ranks, int blocks, unsigned int nx, unsigned int ny, unsigned int Nz, double *halo);
+void PrintPlan(const Machine *m, int numberOfProcesses, unsigned int nx, unsigned int ny, unsigned int Nz);
+
+int Integrator(const char* name);
+int IntegratorStages(int integrator, REAL K, REAL dx, REAL dy, REAL dz, REAL dt);
+REAL ExplicitStep(REAL K, REAL dx, REAL dy, REAL dz);
+REAL ExplicitLimit(REAL K, REAL dx, REAL dy, REAL dz);
+int SuperSteps(REAL dt, REAL dtFE);
+void SuperStepCoefficients(int s, int j, REAL *mu, REAL *nu, REAL *mut, REAL *gt);
+
+void InitializeAdi(Adi *A, const Decomposition *d, int rank, unsigned int nx, unsigned int ny,
+	REAL K, REAL dx, REAL dy, REAL dz, REAL dt);
+void AdiPartition(Adi *A, const Decomposition *d);
+REAL AdiStep(Adi *A, Halo *h, REAL *u, REAL *d, REAL kx, REAL ky, REAL kz, unsigned int _nz);
+void FinalizeAdi(Adi *A);
+
+int InitializeSlab(Slab *S, unsigned int nx, unsigned int ny, unsigned int nz);
+int SlabIntegrator(Slab *S, int integrator, const Decomposition *d, int rank, REAL K, REAL dx, REAL dy, REAL dz, REAL dt);
+void ResizeSlab(Slab *S, const Decomposition *d, int rank);
+REAL SlabStep(Slab *S, Halo *h, Counters *C);
+void FinalizeSlab(Slab *S);
+
+void InitializeMonitor(Monitor *M, double tol, int rank);
+int MonitorStep(Monitor *M, REAL change, int it, REAL t, REAL dt);
+void FinalizeMonitor(Monitor *M);
+double MonitorRate(const Monitor *M);
+
+/* C linkage: loaded by name from Python */
+extern "C" {
+Solver *SolverCreate(double K, double L, double W, double H, unsigned int nx, unsigned int ny, unsigned int nz,
+	const char *integrator, double dt, const char *icFile);
+int SolverReset(Solver *s, double K, double L, double W, double H, const char *integrator, double dt, const char *icFile);
+void SolverDestroy(Solver *s);
+void SolverStep(Solver *s, int n);
+int SolverAdvanceTo(Solver *s, double tEnd);
+double SolverTime(const Solver *s);
+long SolverSteps(const Solver *s);
+double SolverDt(const Solver *s);
+int SolverHalo(void);
+int SolverRealBytes(void);
+REAL *SolverField(Solver *s, int which, size_t shape[3], size_t strides[3]);
+void SolverSave(const Solver *s, const char *name);
+}
+
+int CacheKey(Cache *c, const char *root, REAL K, REAL L, REAL W, REAL H, unsigned int nx, unsigned int ny, unsigned int nz, const char *icFile);
+int CacheLookup(const Cache *c, int max_iters, char *field);
+void CacheStore(const Cache *c, const char *field, int iters, const char *diagnostics);
+int CacheRestore(const Cache *c, const char *field, int iters);
+
+void SolveOutOfCore(const char *path, const char *icFile, const FieldHeader *run, REAL kx, REAL ky, REAL kz, REAL dt, REAL tEnd,
+	REAL dx, REAL dy, REAL dz, unsigned int nx, unsigned int ny, unsigned int Nz, int numberOfThreads);
+
+/****************/
+/* Host kernels */
+/****************/
+void CopyBoundaryRegionToGhostCell(REAL *q, REAL *send_buffer, unsigned int nx, unsigned int ny, unsigned int _nz, unsigned int side);
+void CopyGhostCellToBoundaryRegion(REAL *q, const REAL *recv_buffer, unsigned int nx, unsigned int ny, unsigned int _nz, unsigned int side);
+void Compute_Laplace3d(const REAL *q, REAL *Lq, REAL diff_x, REAL diff_y, REAL diff_z,
+	unsigned int nx, unsigned int ny, unsigned int _nz, unsigned int kstart, unsigned int kstop);
+void Compute_Laplace3d_Plane(const REAL * const *q, REAL *Lq, REAL diff_x, REAL diff_y, REAL diff_z,
+	unsigned int nx, unsigned int ny);
+REAL Compute_sspRK(REAL *q, const REAL *qo, const REAL *Lq, unsigned int step, REAL dt,
+	unsigned int nx, unsigned int ny, unsigned int _nz);
+REAL Compute_RKL2(REAL *y, const REAL *y1, const REAL *y2, const REAL *y0, const REAL *L1, const REAL *L0,
+	REAL mu, REAL nu, REAL mut, REAL gt, REAL dt, unsigned int last, unsigned int nx, unsigned int ny, unsigned int _nz);
+void Compute_ThomasX(REAL *d, const REAL *c, const REAL *inv, REAL r, REAL scale,
+	unsigned int nx, unsigned int ny, unsigned int k0, unsigned int k1);
+void Compute_ThomasY(REAL *d, const REAL *c, const REAL *inv, REAL r,
+	unsigned int nx, unsigned int ny, unsigned int k0, unsigned int k1);
+void Compute_ThomasZ(REAL *d, const REAL *c, const REAL *inv, REAL r,
+	unsigned int nx, unsigned int ny, unsigned int k0, unsigned int m);
+
+#endif	// _DIFFUSION_MPI_H__
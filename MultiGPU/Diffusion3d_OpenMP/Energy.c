@@ -0,0 +1,157 @@
+//
+//  Energy.c
+//  Diffusion3d-MPI-OpenMP
+//
+//  Created by Manuel Diaz on 7/26/16.
+//  Copyright © 2016 Manuel Diaz. All rights reserved.
+//
+
+#include "DiffusionMPI.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*****************************************************************/
+/* Energy through the Linux powercap interface to RAPL: one rank */
+/* per node reads the package and DRAM zones of ENERGY_PATH      */
+/* (core, uncore and psys overlap them and are left out). The    */
+/* counters are cumulative microjoules that wrap at              */
+/* max_energy_range_uj, so every reading adds its difference to  */
+/* the previous one. Ranks sharing the node leave theirs off and */
+/* the totals are summed over nodes                              */
+/*****************************************************************/
+
+/* First line of a zone attribute */
+static int ReadAttribute(const char *zone, const char *attribute, char *line, int size)
+{
+	char name[ENERGY_PATH_MAX];
+	snprintf(name, sizeof(name), "%s/%s/%s", ENERGY_PATH, zone, attribute);
+	FILE *f = fopen(name, "r");
+	if (f == NULL) return 0;
+	const int ok = fgets(line, size, f) != NULL;
+	fclose(f);
+	if (ok) line[strcspn(line, "\n")] = 0;
+	return ok;
+}
+
+/* Microjoules of an open zone, -1 if the read fails */
+static double Microjoules(int fd)
+{
+	char line[32];
+	const ssize_t n = pread(fd, line, sizeof(line)-1, 0);
+	if (n <= 0) return -1;
+	line[n] = 0;
+	return atof(line);
+}
+
+void InitializeEnergy(Energy *E, int on, int rank)
+{
+	memset(E, 0, sizeof(Energy));
+	E->error = ENOENT;
+	if (!on) return;
+
+	// The lowest rank of each node reads its zones
+	MPI_Comm node;
+	int local;
+	MPI_CHECK(MPI_Comm_split_type(solverComm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node));
+	MPI_CHECK(MPI_Comm_rank(node, &local));
+	MPI_CHECK(MPI_Comm_free(&node));
+	E->reader = local == 0;
+	if (!E->reader) return;
+
+	DIR *dir = opendir(ENERGY_PATH);
+	if (dir == NULL) { E->error = errno; return; }
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL && E->zones < ENERGY_ZONES)
+	{
+		char name[64], range[32], path[ENERGY_PATH_MAX];
+		if (strncmp(entry->d_name, "intel-rapl:", 11) != 0) continue;
+		if (!ReadAttribute(entry->d_name, "name", name, sizeof(name))) continue;
+		const int dram = strcmp(name, "dram") == 0;
+		if (!dram && strncmp(name, "package", 7) != 0) continue;
+
+		snprintf(path, sizeof(path), "%s/%s/energy_uj", ENERGY_PATH, entry->d_name);
+		const int fd = open(path, O_RDONLY);
+		if (fd < 0) { E->error = errno; continue; }
+		const double now = Microjoules(fd);
+		if (now < 0) { E->error = errno; close(fd); continue; }
+
+		Zone *z = &E->zone[E->zones++];
+		z->fd = fd;
+		z->dram = dram;
+		z->range = ReadAttribute(entry->d_name, "max_energy_range_uj", range, sizeof(range)) ? atof(range) : 0;
+		z->last = now;
+	}
+	closedir(dir);
+	E->on = E->zones > 0;
+}
+
+/*****************************************************************/
+/* Reads every zone, returns the package and DRAM joules of this */
+/* node since InitializeEnergy                                   */
+/*****************************************************************/
+double EnergySample(Energy *E)
+{
+	if (!E->on) return 0;
+	for (int i = 0; i < E->zones; i++)
+	{
+		Zone *z = &E->zone[i];
+		const double now = Microjoules(z->fd);
+		if (now < 0) continue;
+		double delta = now-z->last;
+		if (delta < 0) delta += z->range; // wrapped
+		E->joules[z->dram] += 1e-6*delta;
+		z->last = now;
+	}
+	return E->joules[0]+E->joules[1];
+}
+
+/* Marks the start of the time loop */
+void EnergyBegin(Energy *E)
+{
+	EnergySample(E);
+	E->loop[0] = -E->joules[0];
+	E->loop[1] = -E->joules[1];
+}
+
+/* Marks its end, the loop then holds what it took */
+void EnergyEnd(Energy *E)
+{
+	EnergySample(E);
+	E->loop[0] += E->joules[0];
+	E->loop[1] += E->joules[1];
+}
+
+/*****************************************************************/
+/* Collective: package and DRAM joules of the loop over nodes,   */
+/* per cell update and as average power                          */
+/*****************************************************************/
+void ReportEnergy(const Energy *E, double seconds, double cellUpdates, int rank)
+{
+	double local[3] = {E->loop[0], E->loop[1], (double)E->on}, total[3] = {0, 0, 0};
+	int requested = E->reader || E->on, any = 0, error = E->reader && !E->on ? E->error : 0;
+
+	MPI_CHECK(MPI_Allreduce(&requested, &any, 1, MPI_INT, MPI_MAX, solverComm));
+	if (!any) return;
+	MPI_CHECK(MPI_Reduce(local, total, 3, MPI_DOUBLE, MPI_SUM, 0, solverComm));
+	MPI_CHECK(MPI_Allreduce(MPI_IN_PLACE, &error, 1, MPI_INT, MPI_MAX, solverComm));
+	if (rank != 0) return;
+
+	if (total[2] == 0)
+	{
+		printf("Energy                                       :  RAPL unavailable (%s: %s)\n", ENERGY_PATH, strerror(error));
+		return;
+	}
+	const double joules = total[0]+total[1];
+	printf("Energy (RAPL)                                :  %.2f J package, %.2f J DRAM, %.0f node%s%s\n", total[0], total[1], total[2], total[2] > 1 ? "s" : "", error ? ", some unread" : "");
+	printf("Average power                                :  %.2f W\n", seconds > 0 ? joules/seconds : 0);
+	printf("Energy per cell update                       :  %.3f nJ\n", cellUpdates > 0 ? 1e9*joules/cellUpdates : 0);
+}
+
+void FinalizeEnergy(Energy *E)
+{
+	for (int i = 0; i < E->zones; i++) close(E->zone[i].fd);
+	E->zones = 0;
+	E->on = 0;
+}
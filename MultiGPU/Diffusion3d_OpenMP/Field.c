@@ -0,0 +1,226 @@
+//
+//  Field.c
+//  Diffusion3d-MPI-OpenMP
+//
+//  Created by Manuel Diaz on 7/26/16.
+//  Copyright © 2016 Manuel Diaz. All rights reserved.
+//
+
+#include "DiffusionMPI.h"
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* In MATLAB the header and data are read by readField.m */
+
+static int MapField(Field *f, int writable)
+{
+	const int prot = writable ? PROT_READ|PROT_WRITE : PROT_READ;
+	void *base = mmap(NULL, f->length, prot, MAP_SHARED, f->fd, 0);
+	if (base == MAP_FAILED) return 0;
+
+	f->header = (FieldHeader*)base;
+	// Version 1 headers end at dt
+	f->planes = (uint32_t*)((char*)base + (f->header->version >= 2 ? sizeof(FieldHeader) : offsetof(FieldHeader, scheme)));
+	f->data = (char*)base + f->header->offset;
+	return 1;
+}
+
+/***************************************************************/
+/* Creates a field file of the given shape and maps it, r/w    */
+/***************************************************************/
+int CreateField(Field *f, const char *name, unsigned int nx, unsigned int ny, unsigned int nz, unsigned int bytes, unsigned int ranks, const unsigned int *planes)
+{
+	const size_t page = sysconf(_SC_PAGESIZE);
+	const size_t offset = (sizeof(FieldHeader)+sizeof(uint32_t)*ranks+page-1)/page*page;
+	unsigned int r;
+
+	f->length = offset + (size_t)bytes*nx*ny*nz;
+	f->fd = open(name, O_RDWR|O_CREAT|O_TRUNC, 0644);
+	if (f->fd < 0 || ftruncate(f->fd, f->length) != 0 || !MapField(f, 1))
+	{
+		printf("Unable to create %s\n", name);
+		if (f->fd >= 0) close(f->fd);
+		return 0;
+	}
+
+	// The mapping starts zeroed, only the header is filled in here
+	FieldHeader *h = f->header;
+	f->data = (char*)h + offset;
+	memcpy(h->magic, FIELD_MAGIC, sizeof(h->magic));
+	h->version = FIELD_VERSION;
+	h->offset = offset;
+	h->nx = nx; h->ny = ny; h->nz = nz;
+	h->bytes = bytes;
+	h->halo = RADIUS;
+	h->ranks = ranks;
+	h->time = 0.; h->step = 0; h->dt = 0.;
+	memset(h->scheme, 0, sizeof(h->scheme));
+	h->K = h->L = h->W = h->H = 0.;
+	for (r = 0; r < ranks; r++) f->planes[r] = planes ? planes[r] : 0;
+	return 1;
+}
+
+/***************************************************************/
+/* Maps an existing field file after checking its header       */
+/***************************************************************/
+int OpenField(Field *f, const char *name, int writable)
+{
+	struct stat st;
+	FieldHeader h;
+
+	f->fd = open(name, writable ? O_RDWR : O_RDONLY);
+	if (f->fd < 0 || fstat(f->fd, &st) != 0 || pread(f->fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h))
+	{
+		printf("Unable to open %s\n", name);
+		if (f->fd >= 0) close(f->fd);
+		return 0;
+	}
+	if (memcmp(h.magic, FIELD_MAGIC, sizeof(h.magic)) != 0 || h.version < 1 || h.version > FIELD_VERSION ||
+		(h.bytes != 4 && h.bytes != 8) || (size_t)st.st_size < h.offset + (size_t)h.bytes*h.nx*h.ny*h.nz)
+	{
+		printf("%s is not a version 1 to %d field file\n", name, FIELD_VERSION);
+		close(f->fd);
+		return 0;
+	}
+
+	f->length = st.st_size;
+	if (!MapField(f, writable))
+	{
+		printf("Unable to map %s\n", name);
+		close(f->fd);
+		return 0;
+	}
+	return 1;
+}
+
+void CloseField(Field *f)
+{
+	munmap(f->header, f->length);
+	close(f->fd);
+}
+
+/***************************************************************/
+/* Refuses a field of another shape than the run's             */
+/***************************************************************/
+int FieldMatches(const Field *f, const char *name, unsigned int nx, unsigned int ny, unsigned int nz)
+{
+	const FieldHeader *h = f->header;
+	if (h->nx == nx && h->ny == ny && h->nz == nz && h->halo == RADIUS) return 1;
+
+	printf("%s holds a %u x %u x %u field with %u boundary planes, %u x %u x %u with %d expected\n",
+		name, h->nx, h->ny, h->nz, h->halo, nx, ny, nz, RADIUS);
+	return 0;
+}
+
+/* Relative agreement of values recomputed from the same inputs */
+static int Same(double a, double b)
+{
+	return fabs(a-b) <= 1e-12*fabs(b);
+}
+
+/***************************************************************/
+/* Refuses to continue a run of another scheme or physics, the */
+/* grid is checked by FieldMatches                             */
+/***************************************************************/
+int FieldContinues(const Field *f, const char *name, const FieldHeader *run)
+{
+	const FieldHeader *h = f->header;
+	if (h->version < 2)
+	{
+		printf("%s records no scheme, it can only be an initial condition\n", name);
+		return 0;
+	}
+	if (strncmp(h->scheme, run->scheme, sizeof(h->scheme)) != 0)
+	{
+		printf("%s was computed with %.16s, this run uses %.16s\n", name, h->scheme, run->scheme);
+		return 0;
+	}
+	if (!Same(h->K,run->K) || !Same(h->L,run->L) || !Same(h->W,run->W) || !Same(h->H,run->H))
+	{
+		printf("%s was computed with K %g on %g x %g x %g, this run has K %g on %g x %g x %g\n",
+			name, h->K, h->L, h->W, h->H, run->K, run->L, run->W, run->H);
+		return 0;
+	}
+	if (!Same(h->dt,run->dt))
+	{
+		printf("%s was advanced with dt %g, this run uses %g\n", name, h->dt, run->dt);
+		return 0;
+	}
+	return 1;
+}
+
+/* Scheme and physics of a run of an INTEGRATOR_*, time and step are set when writing */
+void DescribeRun(FieldHeader *run, int integrator, double K, double L, double W, double H, double dt)
+{
+	memset(run, 0, sizeof(FieldHeader));
+	strncpy(run->scheme, integrator == INTEGRATOR_RKL2 ? FIELD_SCHEME_RKL2 : integrator == INTEGRATOR_ADI ? FIELD_SCHEME_ADI : FIELD_SCHEME,
+		sizeof(run->scheme));
+	run->K = K; run->L = L; run->W = W; run->H = H;
+	run->dt = dt;
+}
+
+void CopyRun(FieldHeader *h, const FieldHeader *run)
+{
+	h->time = run->time;
+	h->step = run->step;
+	h->dt = run->dt;
+	memcpy(h->scheme, run->scheme, sizeof(h->scheme));
+	h->K = run->K; h->L = run->L; h->W = run->W; h->H = run->H;
+}
+
+/***************************************************************/
+/* The data as REALs: the mapping itself when the precision    */
+/* matches, otherwise converted into the fallback array        */
+/***************************************************************/
+const REAL *FieldView(const Field *f, REAL *fallback)
+{
+	if (f->header->bytes == sizeof(REAL)) return (const REAL*)f->data;
+
+	ReadFieldPlanes(f, fallback, 0, f->header->nz);
+	return fallback;
+}
+
+/***************************************************************/
+/* Copies planes [k0,k0+n) into dst at the run's precision     */
+/***************************************************************/
+void ReadFieldPlanes(const Field *f, REAL *dst, unsigned int k0, unsigned int n)
+{
+	const FieldHeader *h = f->header;
+	const size_t XY = (size_t)h->nx*h->ny, count = XY*n;
+	size_t o;
+
+	if (h->bytes == sizeof(float))
+	{
+		const float *src = (const float*)f->data + XY*k0;
+		#pragma omp parallel for simd schedule(static)
+		for (o = 0; o < count; o++) dst[o] = src[o];
+	}
+	else
+	{
+		const double *src = (const double*)f->data + XY*k0;
+		#pragma omp parallel for simd schedule(static)
+		for (o = 0; o < count; o++) dst[o] = src[o];
+	}
+}
+
+/***************************************************************/
+/* Writes a whole field at full precision in one go            */
+/***************************************************************/
+void WriteField(const char *name, const REAL *u, unsigned int nx, unsigned int ny, unsigned int nz, unsigned int ranks, const unsigned int *planes, const FieldHeader *run)
+{
+	Field f;
+	const size_t n = (size_t)nx*ny*nz;
+	size_t o;
+
+	if (!CreateField(&f, name, nx, ny, nz, sizeof(REAL), ranks, planes)) return;
+
+	REAL *dst = (REAL*)f.data;
+	#pragma omp parallel for simd schedule(static)
+	for (o = 0; o < n; o++) dst[o] = u[o];
+
+	CopyRun(f.header, run);
+	CloseField(&f);
+}
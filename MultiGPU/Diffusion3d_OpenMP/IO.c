@@ -0,0 +1,188 @@
+//
+//  IO.c
+//  Diffusion3d-MPI-OpenMP
+//
+//  Created by Manuel Diaz on 7/26/16.
+//  Copyright © 2016 Manuel Diaz. All rights reserved.
+//
+
+#include "DiffusionMPI.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Messages from a solver rank to its server */
+#define IO_HEADER 1
+#define IO_DATA   2
+
+/*****************************************************************/
+/* Reserves I/O servers, the solver runs on the remaining ranks  */
+/*****************************************************************/
+int InitializeIO(IO *io, const char *servers, int *rank, int *numberOfProcesses, unsigned int nx, unsigned int ny, unsigned int Nz)
+{
+	int worldRank, worldSize, isServer = 0, s;
+	MPI_CHECK(MPI_Comm_rank(MPI_COMM_WORLD, &worldRank));
+	MPI_CHECK(MPI_Comm_size(MPI_COMM_WORLD, &worldSize));
+
+	io->nx = nx; io->ny = ny; io->Nz = Nz;
+	io->servers = 0;
+	io->server = -1;
+	io->clients = 0;
+	io->slot = 0;
+	io->wait_time = 0.;
+	for (s = 0; s < IO_DEPTH; s++)
+	{
+		io->stage[s] = NULL; io->size[s] = 0;
+		io->req[s][0] = io->req[s][1] = MPI_REQUEST_NULL;
+	}
+
+	if (strcmp(servers,"node") == 0)
+	{
+		// The last rank of every node serves the others
+		MPI_Comm node_comm;
+		int nodeRank, nodeSize;
+		MPI_CHECK(MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, worldRank, MPI_INFO_NULL, &node_comm));
+		MPI_CHECK(MPI_Comm_rank(node_comm, &nodeRank));
+		MPI_CHECK(MPI_Comm_size(node_comm, &nodeSize));
+		if (nodeSize < 2)
+		{
+			printf("Rank %d is alone on its node, it can not spare an I/O server\n", worldRank);
+			MPI_Abort(MPI_COMM_WORLD, 1);
+		}
+		isServer = nodeRank == nodeSize-1;
+		int candidate = isServer ? worldRank : -1;
+		MPI_CHECK(MPI_Allreduce(&candidate, &io->server, 1, MPI_INT, MPI_MAX, node_comm));
+		MPI_CHECK(MPI_Comm_free(&node_comm));
+	}
+	else if (atoi(servers) > 0)
+	{
+		// The last k ranks serve contiguous groups of solver ranks
+		const int k = atoi(servers), solvers = worldSize-k;
+		if (solvers < 1)
+		{
+			if (worldRank == 0) printf("%d I/O servers leave no rank to solve\n", k);
+			MPI_Abort(MPI_COMM_WORLD, 1);
+		}
+		isServer = worldRank >= solvers;
+		io->server = solvers + (int)((long)worldRank*k/solvers);
+	}
+
+	MPI_CHECK(MPI_Allreduce(&isServer, &io->servers, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD));
+	if (io->servers == 0) return 0;
+
+	// Servers count the solver ranks they have to wait for
+	int target = isServer ? -1 : io->server;
+	int *targets = (int*)malloc(sizeof(int)*worldSize);
+	MPI_CHECK(MPI_Allgather(&target, 1, MPI_INT, targets, 1, MPI_INT, MPI_COMM_WORLD));
+	for (s = 0; s < worldSize; s++) if (targets[s] == worldRank) io->clients++;
+	free(targets);
+	if (isServer) io->server = -1;
+
+	// Solver ranks keep their world order, so the z-slabs keep theirs
+	MPI_CHECK(MPI_Comm_split(MPI_COMM_WORLD, isServer, worldRank, &solverComm));
+	MPI_CHECK(MPI_Comm_set_errhandler(solverComm, MPI_ERRORS_RETURN));
+	MPI_CHECK(MPI_Comm_rank(solverComm, rank));
+	MPI_CHECK(MPI_Comm_size(solverComm, numberOfProcesses));
+	return isServer;
+}
+
+/***************************************************************/
+/* Hands the planes a subdomain owns to our server, no waiting */
+/***************************************************************/
+void IOPost(IO *io, const REAL *q, unsigned int z0, unsigned int nz, int iteration, int final)
+{
+	const size_t XY = (size_t)io->nx*io->ny;
+	// The end subdomains also carry the fixed boundary planes of the domain
+	const unsigned int lo = z0 == 0 ? 0 : z0+RADIUS;
+	const unsigned int hi = z0+nz == io->Nz ? io->Nz+2*RADIUS : z0+RADIUS+nz;
+	const size_t n = XY*(hi-lo);
+	const REAL *src = q + XY*(lo-z0);
+	const int s = io->slot;
+	size_t o;
+
+	// A slot is reused only once its previous piece has left, the ring absorbs slow servers
+	double wait = MPI_Wtime();
+	MPI_CHECK(MPI_Waitall(2, io->req[s], MPI_STATUSES_IGNORE));
+	io->wait_time += MPI_Wtime()-wait;
+	io->slot = (s+1)%IO_DEPTH;
+
+	if (io->size[s] < n)
+	{
+		free(io->stage[s]);
+		io->stage[s] = (float*)malloc(sizeof(float)*n);
+		io->size[s] = n;
+	}
+	float *dst = io->stage[s];
+
+	#pragma omp parallel for simd schedule(static)
+	for (o = 0; o < n; o++) dst[o] = (float)src[o];
+
+	io->header[s][0] = iteration; io->header[s][1] = lo; io->header[s][2] = hi; io->header[s][3] = final;
+	MPI_CHECK(MPI_Isend(io->header[s], 4, MPI_INT, io->server, IO_HEADER, MPI_COMM_WORLD, &io->req[s][0]));
+	MPI_CHECK(MPI_Isend(dst, n, MPI_FLOAT, io->server, IO_DATA, MPI_COMM_WORLD, &io->req[s][1]));
+}
+
+/*******************************************************************/
+/* Writes pieces where they belong in the file until clients quit  */
+/*******************************************************************/
+void IOServer(IO *io)
+{
+	const size_t XY = (size_t)io->nx*io->ny;
+	int header[4], done = 0, pieces = 0, worldRank;
+	double bytes = 0., write_time = 0.;
+	float *buffer = NULL;
+	size_t size = 0;
+	char name[64];
+	MPI_Status status;
+
+	MPI_CHECK(MPI_Comm_rank(MPI_COMM_WORLD, &worldRank));
+	while (done < io->clients)
+	{
+		MPI_CHECK(MPI_Recv(header, 4, MPI_INT, MPI_ANY_SOURCE, IO_HEADER, MPI_COMM_WORLD, &status));
+		if (header[0] < 0) { done++; continue; }
+
+		const size_t n = XY*(header[2]-header[1]);
+		if (size < n) { free(buffer); buffer = (float*)malloc(sizeof(float)*n); size = n; }
+		MPI_CHECK(MPI_Recv(buffer, n, MPI_FLOAT, status.MPI_SOURCE, IO_DATA, MPI_COMM_WORLD, MPI_STATUS_IGNORE));
+
+		// Every server writes its planes at their offset, no gather and no coordination
+		if (header[3]) sprintf(name, "result.bin");
+		else sprintf(name, "snapshot_%06d.bin", header[0]);
+		write_time -= MPI_Wtime();
+		int fd = open(name, O_WRONLY|O_CREAT, 0644);
+		// The server of the first plane cuts an older, larger file to this size; cutting to the
+		// final size never touches planes the other servers have written, whenever it happens
+		if (fd >= 0 && header[1] == 0 && ftruncate(fd, (off_t)(sizeof(float)*XY*(io->Nz+2*RADIUS))) != 0)
+		{
+			printf("I/O server %d: unable to truncate %s\n", worldRank, name);
+		}
+		if (fd < 0 || pwrite(fd, buffer, sizeof(float)*n, (off_t)(sizeof(float)*XY*header[1])) != (ssize_t)(sizeof(float)*n))
+		{
+			printf("I/O server %d: unable to write %s\n", worldRank, name);
+		}
+		if (fd >= 0) close(fd);
+		write_time += MPI_Wtime();
+		bytes += sizeof(float)*n;
+		pieces++;
+	}
+	free(buffer);
+
+	printf("I/O server %d: %d pieces from %d ranks, %.1f MB written in %lf seconds\n", worldRank, pieces, io->clients, bytes/1e6, write_time);
+}
+
+/******************************************************************/
+/* Solver ranks drain their ring and tell the server they are done */
+/******************************************************************/
+void FinalizeIO(IO *io)
+{
+	int s, quit[4] = {-1, 0, 0, 0};
+
+	if (io->server >= 0)
+	{
+		double wait = MPI_Wtime();
+		for (s = 0; s < IO_DEPTH; s++) MPI_CHECK(MPI_Waitall(2, io->req[s], MPI_STATUSES_IGNORE));
+		io->wait_time += MPI_Wtime()-wait;
+		MPI_CHECK(MPI_Send(quit, 4, MPI_INT, io->server, IO_HEADER, MPI_COMM_WORLD));
+	}
+	for (s = 0; s < IO_DEPTH; s++) free(io->stage[s]);
+	if (io->servers > 0) MPI_CHECK(MPI_Comm_free(&solverComm));
+}
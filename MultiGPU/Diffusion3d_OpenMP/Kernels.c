@@ -0,0 +1,276 @@
+//
+//  Kernels.c
+//  Diffusion3d-MPI-OpenMP
+//
+//  Created by Manuel Diaz on 7/26/16.
+//  Copyright © 2016 Manuel Diaz. All rights reserved.
+//
+
+#include "DiffusionMPI.h"
+
+/*************************************************/
+/* Stages a boundary region into a face buffer   */
+/*************************************************/
+void CopyBoundaryRegionToGhostCell(REAL *q, REAL *send_buffer, unsigned int Nx, unsigned int Ny, unsigned int _Nz, unsigned int side)
+{
+  // side = {RIGHT,LEFT}: planes {_Nz-6,_Nz-5,_Nz-4} or {3,4,5}
+  const size_t XY = Nx*Ny, n = XY*RADIUS;
+  const REAL *br = q + XY*(side == RIGHT ? _Nz-2*RADIUS : RADIUS);
+  size_t o;
+
+  #pragma omp parallel for simd schedule(static)
+  for (o = 0; o < n; o++) send_buffer[o] = br[o];
+}
+
+/***************************************************/
+/* Copies a received face into the ghost region    */
+/***************************************************/
+void CopyGhostCellToBoundaryRegion(REAL *q, const REAL *recv_buffer, unsigned int Nx, unsigned int Ny, unsigned int _Nz, unsigned int side)
+{
+  // side = {RIGHT,LEFT}: planes {_Nz-3,_Nz-2,_Nz-1} or {0,1,2}
+  const size_t XY = Nx*Ny, n = XY*RADIUS;
+  REAL *gc = q + XY*(side == RIGHT ? _Nz-RADIUS : 0);
+  size_t o;
+
+  #pragma omp parallel for simd schedule(static)
+  for (o = 0; o < n; o++) gc[o] = recv_buffer[o];
+}
+
+/*******************************************************/
+/* 4th order 3D Laplace operator on planes [kstart,kstop) */
+/*******************************************************/
+void Compute_Laplace3d(
+  const REAL * __restrict__ u,
+  REAL * __restrict__ Lu,
+  const REAL diff_x, // K/(12*dx^2)
+  const REAL diff_y, // K/(12*dy^2)
+  const REAL diff_z, // K/(12*dz^2)
+  const unsigned int Nx,
+  const unsigned int Ny,
+  const unsigned int _Nz,
+  const unsigned int kstart,
+  const unsigned int kstop)
+{
+  const unsigned int XY = Nx*Ny, Nx2 = Nx+Nx, XY2 = XY+XY;
+  const unsigned int k0 = MAX(kstart,2), k1 = MIN(kstop,_Nz-2);
+  unsigned int i, j, k, o;
+
+  // Called from inside a task this region runs on the calling thread only
+  #pragma omp parallel for collapse(2) private(i,o) schedule(static)
+  for (k = k0; k < k1; k++) {
+    for (j = 3; j < Ny-3; j++) {
+      #pragma omp simd
+      for (i = 3; i < Nx-3; i++) {
+        o = i+Nx*j+XY*k;
+        Lu[o] = diff_x * (- u[o-2]   + 16*u[o-1]  - 30*u[o] + 16*u[o+1]  - u[o+2]  ) +
+                diff_y * (- u[o-Nx2] + 16*u[o-Nx] - 30*u[o] + 16*u[o+Nx] - u[o+Nx2]) +
+                diff_z * (- u[o-XY2] + 16*u[o-XY] - 30*u[o] + 16*u[o+XY] - u[o+XY2]);
+      }
+    }
+  }
+}
+
+/**********************************************************/
+/* Same operator on plane k of a z-window, u[0..4]: k-2..k+2 */
+/**********************************************************/
+void Compute_Laplace3d_Plane(
+  const REAL * const * u,
+  REAL * __restrict__ Lu,
+  const REAL diff_x, // K/(12*dx^2)
+  const REAL diff_y, // K/(12*dy^2)
+  const REAL diff_z, // K/(12*dz^2)
+  const unsigned int Nx,
+  const unsigned int Ny)
+{
+  const REAL * __restrict__ b2 = u[0], * __restrict__ b1 = u[1], * __restrict__ c = u[2];
+  const REAL * __restrict__ a1 = u[3], * __restrict__ a2 = u[4];
+  const unsigned int Nx2 = Nx+Nx;
+  unsigned int i, j, o;
+
+  #pragma omp parallel for private(i,o) schedule(static)
+  for (j = 3; j < Ny-3; j++) {
+    #pragma omp simd
+    for (i = 3; i < Nx-3; i++) {
+      o = i+Nx*j;
+      Lu[o] = diff_x * (- c[o-2]   + 16*c[o-1]  - 30*c[o] + 16*c[o+1]  - c[o+2]  ) +
+              diff_y * (- c[o-Nx2] + 16*c[o-Nx] - 30*c[o] + 16*c[o+Nx] - c[o+Nx2]) +
+              diff_z * (- b2[o]    + 16*b1[o]   - 30*c[o] + 16*a1[o]   - a2[o]   );
+    }
+  }
+}
+
+/***********************/
+/* Runge Kutta Methods */  // <==== this is perfectly parallel!
+/***********************/
+// Step 3 also returns max|q-qo|, the change over the whole time step
+REAL Compute_sspRK(
+  REAL * __restrict__ q,
+  const REAL * __restrict__ qo,
+  const REAL * __restrict__ Lq,
+  const unsigned int step,
+  const REAL dt,
+  const unsigned int Nx,
+  const unsigned int Ny,
+  const unsigned int _Nz)
+{
+  const unsigned int XY = Nx*Ny;
+  unsigned int i, j, k, o;
+
+  // q = a*qo + b*(q+dt*Lq), step 1 relies on q == qo
+  REAL a, b;
+  switch (step) {
+    case 1: a = 0.00; b = 1.00; break; // step 1
+    case 2: a = 0.75; b = 0.25; break; // step 2
+    default: a = 1./3; b = 2./3; break; // step 3
+  }
+
+  // Ghost planes are advanced too, with the Lq received from the neighbors
+  if (step < 3) {
+    #pragma omp parallel for collapse(2) private(i,o) schedule(static)
+    for (k = 0; k < _Nz; k++) {
+      for (j = 3; j < Ny-3; j++) {
+        #pragma omp simd
+        for (i = 3; i < Nx-3; i++) {
+          o = i+Nx*j+XY*k;
+          q[o] = a*qo[o]+b*(q[o]+dt*Lq[o]);
+        }
+      }
+    }
+    return 0;
+  }
+
+  // The last update is fused with the residual, qo is read there anyway
+  REAL change = 0;
+  #pragma omp parallel for collapse(2) private(i,o) schedule(static) reduction(max:change)
+  for (k = 0; k < _Nz; k++) {
+    for (j = 3; j < Ny-3; j++) {
+      #pragma omp simd reduction(max:change)
+      for (i = 3; i < Nx-3; i++) {
+        o = i+Nx*j+XY*k;
+        q[o] = a*qo[o]+b*(q[o]+dt*Lq[o]);
+        change = fmax(change, fabs(q[o]-qo[o]));
+      }
+    }
+  }
+  return change;
+}
+
+/*****************************************************************/
+/* RKL2 stage: y = mu*y1 + nu*y2 + (1-mu-nu)*y0 + dt*(mut*L1+gt*L0) */
+/* y may be y1 or y2, updated in place; the last stage also      */
+/* returns max|y-y0|, the change over the whole time step        */
+/*****************************************************************/
+REAL Compute_RKL2(
+  REAL *y,
+  const REAL *y1,
+  const REAL *y2,
+  const REAL * __restrict__ y0,
+  const REAL * __restrict__ L1,
+  const REAL * __restrict__ L0,
+  const REAL mu,
+  const REAL nu,
+  const REAL mut,
+  const REAL gt,
+  const REAL dt,
+  const unsigned int last,
+  const unsigned int Nx,
+  const unsigned int Ny,
+  const unsigned int _Nz)
+{
+  const unsigned int XY = Nx*Ny;
+  const REAL c0 = 1-mu-nu, a1 = dt*mut, a0 = dt*gt;
+  unsigned int i, j, k, o;
+  REAL change = 0;
+
+  // Ghost planes are advanced too, with the L1 received from the neighbors
+  #pragma omp parallel for collapse(2) private(i,o) schedule(static) reduction(max:change)
+  for (k = 0; k < _Nz; k++) {
+    for (j = 3; j < Ny-3; j++) {
+      #pragma omp simd reduction(max:change)
+      for (i = 3; i < Nx-3; i++) {
+        o = i+Nx*j+XY*k;
+        y[o] = mu*y1[o]+nu*y2[o]+c0*y0[o]+a1*L1[o]+a0*L0[o];
+        if (last) change = fmax(change, fabs(y[o]-y0[o]));
+      }
+    }
+  }
+  return change;
+}
+
+/*****************************************************************/
+/* Batched Thomas solves of (1+2r)x_i - r(x_{i-1}+x_{i+1}) = d_i */
+/* with x = 0 past both ends, on every interior line of planes   */
+/* [k0,k1). The matrix is the same for all lines, c and inv hold */
+/* its elimination: c_i = -r*inv_i, inv_i = 1/(1+2r+r*c_{i-1}).  */
+/* Lines along x run with SIMD lanes over j, along y and z over  */
+/* i; d is overwritten with x, scaled by 'scale' on the way in   */
+/*****************************************************************/
+void Compute_ThomasX(REAL *d, const REAL *c, const REAL *inv, const REAL r, const REAL scale,
+  const unsigned int Nx, const unsigned int Ny, const unsigned int k0, const unsigned int k1)
+{
+  const size_t XY = (size_t)Nx*Ny;
+  unsigned int k;
+
+  #pragma omp parallel for schedule(static)
+  for (k = k0; k < k1; k++) {
+    REAL * __restrict__ p = d+XY*k;
+    int i, j;
+    #pragma omp simd
+    for (j = 3; j < (int)Ny-3; j++) p[3+Nx*j] *= scale*inv[0];
+    for (i = 4; i < (int)Nx-3; i++) {
+      #pragma omp simd
+      for (j = 3; j < (int)Ny-3; j++) p[i+Nx*j] = (scale*p[i+Nx*j]+r*p[i-1+Nx*j])*inv[i-3];
+    }
+    for (i = Nx-5; i >= 3; i--) {
+      #pragma omp simd
+      for (j = 3; j < (int)Ny-3; j++) p[i+Nx*j] -= c[i-3]*p[i+1+Nx*j];
+    }
+  }
+}
+
+void Compute_ThomasY(REAL *d, const REAL *c, const REAL *inv, const REAL r,
+  const unsigned int Nx, const unsigned int Ny, const unsigned int k0, const unsigned int k1)
+{
+  const size_t XY = (size_t)Nx*Ny;
+  unsigned int k;
+
+  #pragma omp parallel for schedule(static)
+  for (k = k0; k < k1; k++) {
+    REAL * __restrict__ p = d+XY*k;
+    int i, j;
+    #pragma omp simd
+    for (i = 3; i < (int)Nx-3; i++) p[i+Nx*3] *= inv[0];
+    for (j = 4; j < (int)Ny-3; j++) {
+      #pragma omp simd
+      for (i = 3; i < (int)Nx-3; i++) p[i+Nx*j] = (p[i+Nx*j]+r*p[i+Nx*(j-1)])*inv[j-3];
+    }
+    for (j = Ny-5; j >= 3; j--) {
+      #pragma omp simd
+      for (i = 3; i < (int)Nx-3; i++) p[i+Nx*j] -= c[j-3]*p[i+Nx*(j+1)];
+    }
+  }
+}
+
+// Here the lines are the m planes from k0, split by rows j among the threads
+void Compute_ThomasZ(REAL *d, const REAL *c, const REAL *inv, const REAL r,
+  const unsigned int Nx, const unsigned int Ny, const unsigned int k0, const unsigned int m)
+{
+  const size_t XY = (size_t)Nx*Ny;
+  int j;
+
+  #pragma omp parallel for schedule(static)
+  for (j = 3; j < (int)Ny-3; j++) {
+    REAL * __restrict__ p = d+XY*k0+Nx*j;
+    int i, k;
+    #pragma omp simd
+    for (i = 3; i < (int)Nx-3; i++) p[i] *= inv[0];
+    for (k = 1; k < (int)m; k++) {
+      #pragma omp simd
+      for (i = 3; i < (int)Nx-3; i++) p[i+XY*k] = (p[i+XY*k]+r*p[i+XY*(k-1)])*inv[k];
+    }
+    for (k = m-2; k >= 0; k--) {
+      #pragma omp simd
+      for (i = 3; i < (int)Nx-3; i++) p[i+XY*k] -= c[k]*p[i+XY*(k+1)];
+    }
+  }
+}
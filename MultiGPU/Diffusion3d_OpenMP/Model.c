@@ -0,0 +1,292 @@
+//
+//  Model.c
+//  Diffusion3d-MPI-OpenMP
+//
+//  Created by Manuel Diaz on 7/26/16.
+//  Copyright © 2016 Manuel Diaz. All rights reserved.
+//
+
+#include "DiffusionMPI.h"
+#include <unistd.h>
+
+/*****************************************************************/
+/* Performance model of the time loop. Short probes measure the  */
+/* copy bandwidth of one rank alone and of every rank at once,   */
+/* the cost per cell and per call of the Laplacian and the RK    */
+/* update on a few planes of the grid, the cost of a task and    */
+/* the MPI latency and bandwidth between ranks 0 and 1. A step   */
+/* is then the data the solver moves and the cells it updates,   */
+/* each kernel taking the longer of its arithmetic and its       */
+/* memory traffic, plus the halo the inner planes cannot hide.   */
+/* The decomposition is along z, a plan is a number of ranks and */
+/* of blocks per rank                                            */
+/*****************************************************************/
+
+/* Ranks not probing wait without spinning on a core */
+static void Idle(int active)
+{
+	MPI_Request request;
+	int done = 0;
+	MPI_CHECK(MPI_Ibarrier(solverComm, &request));
+	if (active) { MPI_CHECK(MPI_Wait(&request, MPI_STATUS_IGNORE)); return; }
+	while (!done)
+	{
+		MPI_CHECK(MPI_Test(&request, &done, MPI_STATUS_IGNORE));
+		if (!done) usleep(1000);
+	}
+}
+
+/* Copy bandwidth in bytes/s, best of MODEL_REPEATS */
+static double Bandwidth(void)
+{
+	const size_t n = (size_t)MODEL_STREAM_MB*(1<<20)/sizeof(REAL);
+	REAL *a = (REAL*)malloc(sizeof(REAL)*n), *b = (REAL*)malloc(sizeof(REAL)*n);
+	double best = 0;
+	size_t i;
+
+	#pragma omp parallel for schedule(static)
+	for (i = 0; i < n; i++) { a[i] = 1; b[i] = 0; }
+	for (int r = 0; r < MODEL_REPEATS; r++)
+	{
+		double t = MPI_Wtime();
+		#pragma omp parallel for simd schedule(static)
+		for (i = 0; i < n; i++) b[i] = a[i];
+		t = MPI_Wtime()-t;
+		if (t > 0) best = MAX(best, 2.*sizeof(REAL)*n/t);
+	}
+	free(a); free(b);
+	return best;
+}
+
+/* Seconds of one Laplacian and one RK update over 'planes' planes of nx x ny, best of MODEL_REPEATS */
+static void Kernels(unsigned int nx, unsigned int ny, unsigned int planes, double *laplace, double *update)
+{
+	const unsigned int NZ = planes+2*RADIUS;
+	const size_t size = (size_t)nx*ny*NZ;
+	REAL *u = (REAL*)malloc(sizeof(REAL)*size), *uo = (REAL*)malloc(sizeof(REAL)*size), *Lu = (REAL*)malloc(sizeof(REAL)*size);
+	for (size_t o = 0; o < size; o++) { u[o] = uo[o] = (REAL)(o%7); Lu[o] = 0; }
+
+	*laplace = *update = 1e30;
+	for (int r = 0; r < MODEL_REPEATS; r++)
+	{
+		double t = MPI_Wtime();
+		Compute_Laplace3d(u, Lu, 1e-3, 1e-3, 1e-3, nx, ny, NZ, RADIUS, planes+RADIUS);
+		*laplace = MIN(*laplace, MPI_Wtime()-t);
+		t = MPI_Wtime();
+		Compute_sspRK(u, uo, Lu, 2, 1e-3, nx, ny, NZ);
+		*update = MIN(*update, MPI_Wtime()-t);
+	}
+	free(u); free(uo); free(Lu);
+}
+
+/* Seconds per task spawned from a single producer */
+static double Tasks(void)
+{
+	double best = 1e30;
+	for (int r = 0; r < MODEL_REPEATS; r++)
+	{
+		double t = MPI_Wtime();
+		#pragma omp parallel
+		#pragma omp single
+		for (int i = 0; i < MODEL_TASKS; i++)
+		{
+			#pragma omp task
+			{ }
+		}
+		best = MIN(best, (MPI_Wtime()-t)/MODEL_TASKS);
+	}
+	return best;
+}
+
+/* Half round trip of a message of 'bytes' between ranks 0 and 1 */
+static double PingPong(int rank, char *buffer, int bytes)
+{
+	double best = 1e30;
+	for (int r = 0; r < MODEL_REPEATS; r++)
+	{
+		double t = MPI_Wtime();
+		for (int i = 0; i < MODEL_PINGS; i++)
+		{
+			if (rank == 0)
+			{
+				MPI_CHECK(MPI_Send(buffer, bytes, MPI_CHAR, 1, 0, solverComm));
+				MPI_CHECK(MPI_Recv(buffer, bytes, MPI_CHAR, 1, 0, solverComm, MPI_STATUS_IGNORE));
+			}
+			else
+			{
+				MPI_CHECK(MPI_Recv(buffer, bytes, MPI_CHAR, 0, 0, solverComm, MPI_STATUS_IGNORE));
+				MPI_CHECK(MPI_Send(buffer, bytes, MPI_CHAR, 0, 0, solverComm));
+			}
+		}
+		best = MIN(best, (MPI_Wtime()-t)/(2*MODEL_PINGS));
+	}
+	return best;
+}
+
+/*****************************************************************/
+/* Collective: every rank ends with the parameters of rank 0,    */
+/* the node bandwidth is that of the slowest node                */
+/*****************************************************************/
+void CalibrateMachine(Machine *m, int rank, int numberOfProcesses, unsigned int nx, unsigned int ny)
+{
+	const double start = MPI_Wtime();
+	memset(m, 0, sizeof(Machine));
+	m->threads = omp_get_max_threads();
+	m->cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	m->cache = MAX(0., (double)sysconf(_SC_LEVEL3_CACHE_SIZE));
+
+	MPI_Comm node;
+	MPI_CHECK(MPI_Comm_split_type(solverComm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node));
+	MPI_CHECK(MPI_Comm_size(node, &m->node_ranks));
+
+	// Rank 0 alone: bandwidth, kernels and tasks. The kernels run on planes of
+	// this grid, fewer rows when they would not fit MODEL_TILE_MB, and the cost
+	// per cell is the difference of two depths, the per-call cost what remains
+	if (rank == 0)
+	{
+		double l1, u1, l2, u2;
+		const unsigned int p1 = MODEL_PLANES/4, p2 = MODEL_PLANES;
+		const unsigned int rows = (unsigned int)MIN((size_t)ny, MAX((size_t)4*RADIUS, ((size_t)MODEL_TILE_MB<<20)/(3*sizeof(REAL)*nx*(p2+2*RADIUS))));
+		const double XY = (double)nx*rows, used = MIN(m->threads, MAX(1, m->cores));
+		m->bw = Bandwidth();
+		Kernels(nx, rows, p1, &l1, &u1);
+		Kernels(nx, rows, p2, &l2, &u2);
+		m->laplace = MAX(0., (l2-l1)/(XY*(p2-p1)))*used;
+		m->update = MAX(0., (u2-u1)/(XY*(p2-p1)))*used;
+		m->call = MAX(0., 0.5*(l1-m->laplace/used*XY*p1+u1-m->update/used*XY*(p1+2*RADIUS)));
+		m->task = Tasks();
+	}
+	Idle(rank == 0);
+
+	// Every rank at once: what a node delivers
+	MPI_CHECK(MPI_Barrier(solverComm));
+	double bw = Bandwidth(), node_bw = 0;
+	MPI_CHECK(MPI_Allreduce(&bw, &node_bw, 1, MPI_DOUBLE, MPI_SUM, node));
+	MPI_CHECK(MPI_Allreduce(MPI_IN_PLACE, &node_bw, 1, MPI_DOUBLE, MPI_MIN, solverComm));
+	MPI_CHECK(MPI_Allreduce(MPI_IN_PLACE, &m->node_ranks, 1, MPI_INT, MPI_MAX, solverComm));
+	MPI_CHECK(MPI_Comm_free(&node));
+
+	// Ranks 0 and 1: an empty message and a face
+	const int face = (int)(sizeof(REAL)*nx*ny*RADIUS);
+	if (numberOfProcesses > 1 && rank < 2)
+	{
+		char *buffer = (char*)calloc(face, 1);
+		const double small = PingPong(rank, buffer, 8), large = PingPong(rank, buffer, face);
+		m->latency = small;
+		m->mpi_bw = large > small ? face/(large-small) : face/large;
+		m->measured_mpi = 1;
+		free(buffer);
+	}
+	Idle(rank < 2);
+
+	MPI_CHECK(MPI_Bcast(m, sizeof(Machine), MPI_BYTE, 0, solverComm));
+	m->node_bw = node_bw;
+	// A single rank copies faces between its own buffers, as the shared memory halo does
+	if (!m->measured_mpi) { m->latency = 0; m->mpi_bw = m->bw; }
+	m->probe_time = MPI_Wtime()-start;
+}
+
+/*****************************************************************/
+/* Seconds per step of the thickest of 'ranks' slabs, split in   */
+/* 'blocks' task blocks (0: one slab), and its exposed halo      */
+/*****************************************************************/
+double PredictStep(const Machine *m, int ranks, int blocks, unsigned int nx, unsigned int ny, unsigned int Nz, double *halo)
+{
+	const double S = sizeof(REAL), XY = (double)nx*ny, R = RADIUS;
+	const int node = MIN(ranks, m->node_ranks); // ranks fill nodes like the probing job
+	const double bw = MIN(m->bw, m->node_bw/node);
+	const double slow = MAX(1., (double)node*m->threads/MAX(1, m->cores)); // oversubscribed cores
+	const int B = blocks > 0 ? blocks : 1;
+	const double nz = DIVIDE_INTO(Nz, ranks), nb = nz/B, NB = nb+2*R;
+	const int faces = ranks > 2 ? 2 : ranks-1;
+
+	// Arrays that stay in cache between stages cost their arithmetic only
+	const int cached = m->cache > 0 && 3*S*XY*B*NB <= m->cache/node;
+	const double mem = cached ? 0 : 1./bw;
+
+	// Threads per kernel call: the team on a slab, one per block task
+	const double threads = blocks > 0 ? MIN(m->threads, B) : m->threads;
+
+	// Thread-seconds and bytes of each kernel over the rank, per step
+	const double copy_s = m->update*XY*B*NB, copy_b = 2*S*XY*B*NB;
+	const double lap_s = 3*m->laplace*XY*B*nb, lap_b = 3*S*XY*B*(NB+nb);
+	const double upd_s = 3*m->update*XY*B*NB, upd_b = 3*4*S*XY*B*NB;
+	const double ghost = 3*2*S*XY*R*(2*(B-1)+2*faces); // copies between blocks, packs and unpacks
+
+	// Each kernel is bound by its arithmetic or its traffic
+	const double copy = MAX(copy_s*slow/threads, copy_b*mem);
+	const double lap = MAX(lap_s*slow/threads, lap_b*mem);
+	const double upd = MAX(upd_s*slow/threads, upd_b*mem);
+	double compute = copy+lap+upd+ghost*mem, hidden;
+
+	if (blocks > 0)
+	{
+		// Tasks spawned by one thread; the inner blocks' stage hides the halo
+		compute += (B+3*(B+2*faces+(B-1)+2+B))*m->task;
+		hidden = B > faces ? (lap+upd)/3*(B-faces)/B : 0;
+	}
+	else
+	{
+		// A parallel region per kernel call; the inner planes' Laplacian hides the halo
+		compute += (1+3*(2+3*faces))*m->call*slow;
+		hidden = lap/3*(nz-faces*R)/nz;
+	}
+
+	// Faces of a stage leave together and wait behind the inner planes
+	const double comm = faces > 0 ? m->latency+faces*S*XY*R/m->mpi_bw : 0;
+	const double exposed = 3*MAX(0., comm-hidden);
+	if (halo) *halo = exposed;
+	return compute+exposed;
+}
+
+/* Blocks per rank from 1 up while blocks stay thick enough, 0 (one slab) first */
+static int NextTile(int blocks, int ranks, unsigned int Nz)
+{
+	const int next = blocks == 0 ? 1 : 2*blocks;
+	return (unsigned int)(next*ranks*2*RADIUS) <= Nz && next <= MODEL_BLOCKS ? next : -1;
+}
+
+/*****************************************************************/
+/* Rank 0 prints the parameters, the predicted step over rank    */
+/* counts and tiles, and the recommended configuration           */
+/*****************************************************************/
+void PrintPlan(const Machine *m, int numberOfProcesses, unsigned int nx, unsigned int ny, unsigned int Nz)
+{
+	const int most = MAX(1, MIN(MAX(numberOfProcesses, m->cores/MAX(1, m->threads)), (int)(Nz/(2*RADIUS)))); // slabs hold both boundary regions
+	double *best = (double*)malloc(sizeof(double)*(most+1));
+	int *tile = (int*)malloc(sizeof(int)*(most+1));
+	int p, b;
+
+	printf("Performance model, %u x %u x %u, %d threads per rank (probes %.2f s)\n", nx, ny, Nz, m->threads, m->probe_time);
+	printf("Copy bandwidth                               :  %.2f GB/s one rank, %.2f GB/s %d ranks of a node\n", m->bw*1e-9, m->node_bw*1e-9, m->node_ranks);
+	printf("Laplacian FD4                                :  %.3f ns per cell and thread, %.2f us per call\n", m->laplace*1e9, m->call*1e6);
+	printf("RK update                                    :  %.3f ns per cell and thread\n", m->update*1e9);
+	printf("Tasks                                        :  %.3f us each\n", m->task*1e6);
+	if (m->measured_mpi) printf("MPI ranks 0-1                                :  %.2f us latency, %.2f GB/s\n", m->latency*1e6, m->mpi_bw*1e-9);
+	else printf("MPI                                          :  not measured on one rank, faces copied at memory bandwidth\n");
+	printf("Last-level cache                             :  %.0f MB per node, %d cores\n\n", m->cache/(1<<20), m->cores);
+
+	printf("%5s %8s %10s %10s %10s %8s %8s %8s\n", "ranks", "planes", "slab ms", "halo ms", "blocks", "best ms", "speedup", "effic.");
+	for (p = 1; p <= most; p++)
+	{
+		double halo, slab = PredictStep(m, p, 0, nx, ny, Nz, &halo);
+		best[p] = slab; tile[p] = 0;
+		for (b = NextTile(0, p, Nz); b > 0; b = NextTile(b, p, Nz))
+		{
+			const double step = PredictStep(m, p, b, nx, ny, Nz, NULL);
+			if (step < best[p]) { best[p] = step; tile[p] = b; }
+		}
+		// Blocks have to pay for themselves, a near tie keeps the slab
+		if (tile[p] > 0 && (1+MODEL_TOLERANCE)*best[p] > slab) { best[p] = slab; tile[p] = 0; }
+		printf("%5d %8u %10.3f %10.3f %10d %8.3f %8.2f %7.1f%%%s\n", p, DIVIDE_INTO(Nz, p), 1e3*slab, 1e3*halo, tile[p], 1e3*best[p],
+			best[1]/best[p], 100*best[1]/(p*best[p]), p*m->threads > m->cores ? "  oversubscribed" : "");
+	}
+
+	// The fewest ranks within MODEL_TOLERANCE of the fastest plan
+	int fastest = 1, pick;
+	for (p = 2; p <= most; p++) if (best[p] < best[fastest]) fastest = p;
+	for (pick = 1; best[pick] > (1+MODEL_TOLERANCE)*best[fastest]; pick++);
+	printf("Recommended                                  :  -np %d -blocks %d, %.3f ms/step predicted\n", pick, tile[pick], 1e3*best[pick]);
+	printf("===================================================================\n");
+	free(best); free(tile);
+}
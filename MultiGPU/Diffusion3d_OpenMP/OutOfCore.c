@@ -0,0 +1,176 @@
+//
+//  OutOfCore.c
+//  Diffusion3d-MPI-OpenMP
+//
+//  Created by Manuel Diaz on 7/26/16.
+//  Copyright © 2016 Manuel Diaz. All rights reserved.
+//
+
+#include "DiffusionMPI.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Plane k of a stage window */
+#define PLANE(ring,k) ((ring) + XY*((k)%OOC_RING))
+
+/*********************************************************/
+/* Applies madvise to whole pages inside planes [k0,k1)  */
+/*********************************************************/
+static void Advise(REAL *u, size_t XY, unsigned int k0, unsigned int k1, int advice)
+{
+	const size_t page = sysconf(_SC_PAGESIZE);
+	size_t lo = sizeof(REAL)*XY*k0, hi = sizeof(REAL)*XY*k1;
+	lo = (lo+page-1)/page*page; hi = hi/page*page;
+	if (lo < hi) madvise((char*)u+lo, hi-lo, advice);
+}
+
+static void CopyPlane(REAL *dst, const REAL *src, size_t XY)
+{
+	size_t o;
+	#pragma omp parallel for simd schedule(static)
+	for (o = 0; o < XY; o++) dst[o] = src[o];
+}
+
+/***************************************************************/
+/* RK stage on plane k: out = a*uo + b*(in + dt*L(in)), in the */
+/* window of the previous stage; L vanishes on fixed planes    */
+/***************************************************************/
+static void Stage(REAL *out, const REAL *uo, const REAL *in, REAL *Lu, unsigned int k, unsigned int step,
+	REAL kx, REAL ky, REAL kz, REAL dt, unsigned int nx, unsigned int ny, unsigned int NZ)
+{
+	const size_t XY = (size_t)nx*ny;
+
+	if (k >= RADIUS && k < NZ-RADIUS)
+	{
+		const REAL *window[5] = {PLANE(in,k-2), PLANE(in,k-1), PLANE(in,k), PLANE(in,k+1), PLANE(in,k+2)};
+		Compute_Laplace3d_Plane(window, Lu, kx, ky, kz, nx, ny);
+	}
+	else
+	{
+		memset(Lu, 0, sizeof(REAL)*XY);
+	}
+	CopyPlane(out, PLANE(in,k), XY);
+	Compute_sspRK(out, uo, Lu, step, dt, nx, ny, 1);
+}
+
+/******************************************************************/
+/* Diffusion on a field kept in a file, streamed one plane at a   */
+/* time: the three RK stages march along z as a pipeline, stage s */
+/* trailing stage s-1 by RADIUS-1 planes, so memory holds three   */
+/* windows of OOC_RING planes whatever the size of the grid       */
+/******************************************************************/
+void SolveOutOfCore(const char *path, const char *icFile, const FieldHeader *run, REAL kx, REAL ky, REAL kz, REAL dt, REAL tEnd,
+	REAL dx, REAL dy, REAL dz, unsigned int nx, unsigned int ny, unsigned int Nz, int numberOfThreads)
+{
+	const unsigned int NZ = Nz+2*RADIUS, lag = 2;
+	const size_t XY = (size_t)nx*ny, bytes = sizeof(REAL)*XY*NZ;
+	unsigned int k;
+
+	// The field lives in a field file, the page cache stages it. A run continuing
+	// that file itself opens it in place, recreating it would erase the state
+	struct stat st, ic_st;
+	const int inPlace = icFile && stat(path, &st) == 0 && stat(icFile, &ic_st) == 0 &&
+		st.st_dev == ic_st.st_dev && st.st_ino == ic_st.st_ino;
+	Field field;
+	if (inPlace)
+	{
+		if (!OpenField(&field, path, 1) || !FieldMatches(&field, path, nx, ny, NZ)) exit(1);
+		if (field.header->bytes != sizeof(REAL))
+		{
+			printf("%s holds %u-byte values, this build streams %u-byte ones: continue from a copy\n",
+				path, (unsigned int)field.header->bytes, (unsigned int)sizeof(REAL));
+			exit(1);
+		}
+	}
+	else if (!CreateField(&field, path, nx, ny, NZ, sizeof(REAL), 1, &Nz)) exit(1);
+	REAL *u = (REAL*)field.data;
+	const int fd = field.fd;
+	const off_t offset = field.header->offset;
+	madvise(u, bytes, MADV_SEQUENTIAL);
+
+	if (inPlace)
+	{
+		printf("Continuing %s in place\n", path);
+	}
+	else if (icFile)
+	{
+		// Copied a plane at a time, the IC can be as large as the field
+		Field ic;
+		if (!OpenField(&ic, icFile, 0) || !FieldMatches(&ic, icFile, nx, ny, NZ)) exit(1);
+		for (k = 0; k < NZ; k++) ReadFieldPlanes(&ic, u+XY*k, k, 1);
+		CloseField(&ic);
+	}
+	else
+	{
+		Init_domain(1,u,dx,dy,dz,nx,ny,NZ);
+	}
+	SaveBinary3D(u,nx,ny,NZ,"initial.bin");
+	printf("IC saved in %s\n", path);
+
+	// Windows of u^n, u^(1) and u^(2); u^(n+1) goes straight back to the file
+	REAL *u0 = (REAL*)malloc(sizeof(REAL)*XY*OOC_RING);
+	REAL *u1 = (REAL*)malloc(sizeof(REAL)*XY*OOC_RING);
+	REAL *u2 = (REAL*)malloc(sizeof(REAL)*XY*OOC_RING);
+	REAL *Lu = (REAL*)malloc(sizeof(REAL)*XY);
+
+	// A continued run starts where its field file left off
+	const int it0 = run->step;
+	int it = it0;
+	REAL t = run->time;
+	double compute_timer = -MPI_Wtime();
+
+	while (t < tEnd)
+	{
+		t+=dt; it+=1;
+
+		// Plane k is read while stage 1 runs on k-2, stage 2 on k-4 and stage 3 on k-6
+		for (k = 0; k < NZ+3*lag; k++)
+		{
+			if (k < NZ)
+			{
+				// Prefetch: the kernel reads ahead while we compute
+				Advise(u, XY, k+1, MIN(k+1+OOC_PREFETCH,NZ), MADV_WILLNEED);
+				CopyPlane(PLANE(u0,k), u+XY*k, XY);
+			}
+			if (k >= lag && k-lag < NZ)
+			{
+				Stage(PLANE(u1,k-lag), PLANE(u0,k-lag), u0, Lu, k-lag, 1, kx, ky, kz, dt, nx, ny, NZ);
+			}
+			if (k >= 2*lag && k-2*lag < NZ)
+			{
+				Stage(PLANE(u2,k-2*lag), PLANE(u0,k-2*lag), u1, Lu, k-2*lag, 2, kx, ky, kz, dt, nx, ny, NZ);
+			}
+			if (k >= 3*lag && k-3*lag < NZ)
+			{
+				// Plane k-6 of u^n was read long ago, it is safe to overwrite
+				const unsigned int p = k-3*lag;
+				Stage(u+XY*p, PLANE(u0,p), u2, Lu, p, 3, kx, ky, kz, dt, nx, ny, NZ);
+
+				// Write-behind: start the writeback and drop the pages from our address space
+				sync_file_range(fd, offset+sizeof(REAL)*XY*p, sizeof(REAL)*XY, SYNC_FILE_RANGE_WRITE);
+				Advise(u, XY, p > 0 ? p-1 : 0, p+1, MADV_DONTNEED);
+			}
+		}
+	}
+
+	compute_timer += MPI_Wtime();
+	printf("dt: %g, iterations: %d, final time: %g\n\n",dt,it,t);
+
+	// The file is left holding the final state
+	CopyRun(field.header, run);
+	field.header->time = t;
+	field.header->step = it;
+	if (WRITE) SaveBinary3D(u,nx,ny,NZ,"result.bin");
+
+	float gflops = CalcGflops(compute_timer, it-it0, 3, nx, ny, NZ);
+	PrintSummary("Diffusion-3D MPI-OpenMP-FD4", "Out-of-core stream", compute_timer, gflops, it-it0, 3, nx, ny, NZ, 1, numberOfThreads);
+	printf("Field file                                   :  %s, %.1f MB\n", path, bytes/1e6);
+	printf("Resident windows                             :  %.1f MB\n", sizeof(REAL)*XY*(3*OOC_RING+1)/1e6);
+	printf("Streamed (read + write)                      :  %.1f MB/s\n", 2.*bytes*(it-it0)/compute_timer/1e6);
+	printf("===================================================================\n");
+
+	free(u0); free(u1); free(u2); free(Lu);
+	CloseField(&field);
+}
@@ -0,0 +1,229 @@
+//
+//  Preview.c
+//  Diffusion3d-MPI-OpenMP
+//
+//  Created by Manuel Diaz on 7/26/16.
+//  Copyright © 2016 Manuel Diaz. All rights reserved.
+//
+
+#include "DiffusionMPI.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Plane of level l-1 sent down to the rank that pairs it, clear of halo and block tags */
+#define TAG(l) (8+(l))
+
+/*****************************************************************/
+/* Level l halves level l-1 in every direction: each coarse cell */
+/* reduces the (up to) 2x2x2 cells it covers to their mean, or   */
+/* to their max so that fronts and shocks keep their height.     */
+/* Coarse plane K of a level belongs to the rank owning plane 2K */
+/* of the level below, so a rank only lacks plane 2K+1 at the    */
+/* top of its range, which the next rank sends                   */
+/*****************************************************************/
+void InitializePreview(Preview *P, int levels, int max, int rank, int numberOfProcesses, unsigned int nx, unsigned int ny, unsigned int Nz)
+{
+	int l;
+	P->levels = MIN(MAX(levels,1), PREVIEW_LEVELS_MAX);
+	P->max = max;
+	P->rank = rank;
+	P->size = numberOfProcesses;
+	P->count = 0;
+	P->bytes = 0.;
+	P->nx[0] = nx; P->ny[0] = ny; P->nz[0] = Nz+2*RADIUS;
+	for (l = 1; l <= P->levels; l++)
+	{
+		P->nx[l] = (P->nx[l-1]+1)/2;
+		P->ny[l] = (P->ny[l-1]+1)/2;
+		P->nz[l] = (P->nz[l-1]+1)/2;
+	}
+	for (l = 0; l <= P->levels; l++)
+	{
+		P->level[l] = NULL; P->planes[l] = 0;
+		P->lo[l] = (unsigned int*)malloc(sizeof(unsigned int)*numberOfProcesses);
+		P->hi[l] = (unsigned int*)malloc(sizeof(unsigned int)*numberOfProcesses);
+	}
+	P->extra = (float*)malloc(sizeof(float)*nx*ny);
+	P->pair = (float*)malloc(sizeof(float)*2*nx*ny);
+
+	if (rank == 0)
+	{
+		FILE *pFile = fopen("preview_index.txt", "w");
+		fprintf(pFile, "# level nx ny nz reduction, in preview_l<level>_<iteration>.bin\n");
+		for (l = 1; l <= P->levels; l++)
+		{
+			fprintf(pFile, "%d %u %u %u %s\n", l, P->nx[l], P->ny[l], P->nz[l], max ? "max" : "mean");
+		}
+		fclose(pFile);
+	}
+}
+
+void FinalizePreview(Preview *P)
+{
+	for (int l = 0; l <= P->levels; l++) { free(P->level[l]); free(P->lo[l]); free(P->hi[l]); }
+	free(P->extra);
+	free(P->pair);
+}
+
+/* Fine planes [lo,hi) a subdomain owns, the fixed planes go with the end ones */
+static void Owned(unsigned int z0, unsigned int nz, unsigned int Nz, unsigned int *lo, unsigned int *hi)
+{
+	*lo = z0 == 0 ? 0 : z0+RADIUS;
+	*hi = z0+nz == Nz ? Nz+2*RADIUS : z0+RADIUS+nz;
+}
+
+/* Level 0 plane k of this rank as floats */
+static void FinePlane(float *dst, const REAL *h_s_u, const BlockSet *set, const Decomposition *decomp, int blocks, int rank, unsigned int k, size_t XY)
+{
+	const REAL *src;
+	size_t o;
+	if (blocks > 0)
+	{
+		const unsigned int g1 = set->owner.z0[rank]+set->owner.nz[rank]-1;
+		unsigned int g = set->owner.z0[rank];
+		while (g < g1 && k >= set->b[g].z0+RADIUS+set->b[g].nz) g++;
+		src = set->b[g].u + XY*(k-set->b[g].z0);
+	}
+	else
+	{
+		src = h_s_u + XY*(k-decomp->z0[rank]);
+	}
+	#pragma omp parallel for simd schedule(static)
+	for (o = 0; o < XY; o++) dst[o] = (float)src[o];
+}
+
+/* One coarse plane from planes a and b (NULL past the top) of the level below */
+static void Reduce(float *out, const float *a, const float *b, unsigned int nx, unsigned int ny, unsigned int cx, unsigned int cy, int max)
+{
+	unsigned int I, J;
+	#pragma omp parallel for private(I) schedule(static)
+	for (J = 0; J < cy; J++)
+	{
+		for (I = 0; I < cx; I++)
+		{
+			const unsigned int i1 = MIN(2*I+2, nx), j1 = MIN(2*J+2, ny);
+			float r = max ? a[(size_t)nx*2*J+2*I] : 0.f;
+			int n = 0;
+			for (unsigned int j = 2*J; j < j1; j++)
+			{
+				for (unsigned int i = 2*I; i < i1; i++)
+				{
+					const size_t o = (size_t)nx*j+i;
+					if (max) { r = MAX(r, a[o]); if (b) r = MAX(r, b[o]); }
+					else { r += a[o]; n++; if (b) { r += b[o]; n++; } }
+				}
+			}
+			out[(size_t)cx*J+I] = max ? r : r/n;
+		}
+	}
+}
+
+/*****************************************************************/
+/* Builds the coarse levels from the planes this rank owns and   */
+/* writes them in place, preview_l<l>_<it>.bin, no gather        */
+/*****************************************************************/
+void WritePreview(Preview *P, const REAL *h_s_u, const BlockSet *set, const Decomposition *decomp, int blocks, int it)
+{
+	const int rank = P->rank;
+	const unsigned int Nz = decomp->Nz;
+	unsigned int lo, hi, K;
+	char name[64];
+	int r, l;
+
+	// Ownership of every rank at every level, the partition may have moved
+	for (r = 0; r < P->size; r++)
+	{
+		if (blocks > 0)
+		{
+			const unsigned int g0 = set->owner.z0[r], g1 = g0+set->owner.nz[r];
+			if (g1 == g0) { P->lo[0][r] = P->hi[0][r] = 0; continue; }
+			Owned(set->b[g0].z0, set->b[g0].nz, Nz, &P->lo[0][r], &hi);
+			Owned(set->b[g1-1].z0, set->b[g1-1].nz, Nz, &lo, &P->hi[0][r]);
+		}
+		else
+		{
+			Owned(decomp->z0[r], decomp->nz[r], Nz, &P->lo[0][r], &P->hi[0][r]);
+		}
+	}
+	for (l = 1; l <= P->levels; l++)
+	{
+		for (r = 0; r < P->size; r++)
+		{
+			P->lo[l][r] = (P->lo[l-1][r]+1)/2;
+			P->hi[l][r] = (P->hi[l-1][r]+1)/2;
+		}
+	}
+
+	for (l = 1; l <= P->levels; l++)
+	{
+		const unsigned int nx = P->nx[l-1], ny = P->ny[l-1], cx = P->nx[l], cy = P->ny[l];
+		const size_t XY = (size_t)nx*ny, CXY = (size_t)cx*cy;
+		const unsigned int slo = P->lo[l-1][rank], shi = P->hi[l-1][rank];
+		lo = P->lo[l][rank]; hi = P->hi[l][rank];
+
+		// Our first plane, when odd, completes the top coarse plane of the previous owner
+		MPI_Request req = MPI_REQUEST_NULL;
+		if (slo < shi && slo%2 == 1)
+		{
+			for (r = rank-1; P->lo[l-1][r] == P->hi[l-1][r]; r--);
+			if (l == 1) FinePlane(P->pair, h_s_u, set, decomp, blocks, rank, slo, XY);
+			MPI_CHECK(MPI_Isend(l == 1 ? P->pair : P->level[l-1], XY, MPI_FLOAT, r, TAG(l), solverComm, &req));
+		}
+		const int needs = lo < hi && shi%2 == 1 && shi < P->nz[l-1];
+		if (needs)
+		{
+			for (r = rank+1; P->lo[l-1][r] == P->hi[l-1][r]; r++);
+			MPI_CHECK(MPI_Recv(P->extra, XY, MPI_FLOAT, r, TAG(l), solverComm, MPI_STATUS_IGNORE));
+		}
+		MPI_CHECK(MPI_Wait(&req, MPI_STATUS_IGNORE));
+
+		if (P->planes[l] < hi-lo)
+		{
+			free(P->level[l]);
+			P->level[l] = (float*)malloc(sizeof(float)*CXY*(hi-lo));
+			P->planes[l] = hi-lo;
+		}
+		for (K = lo; K < hi; K++)
+		{
+			const unsigned int k = 2*K;
+			const float *a, *b = NULL;
+			if (l == 1)
+			{
+				// Fine planes are converted a pair at a time
+				FinePlane(P->pair, h_s_u, set, decomp, blocks, rank, k, XY);
+				if (k+1 < shi) FinePlane(P->pair+XY, h_s_u, set, decomp, blocks, rank, k+1, XY);
+				a = P->pair;
+				if (k+1 < shi) b = P->pair+XY;
+			}
+			else
+			{
+				a = P->level[l-1] + XY*(k-slo);
+				if (k+1 < shi) b = a+XY;
+			}
+			if (k+1 == shi && needs) b = P->extra;
+			Reduce(P->level[l]+CXY*(K-lo), a, b, nx, ny, cx, cy, P->max);
+		}
+
+		// Every rank writes its coarse planes where they belong
+		if (lo < hi)
+		{
+			sprintf(name, "preview_l%d_%06d.bin", l, it);
+			int fd = open(name, O_WRONLY|O_CREAT, 0644);
+			const size_t bytes = sizeof(float)*CXY*(hi-lo);
+			if (fd < 0 || pwrite(fd, P->level[l], bytes, (off_t)(sizeof(float)*CXY*lo)) != (ssize_t)bytes)
+			{
+				printf("Rank %d: unable to write %s\n", rank, name);
+			}
+
+			// The owner of the first plane cuts an older, larger file to the level's size,
+			// which never touches planes the other ranks have written
+			if (fd >= 0 && lo == 0 && ftruncate(fd, (off_t)(sizeof(float)*CXY*P->nz[l])) != 0)
+			{
+				printf("Rank %d: unable to truncate %s\n", rank, name);
+			}
+			if (fd >= 0) close(fd);
+			P->bytes += bytes;
+		}
+	}
+	P->count++;
+}
@@ -0,0 +1,421 @@
+//
+//  Profile.c
+//  Diffusion3d-MPI-OpenMP
+//
+//  Created by Manuel Diaz on 7/26/16.
+//  Copyright © 2016 Manuel Diaz. All rights reserved.
+//
+
+#include "DiffusionMPI.h"
+
+/*****************************************************************/
+/* Communication profile through the PMPI interface: the calls   */
+/* the solver makes are intercepted here and forwarded to their  */
+/* PMPI_ versions. With '-profile 1' every rank records, per     */
+/* phase and peer (ranks of MPI_COMM_WORLD), the bytes and       */
+/* messages it sends and the time it spends blocked on them,     */
+/* plus message size histograms; MPI_Finalize gathers them into  */
+/* PROFILE_FILE. Faces read over shared memory carry no MPI      */
+/* payload, Halo.c reports them with ProfileShared. Blocking     */
+/* collectives have no single peer, their time goes to the last  */
+/* column of the wait matrix                                     */
+/*****************************************************************/
+
+static const char *PhaseName[PROFILE_PHASES] = {"setup", "halo", "balance", "output", "other"};
+
+static struct {
+	int on, phase;
+	int rank, size;           // in MPI_COMM_WORLD
+	double *bytes, *messages; // [phase][peer] sent
+	double *wait;             // [phase][peer+1] blocked, last column not attributable to a peer
+	double *sizes;            // [phase][bin] messages of up to 2^(bin-1) bytes, bin 0 empty ones
+	struct { MPI_Request request; int peer; } pending[PROFILE_REQUESTS];
+	double dropped;           // requests beyond PROFILE_REQUESTS, their waits go unattributed
+	struct { MPI_Comm comm; MPI_Win win; int size; int *world; } maps[PROFILE_MAPS];
+} P;
+
+void ProfileEnable(void) { P.on = 1; }
+void ProfilePhase(int phase) { P.phase = phase; }
+
+/* World ranks of a communicator or window group, looked up once; callers hold critical(profile_maps) */
+static int *Map(MPI_Comm comm, MPI_Win win)
+{
+	int m, slot = -1;
+	for (m = 0; m < PROFILE_MAPS; m++)
+	{
+		if (P.maps[m].world == NULL) { if (slot < 0) slot = m; continue; }
+		if (win != MPI_WIN_NULL ? P.maps[m].win == win : P.maps[m].comm == comm) return P.maps[m].world;
+	}
+	if (slot < 0) return NULL;
+
+	MPI_Group group, world;
+	int size, r;
+	if (win != MPI_WIN_NULL) PMPI_Win_get_group(win, &group);
+	else PMPI_Comm_group(comm, &group);
+	PMPI_Comm_group(MPI_COMM_WORLD, &world);
+	PMPI_Group_size(group, &size);
+	int *ranks = (int*)malloc(sizeof(int)*size);
+	int *mapped = (int*)malloc(sizeof(int)*size);
+	for (r = 0; r < size; r++) ranks[r] = r;
+	PMPI_Group_translate_ranks(group, size, ranks, world, mapped);
+	PMPI_Group_free(&group);
+	PMPI_Group_free(&world);
+	free(ranks);
+
+	P.maps[slot].comm = comm; P.maps[slot].win = win;
+	P.maps[slot].size = size; P.maps[slot].world = mapped;
+	return mapped;
+}
+
+static void Unmap(MPI_Comm comm, MPI_Win win)
+{
+	#pragma omp critical(profile_maps)
+	for (int m = 0; m < PROFILE_MAPS; m++)
+	{
+		if (P.maps[m].world == NULL) continue;
+		if (win != MPI_WIN_NULL ? P.maps[m].win != win : P.maps[m].comm != comm) continue;
+		free(P.maps[m].world);
+		P.maps[m].world = NULL;
+	}
+}
+
+/* Face threads send at once, the table is shared */
+static int Peer(MPI_Comm comm, MPI_Win win, int rank)
+{
+	int peer = -1;
+	if (rank < 0) return -1; // MPI_PROC_NULL, MPI_ANY_SOURCE
+	#pragma omp critical(profile_maps)
+	{
+		const int *world = Map(comm, win);
+		if (world) peer = world[rank];
+	}
+	return peer;
+}
+
+static void Sent(int peer, double bytes)
+{
+	if (peer < 0) return;
+	int bin = 0;
+	while (bin < PROFILE_BINS-1 && bytes > (double)(1ULL << bin)/2) bin++;
+	#pragma omp critical(profile)
+	{
+		P.bytes[P.phase*P.size+peer] += bytes;
+		P.messages[P.phase*P.size+peer] += 1;
+		P.sizes[P.phase*PROFILE_BINS+bin] += 1;
+	}
+}
+
+static void Blocked(int peer, double seconds)
+{
+	#pragma omp critical(profile)
+	P.wait[P.phase*(P.size+1)+(peer < 0 ? P.size : peer)] += seconds;
+}
+
+static double Bytes(int count, MPI_Datatype type)
+{
+	int size;
+	PMPI_Type_size(type, &size);
+	return (double)count*size;
+}
+
+/* Requests in flight remember their peer for the wait, those beyond the table are counted */
+static void Track(MPI_Request request, int peer)
+{
+	#pragma omp critical(profile)
+	{
+		int i;
+		for (i = 0; i < PROFILE_REQUESTS; i++)
+		{
+			if (P.pending[i].request != MPI_REQUEST_NULL) continue;
+			P.pending[i].request = request; P.pending[i].peer = peer;
+			break;
+		}
+		if (i == PROFILE_REQUESTS) P.dropped += 1;
+	}
+}
+
+static int Untrack(MPI_Request request)
+{
+	int peer = -1;
+	if (request == MPI_REQUEST_NULL) return -1;
+	#pragma omp critical(profile)
+	for (int i = 0; i < PROFILE_REQUESTS; i++)
+	{
+		if (P.pending[i].request != request) continue;
+		P.pending[i].request = MPI_REQUEST_NULL;
+		peer = P.pending[i].peer;
+		break;
+	}
+	return peer;
+}
+
+/* Faces read in place from a same-node neighbor's buffer */
+void ProfileShared(int rank, double bytes)
+{
+	if (P.on) Sent(Peer(solverComm, MPI_WIN_NULL, rank), bytes);
+}
+
+/***************************/
+/* Intercepted MPI calls   */
+/***************************/
+
+int MPI_Init_thread(int *argc, char ***argv, int required, int *provided)
+{
+	int result = PMPI_Init_thread(argc, argv, required, provided);
+	if (!P.on) return result;
+
+	PMPI_Comm_rank(MPI_COMM_WORLD, &P.rank);
+	PMPI_Comm_size(MPI_COMM_WORLD, &P.size);
+	P.bytes = (double*)calloc(PROFILE_PHASES*P.size, sizeof(double));
+	P.messages = (double*)calloc(PROFILE_PHASES*P.size, sizeof(double));
+	P.wait = (double*)calloc(PROFILE_PHASES*(P.size+1), sizeof(double));
+	P.sizes = (double*)calloc(PROFILE_PHASES*PROFILE_BINS, sizeof(double));
+	for (int i = 0; i < PROFILE_REQUESTS; i++) P.pending[i].request = MPI_REQUEST_NULL;
+	return result;
+}
+
+int MPI_Isend(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm, MPI_Request *request)
+{
+	int result = PMPI_Isend(buf, count, datatype, dest, tag, comm, request);
+	if (!P.on) return result;
+	const int peer = Peer(comm, MPI_WIN_NULL, dest);
+	Sent(peer, Bytes(count, datatype));
+	Track(*request, peer);
+	return result;
+}
+
+int MPI_Send(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm)
+{
+	if (!P.on) return PMPI_Send(buf, count, datatype, dest, tag, comm);
+	const int peer = Peer(comm, MPI_WIN_NULL, dest);
+	const double t0 = PMPI_Wtime();
+	int result = PMPI_Send(buf, count, datatype, dest, tag, comm);
+	Blocked(peer, PMPI_Wtime()-t0);
+	Sent(peer, Bytes(count, datatype));
+	return result;
+}
+
+int MPI_Irecv(void *buf, int count, MPI_Datatype datatype, int source, int tag, MPI_Comm comm, MPI_Request *request)
+{
+	int result = PMPI_Irecv(buf, count, datatype, source, tag, comm, request);
+	if (P.on) Track(*request, Peer(comm, MPI_WIN_NULL, source));
+	return result;
+}
+
+int MPI_Recv(void *buf, int count, MPI_Datatype datatype, int source, int tag, MPI_Comm comm, MPI_Status *status)
+{
+	if (!P.on) return PMPI_Recv(buf, count, datatype, source, tag, comm, status);
+	MPI_Status own;
+	if (status == MPI_STATUS_IGNORE) status = &own;
+	const double t0 = PMPI_Wtime();
+	int result = PMPI_Recv(buf, count, datatype, source, tag, comm, status);
+	Blocked(Peer(comm, MPI_WIN_NULL, status->MPI_SOURCE), PMPI_Wtime()-t0);
+	return result;
+}
+
+int MPI_Wait(MPI_Request *request, MPI_Status *status)
+{
+	if (!P.on) return PMPI_Wait(request, status);
+	const int peer = Untrack(*request);
+	const double t0 = PMPI_Wtime();
+	int result = PMPI_Wait(request, status);
+	Blocked(peer, PMPI_Wtime()-t0);
+	return result;
+}
+
+/* One request after another, each wait charged to its peer */
+int MPI_Waitall(int count, MPI_Request array_of_requests[], MPI_Status *array_of_statuses)
+{
+	if (!P.on) return PMPI_Waitall(count, array_of_requests, array_of_statuses);
+	int result = MPI_SUCCESS;
+	for (int i = 0; i < count; i++)
+	{
+		int r = MPI_Wait(&array_of_requests[i], array_of_statuses == MPI_STATUSES_IGNORE ? MPI_STATUS_IGNORE : &array_of_statuses[i]);
+		if (r != MPI_SUCCESS) result = r;
+	}
+	return result;
+}
+
+int MPI_Put(const void *origin_addr, int origin_count, MPI_Datatype origin_datatype, int target_rank,
+	MPI_Aint target_disp, int target_count, MPI_Datatype target_datatype, MPI_Win win)
+{
+	if (P.on) Sent(Peer(MPI_COMM_NULL, win, target_rank), Bytes(origin_count, origin_datatype));
+	return PMPI_Put(origin_addr, origin_count, origin_datatype, target_rank, target_disp, target_count, target_datatype, win);
+}
+
+int MPI_Win_complete(MPI_Win win)
+{
+	if (!P.on) return PMPI_Win_complete(win);
+	const double t0 = PMPI_Wtime();
+	int result = PMPI_Win_complete(win);
+	Blocked(-1, PMPI_Wtime()-t0);
+	return result;
+}
+
+int MPI_Win_wait(MPI_Win win)
+{
+	if (!P.on) return PMPI_Win_wait(win);
+	const double t0 = PMPI_Wtime();
+	int result = PMPI_Win_wait(win);
+	Blocked(-1, PMPI_Wtime()-t0);
+	return result;
+}
+
+int MPI_Win_free(MPI_Win *win)
+{
+	if (P.on) Unmap(MPI_COMM_NULL, *win);
+	return PMPI_Win_free(win);
+}
+
+int MPI_Comm_free(MPI_Comm *comm)
+{
+	if (P.on) Unmap(*comm, MPI_WIN_NULL);
+	return PMPI_Comm_free(comm);
+}
+
+/* Each destination of the graph gets its own sendcounts[j] of sendtypes[j] */
+int MPI_Ineighbor_alltoallw(const void *sendbuf, const int sendcounts[], const MPI_Aint sdispls[], const MPI_Datatype sendtypes[],
+	void *recvbuf, const int recvcounts[], const MPI_Aint rdispls[], const MPI_Datatype recvtypes[], MPI_Comm comm, MPI_Request *request)
+{
+	if (P.on)
+	{
+		int in, out, weighted;
+		PMPI_Dist_graph_neighbors_count(comm, &in, &out, &weighted);
+		int *sources = (int*)malloc(sizeof(int)*(in+1)), *dests = (int*)malloc(sizeof(int)*(out+1));
+		PMPI_Dist_graph_neighbors(comm, in, sources, MPI_UNWEIGHTED, out, dests, MPI_UNWEIGHTED);
+		for (int j = 0; j < out; j++) Sent(Peer(comm, MPI_WIN_NULL, dests[j]), Bytes(sendcounts[j], sendtypes[j]));
+		free(sources); free(dests);
+	}
+	return PMPI_Ineighbor_alltoallw(sendbuf, sendcounts, sdispls, sendtypes, recvbuf, recvcounts, rdispls, recvtypes, comm, request);
+}
+
+/* Blocking collectives, timed as a whole */
+int MPI_Barrier(MPI_Comm comm)
+{
+	if (!P.on) return PMPI_Barrier(comm);
+	const double t0 = PMPI_Wtime();
+	int result = PMPI_Barrier(comm);
+	Blocked(-1, PMPI_Wtime()-t0);
+	return result;
+}
+
+int MPI_Bcast(void *buffer, int count, MPI_Datatype datatype, int root, MPI_Comm comm)
+{
+	if (!P.on) return PMPI_Bcast(buffer, count, datatype, root, comm);
+	const double t0 = PMPI_Wtime();
+	int result = PMPI_Bcast(buffer, count, datatype, root, comm);
+	Blocked(-1, PMPI_Wtime()-t0);
+	return result;
+}
+
+int MPI_Reduce(const void *sendbuf, void *recvbuf, int count, MPI_Datatype datatype, MPI_Op op, int root, MPI_Comm comm)
+{
+	if (!P.on) return PMPI_Reduce(sendbuf, recvbuf, count, datatype, op, root, comm);
+	const double t0 = PMPI_Wtime();
+	int result = PMPI_Reduce(sendbuf, recvbuf, count, datatype, op, root, comm);
+	Blocked(-1, PMPI_Wtime()-t0);
+	return result;
+}
+
+int MPI_Allreduce(const void *sendbuf, void *recvbuf, int count, MPI_Datatype datatype, MPI_Op op, MPI_Comm comm)
+{
+	if (!P.on) return PMPI_Allreduce(sendbuf, recvbuf, count, datatype, op, comm);
+	const double t0 = PMPI_Wtime();
+	int result = PMPI_Allreduce(sendbuf, recvbuf, count, datatype, op, comm);
+	Blocked(-1, PMPI_Wtime()-t0);
+	return result;
+}
+
+int MPI_Gather(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm)
+{
+	if (!P.on) return PMPI_Gather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, root, comm);
+	const double t0 = PMPI_Wtime();
+	int result = PMPI_Gather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, root, comm);
+	Blocked(-1, PMPI_Wtime()-t0);
+	return result;
+}
+
+int MPI_Allgather(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf, int recvcount, MPI_Datatype recvtype, MPI_Comm comm)
+{
+	if (!P.on) return PMPI_Allgather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm);
+	const double t0 = PMPI_Wtime();
+	int result = PMPI_Allgather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm);
+	Blocked(-1, PMPI_Wtime()-t0);
+	return result;
+}
+
+int MPI_Alltoallv(const void *sendbuf, const int sendcounts[], const int sdispls[], MPI_Datatype sendtype,
+	void *recvbuf, const int recvcounts[], const int rdispls[], MPI_Datatype recvtype, MPI_Comm comm)
+{
+	if (!P.on) return PMPI_Alltoallv(sendbuf, sendcounts, sdispls, sendtype, recvbuf, recvcounts, rdispls, recvtype, comm);
+	const double t0 = PMPI_Wtime();
+	int result = PMPI_Alltoallv(sendbuf, sendcounts, sdispls, sendtype, recvbuf, recvcounts, rdispls, recvtype, comm);
+	Blocked(-1, PMPI_Wtime()-t0);
+	return result;
+}
+
+/*****************************************************************/
+/* Rank 0 of MPI_COMM_WORLD writes the matrices of every phase:  */
+/* row r holds what rank r sent to, or waited on, each column    */
+/*****************************************************************/
+static void Matrix(FILE *f, const char *title, const double *m, int rows, int columns, int stride, int offset)
+{
+	fprintf(f, "%s\n", title);
+	for (int r = 0; r < rows; r++)
+	{
+		for (int c = 0; c < columns; c++) fprintf(f, c ? " %.6g" : "%.6g", m[(size_t)r*stride+offset+c]);
+		fprintf(f, "\n");
+	}
+}
+
+int MPI_Finalize(void)
+{
+	if (!P.on) return PMPI_Finalize();
+
+	const int N = P.size, W = N+1;
+	double *bytes = NULL, *messages = NULL, *wait = NULL, *sizes = NULL;
+	if (P.rank == 0)
+	{
+		bytes = (double*)malloc(sizeof(double)*PROFILE_PHASES*N*N);
+		messages = (double*)malloc(sizeof(double)*PROFILE_PHASES*N*N);
+		wait = (double*)malloc(sizeof(double)*PROFILE_PHASES*W*N);
+		sizes = (double*)malloc(sizeof(double)*PROFILE_PHASES*PROFILE_BINS*N);
+	}
+	PMPI_Gather(P.bytes, PROFILE_PHASES*N, MPI_DOUBLE, bytes, PROFILE_PHASES*N, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+	PMPI_Gather(P.messages, PROFILE_PHASES*N, MPI_DOUBLE, messages, PROFILE_PHASES*N, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+	PMPI_Gather(P.wait, PROFILE_PHASES*W, MPI_DOUBLE, wait, PROFILE_PHASES*W, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+	PMPI_Gather(P.sizes, PROFILE_PHASES*PROFILE_BINS, MPI_DOUBLE, sizes, PROFILE_PHASES*PROFILE_BINS, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+	double dropped = 0;
+	PMPI_Reduce(&P.dropped, &dropped, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+
+	FILE *f = P.rank == 0 ? fopen(PROFILE_FILE, "w") : NULL;
+	if (f)
+	{
+		double total = 0, count = 0, blocked = 0;
+		fprintf(f, "# communication profile of %d ranks (MPI_COMM_WORLD)\n", N);
+		fprintf(f, "# per phase: bytes and messages, row sender, column receiver;\n");
+		fprintf(f, "# wait seconds, row waiting rank, column peer, last column not attributable (RMA epochs, collectives);\n");
+		fprintf(f, "# message sizes, row rank, column b counts messages of up to 2^(b-1) bytes, column 0 empty ones\n");
+		fprintf(f, "# untracked requests %.0f, beyond %d in flight per rank: their waits are in the last column\n", dropped, PROFILE_REQUESTS);
+		for (int p = 0; p < PROFILE_PHASES; p++)
+		{
+			double phase = 0;
+			for (int i = 0; i < N*N; i++) phase += messages[(size_t)(i/N)*PROFILE_PHASES*N+p*N+i%N];
+			for (int r = 0; r < N; r++) for (int c = 0; c < W; c++) blocked += wait[(size_t)r*PROFILE_PHASES*W+p*W+c];
+			for (int r = 0; r < N; r++) for (int c = 0; c < N; c++) total += bytes[(size_t)r*PROFILE_PHASES*N+p*N+c];
+			count += phase;
+			fprintf(f, "\nphase %s\n", PhaseName[p]);
+			Matrix(f, "bytes", bytes, N, N, PROFILE_PHASES*N, p*N);
+			Matrix(f, "messages", messages, N, N, PROFILE_PHASES*N, p*N);
+			Matrix(f, "wait", wait, N, W, PROFILE_PHASES*W, p*W);
+			Matrix(f, "sizes", sizes, N, PROFILE_BINS, PROFILE_PHASES*PROFILE_BINS, p*PROFILE_BINS);
+		}
+		fclose(f);
+		printf("Communication profile                        :  %s, %.1f MB in %.0f messages, %.3f seconds blocked\n", PROFILE_FILE, total/1e6, count, blocked);
+	}
+	free(bytes); free(messages); free(wait); free(sizes);
+	free(P.bytes); free(P.messages); free(P.wait); free(P.sizes);
+	for (int m = 0; m < PROFILE_MAPS; m++) free(P.maps[m].world);
+	P.on = 0;
+	return PMPI_Finalize();
+}
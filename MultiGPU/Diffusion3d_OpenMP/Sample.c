@@ -0,0 +1,195 @@
+//
+//  Sample.c
+//  Diffusion3d-MPI-OpenMP
+//
+//  Created by Manuel Diaz on 7/26/16.
+//  Copyright © 2016 Manuel Diaz. All rights reserved.
+//
+
+#include "DiffusionMPI.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+/*****************************************************************/
+/* Samplers are listed one per line in a text file, indices are  */
+/* those of result.bin (k counts the fixed boundary planes):     */
+/*   plane x|y|z n     the plane normal to an axis at index n    */
+/*   line x|y|z a b    the line along an axis through the other  */
+/*                     two indices, in x,y,z order               */
+/*   probe i j k       a single point                            */
+/* Sampler n appends one record of floats per sample time to     */
+/* sample_<n>.bin, k slowest; the times go to sample_times.txt   */
+/*****************************************************************/
+
+static int Axis(const char *a)
+{
+	if (strcmp(a,"x") == 0) return 0;
+	if (strcmp(a,"y") == 0) return 1;
+	if (strcmp(a,"z") == 0) return 2;
+	return -1;
+}
+
+/* Points of the sampler in a z-plane: m of them from first, stride apart */
+static void InPlane(Sampler *s, size_t first, size_t stride, unsigned int m, int k)
+{
+	s->first = first; s->stride = stride; s->m = m; s->k = k;
+}
+
+static int ParseSampler(Sampler *s, const char *line, unsigned int nx, unsigned int ny, unsigned int NZ)
+{
+	char kind[16], axis[4];
+	int a, b, c;
+
+	if (sscanf(line, "%15s %3s %d %d", kind, axis, &a, &b) >= 3 && strcmp(kind,"plane") == 0)
+	{
+		switch (Axis(axis))
+		{
+			case 0: if (a < 0 || a >= (int)nx) return 0; InPlane(s, a, nx, ny, -1); break;
+			case 1: if (a < 0 || a >= (int)ny) return 0; InPlane(s, (size_t)nx*a, 1, nx, -1); break;
+			case 2: if (a < 0 || a >= (int)NZ) return 0; InPlane(s, 0, 1, nx*ny, a); break;
+			default: return 0;
+		}
+	}
+	else if (sscanf(line, "%15s %3s %d %d", kind, axis, &a, &b) == 4 && strcmp(kind,"line") == 0)
+	{
+		switch (Axis(axis))
+		{
+			case 0: if (a < 0 || a >= (int)ny || b < 0 || b >= (int)NZ) return 0; InPlane(s, (size_t)nx*a, 1, nx, b); break;
+			case 1: if (a < 0 || a >= (int)nx || b < 0 || b >= (int)NZ) return 0; InPlane(s, a, nx, ny, b); break;
+			case 2: if (a < 0 || a >= (int)nx || b < 0 || b >= (int)ny) return 0; InPlane(s, (size_t)nx*b+a, 1, 1, -1); break;
+			default: return 0;
+		}
+	}
+	else if (sscanf(line, "%15s %d %d %d", kind, &a, &b, &c) == 4 && strcmp(kind,"probe") == 0)
+	{
+		if (a < 0 || a >= (int)nx || b < 0 || b >= (int)ny || c < 0 || c >= (int)NZ) return 0;
+		InPlane(s, (size_t)nx*b+a, 1, 1, c);
+	}
+	else return 0;
+
+	s->points = s->k < 0 ? (size_t)s->m*NZ : s->m;
+	strncpy(s->spec, line, sizeof(s->spec)-1);
+	s->spec[sizeof(s->spec)-1] = '\0';
+	s->spec[strcspn(s->spec, "\r\n")] = '\0';
+	return 1;
+}
+
+/*****************************************************************/
+/* Reads the samplers and opens their files, every rank writes   */
+/* its share of each record in place                             */
+/*****************************************************************/
+int InitializeSamples(Samples *S, const char *spec, int rank, unsigned int nx, unsigned int ny, unsigned int Nz)
+{
+	const unsigned int NZ = Nz+2*RADIUS;
+	char line[128], name[64];
+	int n = 0;
+
+	S->count = 0; S->s = NULL;
+	S->nx = nx; S->ny = ny; S->Nz = Nz;
+	S->records = 0; S->bytes = 0.;
+	S->buffer = NULL; S->size = 0;
+	S->times = NULL;
+	if (spec == NULL) return 1;
+
+	FILE *pFile = fopen(spec, "r");
+	if (pFile == NULL)
+	{
+		printf("Unable to read samplers from %s\n", spec);
+		fflush(stdout);
+		return 0;
+	}
+	while (fgets(line, sizeof(line), pFile))
+	{
+		n++;
+		if (line[strspn(line," \t")] == '#' || line[strspn(line," \t\r\n")] == '\0') continue;
+
+		S->s = (Sampler*)realloc(S->s, sizeof(Sampler)*(S->count+1));
+		if (!ParseSampler(&S->s[S->count], line, nx, ny, NZ))
+		{
+			printf("%s:%d: not a sampler in a %u x %u x %u grid: %s", spec, n, nx, ny, NZ, line);
+			fflush(stdout);
+			fclose(pFile);
+			return 0;
+		}
+		S->count++;
+	}
+	fclose(pFile);
+
+	// Rank 0 empties the files before anyone writes into them
+	if (rank != 0) MPI_CHECK(MPI_Barrier(solverComm));
+	for (int s = 0; s < S->count; s++)
+	{
+		sprintf(name, "sample_%02d.bin", s);
+		S->s[s].fd = open(name, O_WRONLY|O_CREAT|(rank == 0 ? O_TRUNC : 0), 0644);
+		if (S->s[s].fd < 0) printf("Rank %d: unable to open %s\n", rank, name);
+	}
+	if (rank == 0) MPI_CHECK(MPI_Barrier(solverComm));
+
+	if (rank == 0)
+	{
+		S->times = fopen("sample_times.txt", "w");
+		fprintf(S->times, "# record iteration time\n");
+		pFile = fopen("sample_index.txt", "w");
+		for (int s = 0; s < S->count; s++)
+		{
+			fprintf(pFile, "sample_%02d.bin  %-24s  %zu floats per record\n", s, S->s[s].spec, S->s[s].points);
+		}
+		fclose(pFile);
+	}
+	return 1;
+}
+
+/*****************************************************************/
+/* Extracts the samples inside the planes a piece owns and       */
+/* writes them at their place in the current record              */
+/*****************************************************************/
+void SamplePiece(Samples *S, const REAL *q, unsigned int z0, unsigned int nz)
+{
+	const size_t XY = (size_t)S->nx*S->ny;
+	const unsigned int lo = z0 == 0 ? 0 : z0+RADIUS;
+	const unsigned int hi = z0+nz == S->Nz ? S->Nz+2*RADIUS : z0+RADIUS+nz;
+
+	for (int s = 0; s < S->count; s++)
+	{
+		const Sampler *p = &S->s[s];
+		const unsigned int k0 = p->k < 0 ? lo : MAX((unsigned int)p->k, lo);
+		const unsigned int k1 = p->k < 0 ? hi : MIN((unsigned int)p->k+1, hi);
+		if (k0 >= k1) continue;
+
+		const size_t n = (size_t)p->m*(k1-k0);
+		if (S->size < n)
+		{
+			free(S->buffer);
+			S->buffer = (float*)malloc(sizeof(float)*n);
+			S->size = n;
+		}
+		for (unsigned int k = k0; k < k1; k++)
+		{
+			const REAL *plane = q + XY*(k-z0) + p->first;
+			float *dst = S->buffer + (size_t)p->m*(k-k0);
+			for (unsigned int o = 0; o < p->m; o++) dst[o] = (float)plane[p->stride*o];
+		}
+
+		const off_t offset = sizeof(float)*(p->points*S->records + (p->k < 0 ? (size_t)p->m*k0 : 0));
+		if (pwrite(p->fd, S->buffer, sizeof(float)*n, offset) != (ssize_t)(sizeof(float)*n))
+		{
+			printf("Unable to write sample_%02d.bin\n", s);
+		}
+		S->bytes += sizeof(float)*n;
+	}
+}
+
+/* Closes the record of this sample time, once every piece is in */
+void SampleRecord(Samples *S, int it, REAL t)
+{
+	if (S->times) fprintf(S->times, "%d %d %.9g\n", S->records, it, t);
+	S->records++;
+}
+
+void FinalizeSamples(Samples *S)
+{
+	for (int s = 0; s < S->count; s++) if (S->s[s].fd >= 0) close(S->s[s].fd);
+	if (S->times) fclose(S->times);
+	free(S->s);
+	free(S->buffer);
+}
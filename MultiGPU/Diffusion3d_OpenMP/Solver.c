@@ -0,0 +1,160 @@
+//
+//  Solver.c
+//  Diffusion3d-MPI-OpenMP
+//
+//  Created by Manuel Diaz on 7/26/16.
+//  Copyright © 2016 Manuel Diaz. All rights reserved.
+//
+
+#include "DiffusionMPI.h"
+
+/*****************************************************************/
+/* The solver of a single-rank run as a library: the driver's    */
+/* slab step (Step.c) on one lone slab, so results match its     */
+/* result.bin bit for bit. libdiffusion3d.so exports these for   */
+/* diffusion3d.py, which wraps the fields as NumPy arrays        */
+/*****************************************************************/
+
+Solver *SolverCreate(double K, double L, double W, double H, unsigned int nx, unsigned int ny, unsigned int nz,
+	const char *integrator, double dt, const char *icFile)
+{
+	if (nx < 2*RADIUS+1 || ny < 2*RADIUS+1 || nz < 2)
+	{
+		printf("A %u x %u x %u grid is too small for the stencil\n", nx, ny, nz);
+		return NULL;
+	}
+
+	// A grid too large for memory is refused, not touched
+	Solver *s = (Solver*)malloc(sizeof(Solver));
+	if (s == NULL) return NULL;
+	s->nx = nx; s->ny = ny; s->nz = nz;
+	InitializeDecomposition(&s->d, 1, nz);
+	if (!InitializeSlab(&s->slab, nx, ny, nz))
+	{
+		printf("A %u x %u x %u grid does not fit in memory\n", nx, ny, nz);
+		SolverDestroy(s);
+		return NULL;
+	}
+
+	if (!SolverReset(s, K, L, W, H, integrator, dt, icFile))
+	{
+		SolverDestroy(s);
+		return NULL;
+	}
+	return s;
+}
+
+/*****************************************************************/
+/* Starts a new run on the arrays of a solver of the same grid,  */
+/* they are already allocated and paged in. integrator NULL and  */
+/* dt 0 take the driver's defaults. An IC starts at t = 0 as the */
+/* driver's -ic does: its clock belongs to the run that saved it */
+/*****************************************************************/
+int SolverReset(Solver *s, double K, double L, double W, double H, const char *integrator, double dt, const char *icFile)
+{
+	const unsigned int nx = s->nx, ny = s->ny, NZ = s->nz+2*RADIUS;
+	const int scheme = Integrator(integrator ? integrator : INTEGRATOR);
+	if (scheme < 0) return 0;
+
+	s->K = K; s->L = L; s->W = W; s->H = H;
+	s->dx = L/(nx-1);
+	s->dy = W/(ny-1);
+	s->dz = H/(s->nz-1);
+	const REAL dtExplicit = ExplicitStep(K, s->dx, s->dy, s->dz);
+	const REAL step = dt > 0 ? (REAL)dt : dtExplicit;
+	if (scheme == INTEGRATOR_SSPRK3 && step > dtExplicit)
+	{
+		printf("dt = %g exceeds the SSP-RK3 limit %g, use rkl2 or adi for larger steps\n", (double)step, (double)dtExplicit);
+		return 0;
+	}
+	s->t = 0;
+	s->it = 0;
+
+	// First touch by the threads that update them
+	#pragma omp parallel for schedule(static)
+	for (unsigned int k = 0; k < NZ; k++)
+	{
+		memset(s->slab.uo+(size_t)nx*ny*k, 0, sizeof(REAL)*nx*ny);
+		memset(s->slab.Lu+(size_t)nx*ny*k, 0, sizeof(REAL)*nx*ny);
+	}
+
+	if (icFile)
+	{
+		Field ic;
+		if (!OpenField(&ic,icFile,0) || !FieldMatches(&ic,icFile,nx,ny,NZ)) return 0;
+		ReadFieldPlanes(&ic, s->slab.u, 0, NZ);
+		CloseField(&ic);
+	}
+	else
+	{
+		Init_domain(1,s->slab.u,s->dx,s->dy,s->dz,nx,ny,NZ);
+	}
+	if (!SlabIntegrator(&s->slab, scheme, &s->d, 0, K, s->dx, s->dy, s->dz, step))
+	{
+		printf("The arrays of this integrator do not fit in memory\n");
+		return 0;
+	}
+	return 1;
+}
+
+void SolverDestroy(Solver *s)
+{
+	if (s == NULL) return;
+	FinalizeSlab(&s->slab);
+	FinalizeDecomposition(&s->d);
+	free(s);
+}
+
+/* n steps of dt */
+void SolverStep(Solver *s, int n)
+{
+	while (n-- > 0)
+	{
+		s->t += s->slab.dt; s->it += 1;
+		SlabStep(&s->slab, NULL, NULL);
+	}
+}
+
+/* Steps while t < tEnd, as the driver does; returns the steps taken */
+int SolverAdvanceTo(Solver *s, double tEnd)
+{
+	const long it0 = s->it;
+	while (s->t < (REAL)tEnd) SolverStep(s, 1);
+	return (int)(s->it-it0);
+}
+
+double SolverTime(const Solver *s) { return s->t; }
+long SolverSteps(const Solver *s) { return s->it; }
+double SolverDt(const Solver *s) { return s->slab.dt; }
+int SolverHalo(void) { return RADIUS; }
+int SolverRealBytes(void) { return sizeof(REAL); }
+
+/*****************************************************************/
+/* Address of field 0 (u), 1 (uo) or 2 (Lu) with its shape and   */
+/* byte strides, z slowest; planes [0,RADIUS) and the last       */
+/* RADIUS of them are the fixed boundary planes                  */
+/*****************************************************************/
+REAL *SolverField(Solver *s, int which, size_t shape[3], size_t strides[3])
+{
+	shape[0] = s->nz+2*RADIUS; shape[1] = s->ny; shape[2] = s->nx;
+	strides[2] = sizeof(REAL);
+	strides[1] = strides[2]*s->nx;
+	strides[0] = strides[1]*s->ny;
+	switch (which)
+	{
+		case 0: return s->slab.u;
+		case 1: return s->slab.uo;
+		case 2: return s->slab.Lu;
+		default: return NULL;
+	}
+}
+
+/* The state as a field file, to continue it later or elsewhere */
+void SolverSave(const Solver *s, const char *name)
+{
+	unsigned int planes = s->nz;
+	FieldHeader run;
+	DescribeRun(&run, s->slab.integrator, s->K, s->L, s->W, s->H, s->slab.dt);
+	run.time = s->t; run.step = s->it;
+	WriteField(name, s->slab.u, s->nx, s->ny, s->nz+2*RADIUS, 1, &planes, &run);
+}
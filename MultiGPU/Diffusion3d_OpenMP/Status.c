@@ -0,0 +1,165 @@
+//
+//  Status.c
+//  Diffusion3d-MPI-OpenMP
+//
+//  Created by Manuel Diaz on 7/26/16.
+//  Copyright © 2016 Manuel Diaz. All rights reserved.
+//
+
+#include "DiffusionMPI.h"
+#include <unistd.h>
+
+/*****************************************************************/
+/* Telemetry of a running solver: every few iterations the ranks */
+/* post their timers and memory use in a nonblocking reduction,  */
+/* polled once per step; when it lands rank 0 rewrites           */
+/* STATUS_FILE in the Prometheus text format, renamed into place */
+/* so readers (cat, watch, a node_exporter textfile collector)   */
+/* always see a whole file                                       */
+/*****************************************************************/
+
+/* Per-rank values, reduced to their max and min */
+enum { V_ELAPSED, V_COMPUTE, V_HALO, V_OUTPUT, V_SAMPLES, V_PREVIEWS, V_RESIDENT, V_PHASES, V_COUNT = V_PHASES+COUNTER_PHASES };
+static_assert(V_COUNT == STATUS_VALUES, "STATUS_VALUES counts the values of a rank");
+
+static const char *PhaseName[COUNTER_PHASES] = {"rk_copy", "laplacian", "pack", "exchange", "unpack", "rk_update", "step_tasks"};
+
+/* Resident set of this process */
+static double Resident(void)
+{
+	long pages = 0, resident = 0;
+	FILE *pFile = fopen("/proc/self/statm", "r");
+	if (pFile == NULL) return 0;
+	if (fscanf(pFile, "%ld %ld", &pages, &resident) != 2) resident = 0;
+	fclose(pFile);
+	return (double)resident*sysconf(_SC_PAGESIZE);
+}
+
+void InitializeStatus(Status *S, int every, int rank, int size, int it0)
+{
+	memset(S, 0, sizeof(Status));
+	S->every = every;
+	S->rank = rank;
+	S->size = size;
+	S->it0 = it0;
+	S->last_it = it0;
+	S->request[0] = S->request[1] = MPI_REQUEST_NULL;
+	S->start = MPI_Wtime();
+}
+
+/* Values of this rank, the max and min come from one MAX over v and -v */
+static void Collect(Status *S, const Timers *T, const Counters *C)
+{
+	double *v = S->local;
+	v[V_ELAPSED] = MPI_Wtime()-S->start;
+	v[V_HALO] = T->halo;
+	v[V_OUTPUT] = T->output;
+	v[V_SAMPLES] = T->samples;
+	v[V_PREVIEWS] = T->previews;
+	v[V_COMPUTE] = v[V_ELAPSED]-v[V_HALO]-v[V_OUTPUT]-v[V_SAMPLES]-v[V_PREVIEWS];
+	v[V_RESIDENT] = Resident();
+	for (int p = 0; p < COUNTER_PHASES; p++) v[V_PHASES+p] = C->on ? C->time[p] : 0;
+	for (int i = 0; i < V_COUNT; i++) v[V_COUNT+i] = -v[i];
+	S->resident = v[V_RESIDENT];
+}
+
+static void Write(const Status *S, int running)
+{
+	const double *max = S->global, *min = S->global+V_COUNT;
+	const double elapsed = max[V_ELAPSED], steps = S->it-S->it0;
+	const double rate = elapsed > 0 ? steps/elapsed : 0;
+	const double recent = S->it > S->last_it && S->wall > S->last_wall ? (S->it-S->last_it)/(S->wall-S->last_wall) : rate;
+	const double remaining = S->dt > 0 && S->tEnd > S->t ? (S->tEnd-S->t)/S->dt : 0;
+	char name[sizeof(STATUS_FILE)+16];
+	int p;
+
+	sprintf(name, "%s.%d", STATUS_FILE, (int)getpid());
+	FILE *f = fopen(name, "w");
+	if (f == NULL) return;
+	fprintf(f, "# HELP diffusion3d_running 1 while the time loop runs\n# TYPE diffusion3d_running gauge\ndiffusion3d_running %d\n", running);
+	fprintf(f, "# HELP diffusion3d_ranks Solver ranks\n# TYPE diffusion3d_ranks gauge\ndiffusion3d_ranks %d\n", S->size);
+	fprintf(f, "# HELP diffusion3d_step Iterations completed\n# TYPE diffusion3d_step counter\ndiffusion3d_step %d\n", S->it);
+	fprintf(f, "# HELP diffusion3d_time Simulated time reached and targeted\n# TYPE diffusion3d_time gauge\n");
+	fprintf(f, "diffusion3d_time{kind=\"current\"} %.9g\ndiffusion3d_time{kind=\"end\"} %.9g\n", (double)S->t, (double)S->tEnd);
+	fprintf(f, "# HELP diffusion3d_step_rate Iterations per second, since the start and since the last update\n# TYPE diffusion3d_step_rate gauge\n");
+	fprintf(f, "diffusion3d_step_rate{window=\"run\"} %.6g\ndiffusion3d_step_rate{window=\"last\"} %.6g\n", rate, recent);
+	fprintf(f, "# HELP diffusion3d_eta_seconds Time to tEnd at the recent step rate\n# TYPE diffusion3d_eta_seconds gauge\n");
+	fprintf(f, "diffusion3d_eta_seconds %.6g\n", recent > 0 ? remaining/recent : 0);
+	fprintf(f, "# HELP diffusion3d_elapsed_seconds Wall time in the time loop\n# TYPE diffusion3d_elapsed_seconds gauge\ndiffusion3d_elapsed_seconds %.6g\n", elapsed);
+
+	fprintf(f, "# HELP diffusion3d_phase_seconds Time per phase since the start, over ranks\n# TYPE diffusion3d_phase_seconds gauge\n");
+	const char *phase[] = {"compute", "halo_wait", "output", "samples", "previews"};
+	const int index[] = {V_COMPUTE, V_HALO, V_OUTPUT, V_SAMPLES, V_PREVIEWS};
+	for (p = 0; p < 5; p++)
+	{
+		fprintf(f, "diffusion3d_phase_seconds{phase=\"%s\",stat=\"max\"} %.6g\n", phase[p], max[index[p]]);
+		fprintf(f, "diffusion3d_phase_seconds{phase=\"%s\",stat=\"min\"} %.6g\n", phase[p], -min[index[p]]);
+	}
+	for (p = 0; p < COUNTER_PHASES; p++)
+	{
+		if (max[V_PHASES+p] <= 0) continue;
+		fprintf(f, "diffusion3d_phase_seconds{phase=\"%s\",stat=\"max\"} %.6g\n", PhaseName[p], max[V_PHASES+p]);
+		fprintf(f, "diffusion3d_phase_seconds{phase=\"%s\",stat=\"min\"} %.6g\n", PhaseName[p], -min[V_PHASES+p]);
+	}
+	fprintf(f, "# HELP diffusion3d_halo_wait_fraction Share of the loop spent waiting on neighbors\n# TYPE diffusion3d_halo_wait_fraction gauge\n");
+	fprintf(f, "diffusion3d_halo_wait_fraction{stat=\"max\"} %.6g\n", elapsed > 0 ? max[V_HALO]/elapsed : 0);
+	fprintf(f, "diffusion3d_halo_wait_fraction{stat=\"min\"} %.6g\n", elapsed > 0 ? -min[V_HALO]/elapsed : 0);
+	fprintf(f, "# HELP diffusion3d_resident_bytes Resident memory per rank and in total\n# TYPE diffusion3d_resident_bytes gauge\n");
+	fprintf(f, "diffusion3d_resident_bytes{stat=\"max\"} %.0f\n", max[V_RESIDENT]);
+	fprintf(f, "diffusion3d_resident_bytes{stat=\"min\"} %.0f\n", -min[V_RESIDENT]);
+	fprintf(f, "diffusion3d_resident_bytes{stat=\"sum\"} %.0f\n", S->total);
+	fclose(f);
+	rename(name, STATUS_FILE);
+}
+
+/* The reduction landed: rank 0 publishes it */
+static void Publish(Status *S, int running)
+{
+	S->pending = 0;
+	if (S->rank != 0) return;
+	Write(S, running);
+	S->last_it = S->it; S->last_wall = S->wall;
+}
+
+/*****************************************************************/
+/* Once per step: polls the reduction in flight and posts a new  */
+/* one every S->every iterations                                 */
+/*****************************************************************/
+void StatusStep(Status *S, int it, REAL t, REAL tEnd, REAL dt, const Timers *T, const Counters *C)
+{
+	if (S->every <= 0) return;
+	if (S->pending && it%S->every != 0)
+	{
+		int done = 0;
+		MPI_CHECK(MPI_Testall(2, S->request, &done, MPI_STATUSES_IGNORE));
+		if (done) Publish(S, 1);
+	}
+	if (it%S->every != 0) return;
+
+	// Collectives are posted at the same steps on every rank, a late one is waited for
+	if (S->pending)
+	{
+		MPI_CHECK(MPI_Waitall(2, S->request, MPI_STATUSES_IGNORE));
+		Publish(S, 1);
+	}
+
+	Collect(S, T, C);
+	S->it = it; S->t = t; S->tEnd = tEnd; S->dt = dt;
+	S->wall = MPI_Wtime()-S->start;
+	MPI_CHECK(MPI_Ireduce(S->local, S->global, 2*V_COUNT, MPI_DOUBLE, MPI_MAX, 0, solverComm, &S->request[0]));
+	MPI_CHECK(MPI_Ireduce(&S->resident, &S->total, 1, MPI_DOUBLE, MPI_SUM, 0, solverComm, &S->request[1]));
+	S->pending = 1;
+}
+
+/* Final state, the file then reads diffusion3d_running 0 */
+void FinalizeStatus(Status *S, int it, REAL t, REAL tEnd, REAL dt, const Timers *T, const Counters *C)
+{
+	if (S->every <= 0) return;
+	if (S->pending) MPI_CHECK(MPI_Waitall(2, S->request, MPI_STATUSES_IGNORE));
+	Collect(S, T, C);
+	S->it = it; S->t = t; S->tEnd = tEnd; S->dt = dt;
+	S->wall = MPI_Wtime()-S->start;
+	MPI_CHECK(MPI_Reduce(S->local, S->global, 2*V_COUNT, MPI_DOUBLE, MPI_MAX, 0, solverComm));
+	MPI_CHECK(MPI_Reduce(&S->resident, &S->total, 1, MPI_DOUBLE, MPI_SUM, 0, solverComm));
+	Publish(S, 0);
+}
@@ -0,0 +1,80 @@
+//
+//  Steady.c
+//  Diffusion3d-MPI-OpenMP
+//
+//  Created by Manuel Diaz on 7/26/16.
+//  Copyright © 2016 Manuel Diaz. All rights reserved.
+//
+
+#include "DiffusionMPI.h"
+
+/*****************************************************************/
+/* Steady-state monitor: the residual of step n is              */
+/* max|u^(n+1)-u^n|/dt over the domain, found by the last RK     */
+/* update as it writes u. Its reduction across ranks is left in  */
+/* flight for a step and completed after the next one, so the    */
+/* run stops one step after the tolerance is met. The max does   */
+/* not depend on the order of the reduction, every partition     */
+/* stops at the same step. Rank 0 logs the history to            */
+/* residual.txt                                                  */
+/*****************************************************************/
+
+void InitializeMonitor(Monitor *M, double tol, int rank)
+{
+	M->tol = tol;
+	M->request = MPI_REQUEST_NULL;
+	M->pending = 0;
+	M->first = M->last = 0.;
+	M->first_it = M->last_it = 0;
+	M->reached = 0;
+	M->history = NULL;
+	if (tol > 0 && rank == 0)
+	{
+		M->history = fopen("residual.txt", "w");
+		if (M->history) fprintf(M->history, "# iteration time residual, max|u^(n+1)-u^n|/dt\n");
+	}
+}
+
+/* Completes the reduction in flight, 1 once the tolerance was met */
+static int Complete(Monitor *M)
+{
+	if (!M->pending) return M->reached > 0;
+	MPI_CHECK(MPI_Wait(&M->request, MPI_STATUS_IGNORE));
+	M->pending = 0;
+
+	if (M->first_it == 0) { M->first = M->global; M->first_it = M->it; }
+	M->last = M->global; M->last_it = M->it;
+	if (M->history) fprintf(M->history, "%d %.9g %.9g\n", M->it, M->t, M->global);
+	if (M->reached == 0 && M->global <= M->tol) M->reached = M->it;
+	return M->reached > 0;
+}
+
+/*****************************************************************/
+/* Posts the residual of step it, change = max|u^(n+1)-u^n| of   */
+/* this rank; returns 1 when the run is steady                   */
+/*****************************************************************/
+int MonitorStep(Monitor *M, REAL change, int it, REAL t, REAL dt)
+{
+	const int steady = Complete(M);
+
+	M->local = change/dt;
+	M->it = it; M->t = t;
+	MPI_CHECK(MPI_Iallreduce(&M->local, &M->global, 1, MPI_DOUBLE, MPI_MAX, solverComm, &M->request));
+	M->pending = 1;
+	return steady;
+}
+
+/* Completes the last reduction, the history then ends at the final step */
+void FinalizeMonitor(Monitor *M)
+{
+	Complete(M);
+	if (M->history) fclose(M->history);
+	M->history = NULL;
+}
+
+/* Residual reduction per step over the history, 1 if undefined */
+double MonitorRate(const Monitor *M)
+{
+	if (M->last_it <= M->first_it || M->first <= 0 || M->last <= 0) return 1.;
+	return pow(M->last/M->first, 1./(M->last_it-M->first_it));
+}
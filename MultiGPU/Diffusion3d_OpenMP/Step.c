@@ -0,0 +1,241 @@
+//
+//  Step.c
+//  Diffusion3d-MPI-OpenMP
+//
+//  Created by Manuel Diaz on 7/26/16.
+//  Copyright © 2016 Manuel Diaz. All rights reserved.
+//
+
+#include "DiffusionMPI.h"
+
+/*****************************************************************/
+/* The time step of a rank's slab, for every integrator: the     */
+/* driver passes its halo and counters, the solver library a     */
+/* lone slab with neither, whose ghost planes are the fixed      */
+/* boundary. Stages compute and send the faces first, then the   */
+/* inner planes while the faces travel                           */
+/*****************************************************************/
+
+/* Phases are counted in the bulk synchronous step only */
+static void Begin(Counters *C, int phase) { if (C) CountersBegin(C, phase); }
+static void End(Counters *C, double flops, double bytes) { if (C) CountersEnd(C, flops, bytes); }
+
+/* Arrays zeroed by the threads that update them, NULL if out of memory */
+static REAL *Allocate(size_t XY, unsigned int _nz)
+{
+	REAL *q = (REAL*)malloc(sizeof(REAL)*XY*_nz);
+	if (q == NULL) return NULL;
+	#pragma omp parallel for schedule(static)
+	for (unsigned int k = 0; k < _nz; k++)
+	{
+		memset(q+XY*k, 0, sizeof(REAL)*XY);
+	}
+	return q;
+}
+
+/* 0 if the arrays do not fit in memory */
+int InitializeSlab(Slab *S, unsigned int nx, unsigned int ny, unsigned int nz)
+{
+	const size_t XY = (size_t)nx*ny;
+
+	memset(S, 0, sizeof(Slab));
+	S->integrator = -1;
+	S->nx = nx; S->ny = ny; S->nz = nz;
+	S->u  = Allocate(XY, nz+2*RADIUS);
+	S->uo = Allocate(XY, nz+2*RADIUS);
+	S->Lu = Allocate(XY, nz+2*RADIUS);
+	return S->u && S->uo && S->Lu;
+}
+
+/* RKL2 arrays, zero where the Laplacian never writes; um takes u's boundary at the first step */
+static int AllocateSuperStep(Slab *S)
+{
+	const size_t XY = (size_t)S->nx*S->ny;
+
+	free(S->um); free(S->L0);
+	S->um = Allocate(XY, S->nz+2*RADIUS);
+	S->L0 = Allocate(XY, S->nz+2*RADIUS);
+	S->primed = 0;
+	return S->um && S->L0;
+}
+
+/* Sets or changes the integrator, its step and the arrays it needs; 0 if they do not fit, no integrator then */
+int SlabIntegrator(Slab *S, int integrator, const Decomposition *d, int rank, REAL K, REAL dx, REAL dy, REAL dz, REAL dt)
+{
+	free(S->um); free(S->L0);
+	S->um = S->L0 = NULL;
+	if (S->integrator == INTEGRATOR_ADI) FinalizeAdi(&S->adi);
+
+	S->integrator = integrator;
+	S->stages = IntegratorStages(integrator, K, dx, dy, dz, dt);
+	S->dt = dt;
+	S->kx = K/(12*dx*dx);
+	S->ky = K/(12*dy*dy);
+	S->kz = K/(12*dz*dz);
+	if (integrator == INTEGRATOR_RKL2 && !AllocateSuperStep(S))
+	{
+		free(S->um); free(S->L0);
+		S->um = S->L0 = NULL;
+		S->integrator = -1;
+		return 0;
+	}
+	if (integrator == INTEGRATOR_ADI) InitializeAdi(&S->adi, d, rank, S->nx, S->ny, K, dx, dy, dz, dt);
+	return 1;
+}
+
+/* After Rebalance has moved u, uo and Lu */
+void ResizeSlab(Slab *S, const Decomposition *d, int rank)
+{
+	S->nz = d->nz[rank];
+	if (S->integrator == INTEGRATOR_RKL2) AllocateSuperStep(S);
+	if (S->integrator == INTEGRATOR_ADI) AdiPartition(&S->adi, d);
+}
+
+/*****************************************************************/
+/* One step of dt, h NULL for a lone slab and C NULL uncounted:  */
+/* returns max|u^(n+1)-u^n| of the slab. u, uo and Lu keep their */
+/* arrays from step to step                                      */
+/*****************************************************************/
+REAL SlabStep(Slab *S, Halo *h, Counters *C)
+{
+	const unsigned int Nx = S->nx, Ny = S->ny, _Nz = S->nz, _NZ = _Nz+2*RADIUS;
+	const size_t XY = (size_t)Nx*Ny;
+	const REAL kx = S->kx, ky = S->ky, kz = S->kz, dt = S->dt;
+	const int rkl2 = S->integrator == INTEGRATOR_RKL2, stages = S->stages;
+	const int faceThreads = h && S->faceThreads;
+	const int nbr[2] = {h ? h->nbr[LEFT] : MPI_PROC_NULL, h ? h->nbr[RIGHT] : MPI_PROC_NULL};
+	REAL change = 0;
+
+	// Line solves along x, y and z, then the ghost planes of u
+	if (S->integrator == INTEGRATOR_ADI) return AdiStep(&S->adi, h, S->u, S->Lu, kx, ky, kz, _NZ);
+
+	// Boundary planes facing a neighbor are computed apart from the inner ones
+	const unsigned int kin0 = nbr[LEFT ] != MPI_PROC_NULL ? 2*RADIUS : RADIUS;
+	const unsigned int kin1 = nbr[RIGHT] != MPI_PROC_NULL ? _Nz : _Nz+RADIUS;
+	const unsigned int kface0[2] = {RADIUS, _Nz};
+	const unsigned int kface1[2] = {2*RADIUS, _Nz+RADIUS};
+	if (faceThreads) C = NULL;
+
+	// Runge Kutta Step 0, RKL2 stages keep the fixed boundary in both of their arrays
+	Begin(C, PHASE_COPY);
+	#pragma omp parallel for schedule(static)
+	for (unsigned int k = 0; k < _NZ; k++)
+	{
+		memcpy(S->uo+XY*k, S->u+XY*k, sizeof(REAL)*XY);
+		if (rkl2 && !S->primed) memcpy(S->um+XY*k, S->u+XY*k, sizeof(REAL)*XY);
+	}
+	S->primed = 1;
+	End(C, 0, 2.*sizeof(REAL)*XY*_NZ);
+
+	// Runge Kutta Steps 1-3, or the stages of a super-time-step
+	for (unsigned int step = 1; step <= (unsigned int)stages; step++)
+	{
+		// The first RKL2 stage computes L(Y_0), kept for every stage
+		REAL *Lq = rkl2 && step == 1 ? S->L0 : S->Lu;
+		const REAL *q = S->u;
+
+		// Post receives of this stage
+		Begin(C, PHASE_EXCHANGE);
+		if (h) HaloBegin(h);
+		End(C, 0, 0);
+
+		if (faceThreads)
+		{
+			// A thread per face computes, packs, sends, receives and unpacks it
+			// while the remaining threads share the inner planes
+			#pragma omp parallel
+			#pragma omp single
+			{
+				for (int s = 0; s < 2; s++)
+				{
+					if (nbr[s] == MPI_PROC_NULL) continue;
+
+					#pragma omp task firstprivate(s)
+					{
+						Compute_Laplace3d(q, Lq, kx, ky, kz, Nx, Ny, _NZ, kface0[s], kface1[s]);
+						CopyBoundaryRegionToGhostCell(Lq, HaloSendBuffer(h,s), Nx, Ny, _NZ, s);
+						HaloSend(h,s);
+						CopyGhostCellToBoundaryRegion(Lq, HaloRecv(h,s), Nx, Ny, _NZ, s);
+					}
+				}
+
+				#pragma omp taskloop grainsize(1)
+				for (unsigned int k = kin0; k < kin1; k++)
+				{
+					Compute_Laplace3d(q, Lq, kx, ky, kz, Nx, Ny, _NZ, k, k+1);
+				}
+			}
+		}
+		else
+		{
+			// Compute and send faces first, all threads pack each face
+			for (int s = 0; s < 2; s++)
+			{
+				if (nbr[s] == MPI_PROC_NULL) continue;
+
+				Begin(C, PHASE_LAPLACE);
+				Compute_Laplace3d(q, Lq, kx, ky, kz, Nx, Ny, _NZ, kface0[s], kface1[s]);
+				End(C, FLOPS_LAPLACE*XY*RADIUS, 0);
+				Begin(C, PHASE_EXCHANGE);
+				REAL *buffer = HaloSendBuffer(h,s);
+				End(C, 0, 0);
+				Begin(C, PHASE_PACK);
+				CopyBoundaryRegionToGhostCell(Lq, buffer, Nx, Ny, _NZ, s);
+				End(C, 0, 2.*sizeof(REAL)*XY*RADIUS);
+				Begin(C, PHASE_EXCHANGE);
+				HaloSend(h,s);
+				End(C, 0, 0);
+			}
+
+			// Compute inner points
+			Begin(C, PHASE_LAPLACE);
+			Compute_Laplace3d(q, Lq, kx, ky, kz, Nx, Ny, _NZ, kin0, kin1);
+			End(C, FLOPS_LAPLACE*XY*(kin1-kin0), 0);
+
+			// Receive data from neighbors
+			for (int s = 0; s < 2; s++)
+			{
+				if (nbr[s] == MPI_PROC_NULL) continue;
+
+				Begin(C, PHASE_EXCHANGE);
+				REAL *buffer = HaloRecv(h,s);
+				End(C, 0, 0);
+				Begin(C, PHASE_UNPACK);
+				CopyGhostCellToBoundaryRegion(Lq, buffer, Nx, Ny, _NZ, s);
+				End(C, 0, 2.*sizeof(REAL)*XY*RADIUS);
+			}
+		}
+
+		// Faces are unpacked, release neighbors and finish sends
+		Begin(C, PHASE_EXCHANGE);
+		if (h) HaloEnd(h);
+		End(C, 0, 0);
+
+		Begin(C, PHASE_UPDATE);
+		if (rkl2)
+		{
+			// Y_j overwrites Y_{j-2}, Y_0 itself at j = 2. An even stage count writes Y_1
+			// apart too, so that u ends the step in its own array
+			REAL mu, nu, mut, gt;
+			SuperStepCoefficients(stages, step, &mu, &nu, &mut, &gt);
+			const int apart = step > 1 || stages%2 == 0;
+			change = Compute_RKL2(apart ? S->um : S->u, S->u, step == 2 ? S->uo : S->um, S->uo, Lq, S->L0,
+				mu, nu, mut, gt, dt, step == (unsigned int)stages, Nx, Ny, _NZ);
+			if (apart) SWAP(REAL*, S->u, S->um);
+		}
+		else
+		{
+			change = Compute_sspRK(S->u, S->uo, S->Lu, step, dt, Nx, Ny, _NZ);
+		}
+		End(C, (rkl2 ? FLOPS_RKL2 : FLOPS_UPDATE)*XY*_NZ, 0);
+	}
+	return change;
+}
+
+void FinalizeSlab(Slab *S)
+{
+	if (S->integrator == INTEGRATOR_ADI) FinalizeAdi(&S->adi);
+	free(S->u); free(S->uo); free(S->Lu);
+	free(S->um); free(S->L0);
+	memset(S, 0, sizeof(Slab));
+}
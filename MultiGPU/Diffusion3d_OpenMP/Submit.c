@@ -0,0 +1,89 @@
+//
+//  Submit.c
+//  Diffusion3d-MPI-OpenMP
+//
+//  Created by Manuel Diaz on 7/26/16.
+//  Copyright © 2016 Manuel Diaz. All rights reserved.
+//
+
+#include "DiffusionMPI.h"
+#include <unistd.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*****************************************************************/
+/* Client of Diffusion3d.daemon: sends one request and prints    */
+/* the answer as it streams back. Files are named relative to    */
+/* the caller, the daemon runs elsewhere                         */
+/*****************************************************************/
+int main(int argc, char** argv)
+{
+	const char *path = GetOption(argc,argv,"-socket",NULL);
+	char socketPath[sizeof(((struct sockaddr_un*)0)->sun_path)];
+	char request[DAEMON_LINE] = "", file[PATH_MAX], last[DAEMON_LINE] = "";
+	int i = 1;
+
+	if (argc > 2 && strcmp(argv[1],"-socket") == 0) i = 3;
+	if (i >= argc)
+	{
+		printf("Usage: %s [-socket path] run K L W H Nx Ny Nz max_iters [-integrator ssprk3|rkl2|adi] [-dt dt] [-tend T] [-ic field] [-o field] [-progress N] | status | shutdown\n", argv[0]);
+		return 1;
+	}
+	for (; i < argc; i++)
+	{
+		const char *arg = argv[i];
+		if (i > 1 && (strcmp(argv[i-1],"-ic") == 0 || strcmp(argv[i-1],"-o") == 0) && arg[0] != '/')
+		{
+			if (getcwd(file, sizeof(file)-strlen(arg)-2) == NULL) return 1;
+			strcat(file, "/"); strcat(file, arg);
+			arg = file;
+		}
+		if (strlen(request)+strlen(arg)+2 >= sizeof(request))
+		{
+			printf("Request too long\n");
+			return 1;
+		}
+		strcat(request, arg);
+		strcat(request, i < argc-1 ? " " : "\n");
+	}
+
+	if (path == NULL)
+	{
+		if (!DaemonSocket(socketPath, sizeof(socketPath))) return 1;
+		path = socketPath;
+	}
+
+	struct sockaddr_un addr;
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		printf("Socket path %s is too long\n", path);
+		return 1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+	{
+		printf("No daemon listening on %s\n", path);
+		return 1;
+	}
+
+	// A refused request is answered without being read, the answer tells why
+	signal(SIGPIPE, SIG_IGN);
+	const int sent = write(fd, request, strlen(request)) == (ssize_t)strlen(request);
+
+	// Lines until the daemon closes the connection, the last one tells the outcome
+	FILE *in = fdopen(fd, "r");
+	char line[DAEMON_LINE];
+	while (fgets(line, sizeof(line), in))
+	{
+		fputs(line, stdout);
+		fflush(stdout);
+		strcpy(last, line);
+	}
+	fclose(in);
+	return sent && strncmp(last, "done", 4) == 0 ? 0 : 1;
+}
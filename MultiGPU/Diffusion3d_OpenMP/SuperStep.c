@@ -0,0 +1,79 @@
+//
+//  SuperStep.c
+//  Diffusion3d-MPI-OpenMP
+//
+//  Created by Manuel Diaz on 7/26/16.
+//  Copyright © 2016 Manuel Diaz. All rights reserved.
+//
+
+#include "DiffusionMPI.h"
+
+/*****************************************************************/
+/* Runge-Kutta-Legendre super-time-stepping (RKL2, Meyer,        */
+/* Balsara & Aslam 2014): s stages of the FD4 Laplacian make one */
+/* second-order step stable up to dt_FE*(s^2+s-2)/4, dt_FE the   */
+/* forward Euler limit 2/lambda_max. The stable step grows as    */
+/* s^2 while the cost grows as s                                 */
+/*****************************************************************/
+
+/* INTEGRATOR_* of an '-integrator' name, -1 if unknown */
+int Integrator(const char* name)
+{
+	if (strcmp(name,"ssprk3") == 0) return INTEGRATOR_SSPRK3;
+	if (strcmp(name,"rkl2") == 0) return INTEGRATOR_RKL2;
+	if (strcmp(name,"adi") == 0) return INTEGRATOR_ADI;
+
+	printf("Unknown integrator '%s', use ssprk3, rkl2 or adi\n", name);
+	return -1;
+}
+
+/* Laplacians per step: three SSP-RK3 stages, the RKL2 stages dt needs, one for ADI */
+int IntegratorStages(int integrator, REAL K, REAL dx, REAL dy, REAL dz, REAL dt)
+{
+	if (integrator == INTEGRATOR_RKL2) return SuperSteps(dt,ExplicitLimit(K,dx,dy,dz));
+	return integrator == INTEGRATOR_ADI ? 1 : 3;
+}
+
+/* The SSP-RK3 step, the default of every integrator */
+REAL ExplicitStep(REAL K, REAL dx, REAL dy, REAL dz)
+{
+	return 1/(2*K*(1/dx/dx+1/dy/dy+1/dz/dz))*0.8;
+}
+
+/* Forward Euler limit of the FD4 Laplacian, lambda_max = (16/3) K sum 1/h^2 */
+REAL ExplicitLimit(REAL K, REAL dx, REAL dy, REAL dz)
+{
+	return 3/(8*K*(1/dx/dx+1/dy/dy+1/dz/dz));
+}
+
+/* Fewest stages, at least 2, that keep a step of dt stable */
+int SuperSteps(REAL dt, REAL dtFE)
+{
+	const double r = dt/(STS_SAFETY*dtFE);
+	int s = (int)ceil(0.5*(sqrt(9+16*r)-1));
+	while (dtFE*STS_SAFETY*((double)s*s+s-2)/4 < dt) s++;
+	return MAX(2, s);
+}
+
+static double b(int j)
+{
+	return j < 2 ? 1./3 : ((double)j*j+j-2)/(2.*j*(j+1));
+}
+
+/*****************************************************************/
+/* Stage j of s: Y_j = mu*Y_{j-1} + nu*Y_{j-2} + (1-mu-nu)*Y_0   */
+/*                    + dt*(mut*L(Y_{j-1}) + gt*L(Y_0))          */
+/*****************************************************************/
+void SuperStepCoefficients(int s, int j, REAL *mu, REAL *nu, REAL *mut, REAL *gt)
+{
+	const double w1 = 4./((double)s*s+s-2);
+	if (j == 1)
+	{
+		*mu = 1; *nu = 0; *mut = b(1)*w1; *gt = 0;
+		return;
+	}
+	*mu = (2.*j-1)/j*b(j)/b(j-1);
+	*nu = -(j-1.)/j*b(j)/b(j-2);
+	*mut = *mu*w1;
+	*gt = -(1-b(j-1))**mut; // a_{j-1} = 1-b_{j-1}
+}
@@ -0,0 +1,311 @@
+//
+//  Tools.c
+//  Diffusion3d-MPI-OpenMP
+//
+//  Created by Manuel Diaz on 7/26/16.
+//  Copyright © 2016 Manuel Diaz. All rights reserved.
+//
+
+#include "DiffusionMPI.h"
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*******************************/
+/* Prints a flattened 3D array */
+/*******************************/
+void Print3D(REAL *u, const unsigned int nx, const unsigned int ny, const unsigned int nz)
+{
+  unsigned int i, j, k, xy;
+  xy=nx*ny; 
+  // print a single property on terminal
+  for(k = 0; k < nz+2*RADIUS; k++) {
+    for (j = 0; j < ny; j++) {
+      for (i = 0; i < nx; i++) {
+				printf("%8.2f", u[i+nx*j+xy*k]);
+      }
+      printf("\n");
+    }
+    printf("\n");
+  }
+  printf("\n");
+}
+
+/*******************************/
+/* Prints a flattened 2D array */
+/*******************************/
+void Print2D(REAL *u, const unsigned int nx, const unsigned int ny)
+{
+  unsigned int i, j;
+  // print a single property on terminal
+  for (j = 0; j < ny; j++) {
+    for (i = 0; i < nx; i++) {
+      printf("%g ", u[i+nx*j]);
+    }
+    printf("\n");
+  }
+  printf("\n");
+}
+
+/*****************************/
+/* Write ASCII file 3D array */
+/*****************************/
+void Save3D(REAL *u, const unsigned int nx, const unsigned int ny, const unsigned int nz)
+{
+  unsigned int i, j, k, xy;
+  xy = nx*ny;
+  // print result to txt file
+  FILE *pFile = fopen("result.bin", "w");
+  if (pFile != NULL) {
+    for (k = 0; k < nz; k++) {
+      for (j = 0; j < ny; j++) {
+        for (i = 0; i < nx; i++) {
+          fprintf(pFile, "%g\n",u[i+nx*j+xy*k]);
+        }
+      }
+    }
+    fclose(pFile);
+  } else {
+    printf("Unable to save to file\n");
+  }
+}
+
+/******************************/
+/* Write Binary file 3D array */
+/******************************/
+void SaveBinary3D(const REAL *u, const unsigned int nx, const unsigned int ny, const unsigned int nz, const char *name)
+{
+  /* NOTE: We save our result as float values always!
+   *
+   * In Matlab, the results can be loaded by simply doing 
+   *  >> fID = fopen('result.bin');
+   *  >> result = fread(fID,[1,nx*ny*nz],'float')';
+   *  >> myplot(result,nx,ny,nz);
+   */
+
+  float data;
+  unsigned int i, j, k;
+  size_t xy, o;
+  xy = (size_t)nx*ny;
+  // print result to txt file
+  FILE *pFile = fopen(name, "w");
+  if (pFile != NULL) {
+      for (k = 0; k < nz; k++) {
+          for (j = 0; j < ny; j++) {
+              for (i = 0; i < nx; i++) {
+                  o = i+nx*j+xy*k; // index
+                  data = (float)u[o]; fwrite(&data,sizeof(float),1,pFile);
+              }
+          }
+      }
+      fclose(pFile);
+  } else {
+      printf("Unable to save to file\n");
+  }
+}
+
+/**********************/
+/* Initializes arrays */
+/**********************/
+void Init_domain(const int IC, REAL *u0, const REAL dx, const REAL dy, const REAL dz, unsigned int nx, unsigned int ny, unsigned int nz)
+{
+	unsigned int i, j, k;
+  size_t o, xy; // out-of-core fields exceed 2^32 cells
+  xy = (size_t)nx*ny;
+	switch (IC) {
+    case 1: {
+      // A Square Jump problem
+      #pragma omp parallel for private(i,j,o) schedule(static)
+      for (k= 0; k < nz; k++) {
+        for (j= 0; j < ny; j++) {
+          for (i= 0; i < nx; i++) {
+            o = i+nx*j+xy*k;
+            if (i>=nx/4 && i<3*nx/4 && j>=ny/4 && j<3*ny/4 && k>=nz/4 && k<3*nz/4) {
+              u0[o]=1.;
+            } else {
+              u0[o]=0.;
+            }
+          }
+        }
+      }
+      break;
+    }
+    case 2: {
+      // Homogeneous IC
+      #pragma omp parallel for private(i,j,o) schedule(static)
+      for (k= 0; k < nz; k++) {
+        for (j= 0; j < ny; j++) {
+          for (i= 0; i < nx; i++) {
+            o = i+nx*j+xy*k;
+            u0[o]=0.0;
+          }
+        }
+      }
+      break;
+    }
+		case 3: {
+			// Sine Distribution in pressure field
+			#pragma omp parallel for private(i,j,o) schedule(static)
+			for(k = 0; k < nz; k++) {
+				for (j = 0; j < ny; j++) {
+					for (i = 0; i < nx; i++) {
+						o = i+nx*j+xy*k; 
+						if (i>=3 || i<nx-2 || j>=3 || j<ny-2 || k>=3 || k<nz-2) {
+							u0[o] = GAUSSIAN_DISTRIBUTION((0.5*(nx-1)-i)*dx,(0.5*(ny-1)-j)*dy,(0.5*(nz-1)-k)*dz);
+						} else {
+							u0[o] = 0.0;
+						}
+					}
+				}
+			}
+			break;
+		}
+		// Here to add another IC
+	}
+}
+
+/******************************/
+/* Initialize the sub-domains */
+/******************************/
+void Init_subdomain(const REAL *h_q, REAL *h_s_q, unsigned int z0, unsigned int Nx, unsigned int Ny, unsigned int _Nz)
+{
+	unsigned int idx_3d; // Global 3D index
+	unsigned int idx_sd; // Subdomain index
+	unsigned int i, j, k, XY, NX; 
+	XY = Nx*Ny; NX = Nx;
+
+	// Copy Domain into n-subdomains, threads first-touch the planes they compute
+	#pragma omp parallel for private(i,j,idx_3d,idx_sd) schedule(static)
+	for(k = 0; k < _Nz+2*RADIUS; k++) {
+		for (j = 0; j < Ny; j++) {
+			for (i = 0; i < Nx; i++) {
+
+				idx_3d = i+NX*j+XY*(k+z0);
+				idx_sd = i+NX*j+XY*(k);
+
+				h_s_q[idx_sd] = h_q[idx_3d];
+			}
+		}
+	}
+}
+
+/*******************************************************/
+/* Merges the smaller sub-domains into a larger domain */
+/*******************************************************/
+void Merge_domains(REAL *h_s_q, REAL *h_q, unsigned int z0, unsigned int Nx, unsigned int Ny, unsigned int _Nz)
+{
+	unsigned int idx_3d; // Global 3D index
+	unsigned int idx_sd; // Subdomain index
+	unsigned int i, j, k, XY, NX; 
+	XY = Nx*Ny; NX = Nx;
+
+	// Copy n-subdomains into the Domain
+	#pragma omp parallel for private(i,j,idx_3d,idx_sd) schedule(static)
+	for(k = RADIUS; k < _Nz+RADIUS; k++) {
+		for (j = 0; j < Ny; j++) {
+			for (i = 0; i < Nx; i++) {
+
+				idx_3d = i+NX*j+XY*(k+z0);
+				idx_sd = i+NX*j+XY*(k);
+
+				h_q[idx_3d] = h_s_q[idx_sd];
+			}
+		}
+	}
+}
+
+/***********************************************************/
+/* Returns the value of an optional '-name value' argument */
+/***********************************************************/
+const char* GetOption(int argc, char** argv, const char* name, const char* fallback)
+{
+  int i;
+  for (i = 1; i < argc-1; i++) {
+    if (strcmp(argv[i],name) == 0) return argv[i+1];
+  }
+  return fallback;
+}
+
+/***********************************************************/
+/* Default socket of the solver daemon: in XDG_RUNTIME_DIR */
+/* or else a directory of this user alone under /tmp       */
+/***********************************************************/
+int DaemonSocket(char *path, size_t size)
+{
+  const char *runtime = getenv("XDG_RUNTIME_DIR");
+  char dir[64];
+  struct stat st;
+
+  if (runtime && runtime[0] == '/') {
+    if (snprintf(path, size, "%s/%s", runtime, DAEMON_SOCKET) < (int)size) return 1;
+    printf("XDG_RUNTIME_DIR is too long for a socket path, set '-socket path'\n");
+    return 0;
+  }
+  snprintf(dir, sizeof(dir), "/tmp/diffusion3d-%u", (unsigned int)getuid());
+  if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+    printf("Unable to create %s\n", dir);
+    return 0;
+  }
+  if (lstat(dir, &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077) != 0) {
+    printf("%s is not a directory of this user alone, set '-socket path'\n", dir);
+    return 0;
+  }
+  snprintf(path, size, "%s/%s", dir, DAEMON_SOCKET);
+  return 1;
+}
+
+/* Ranks running the solver, all of them unless some serve I/O */
+MPI_Comm solverComm = MPI_COMM_WORLD;
+
+/**************************************************************/
+/* Initializes MPI for threads, returns the level we obtained */
+/**************************************************************/
+int InitializeMPI(int* argc, char*** argv, int* rank, int* numberOfProcesses, int required)
+{
+	int provided;
+	MPI_CHECK(MPI_Init_thread(argc, argv, required, &provided));
+	MPI_CHECK(MPI_Comm_rank(MPI_COMM_WORLD, rank));
+	MPI_CHECK(MPI_Comm_size(MPI_COMM_WORLD, numberOfProcesses));
+	MPI_CHECK(MPI_Comm_set_errhandler(MPI_COMM_WORLD, MPI_ERRORS_RETURN));
+
+	if (provided < required && *rank == 0)
+	{
+		printf("MPI provides thread level %d, %d was requested\n", provided, required);
+	}
+	return provided;
+}
+
+/****************************/
+/* Function to finalize MPI */
+/****************************/
+void FinalizeMPI()
+{
+	MPI_CHECK(MPI_Finalize());
+}
+
+/********************/
+/* Calculate Gflops */
+/********************/
+float CalcGflops(float computeTimeInSeconds, unsigned int iterations, unsigned int stages, unsigned int nx, unsigned int ny, unsigned int nz)
+{
+    return ((double)stages*iterations)*(double)((nx * ny * nz) * 1e-9 * FLOPS)/computeTimeInSeconds;
+}
+
+/****************************/
+/* Print Experiment Summary */
+/****************************/
+void PrintSummary(const char* kernelName, const char* optimization,
+    double computeTimeInSeconds, float gflops, const int computeIterations, const int stages,
+    unsigned int nx, unsigned int ny, unsigned int nz, int numberOfProcesses, int numberOfThreads)
+{
+    printf("=======================%s=====================\n", kernelName);
+    printf("Optimization                                 :  %s\n", optimization);
+    printf("Compute time                                 :  %lf seconds\n", computeTimeInSeconds);
+    printf("MPI ranks x OpenMP threads                   :  %d x %d\n", numberOfProcesses, numberOfThreads);
+    printf("===================================================================\n");
+    printf("Total effective GFLOPs                       :  %lf\n", gflops);
+    printf("===================================================================\n");
+    printf("3D Grid Size                                 :  %d x %d x %d\n",nx,ny,nz);
+    printf("Iterations                                   :  %d x %d stages\n", computeIterations, stages);
+    printf("===================================================================\n");
+}
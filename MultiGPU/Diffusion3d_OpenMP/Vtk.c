@@ -0,0 +1,99 @@
+//
+//  Vtk.c
+//  Diffusion3d-MPI-OpenMP
+//
+//  Created by Manuel Diaz on 7/26/16.
+//  Copyright © 2016 Manuel Diaz. All rights reserved.
+//
+
+#include "DiffusionMPI.h"
+
+/*****************************************************************/
+/* Planes [k0,k1] a subdomain writes: its own plus the first one */
+/* of the next subdomain, so that pieces share their interfaces  */
+/*****************************************************************/
+void PieceExtent(unsigned int z0, unsigned int nz, unsigned int Nz, unsigned int *k0, unsigned int *k1)
+{
+	*k0 = z0 == 0 ? 0 : z0+RADIUS;
+	*k1 = z0+nz == Nz ? Nz+2*RADIUS-1 : z0+RADIUS+nz;
+}
+
+/*****************************************************************/
+/* VTK ImageData piece, point data as appended raw Float32; u    */
+/* points at plane k0 of the piece                               */
+/*****************************************************************/
+void WriteImagePiece(const char *name, const REAL *u, unsigned int nx, unsigned int ny, unsigned int NZ,
+	unsigned int k0, unsigned int k1, REAL dx, REAL dy, REAL dz)
+{
+	const size_t XY = (size_t)nx*ny;
+	const uint64_t bytes = sizeof(float)*XY*(k1-k0+1);
+	unsigned int k;
+	size_t o;
+
+	FILE *pFile = fopen(name, "wb");
+	if (pFile == NULL)
+	{
+		printf("Unable to save to file %s\n", name);
+		return;
+	}
+
+	fprintf(pFile, "<?xml version=\"1.0\"?>\n");
+	fprintf(pFile, "<VTKFile type=\"ImageData\" version=\"1.0\" byte_order=\"LittleEndian\" header_type=\"UInt64\">\n");
+	fprintf(pFile, "  <ImageData WholeExtent=\"0 %u 0 %u 0 %u\" Origin=\"0 0 0\" Spacing=\"%.9g %.9g %.9g\">\n", nx-1, ny-1, NZ-1, dx, dy, dz);
+	fprintf(pFile, "    <Piece Extent=\"0 %u 0 %u %u %u\">\n", nx-1, ny-1, k0, k1);
+	fprintf(pFile, "      <PointData Scalars=\"u\">\n");
+	fprintf(pFile, "        <DataArray type=\"Float32\" Name=\"u\" format=\"appended\" offset=\"0\"/>\n");
+	fprintf(pFile, "      </PointData>\n");
+	fprintf(pFile, "    </Piece>\n");
+	fprintf(pFile, "  </ImageData>\n");
+	fprintf(pFile, "  <AppendedData encoding=\"raw\">\n_");
+	fwrite(&bytes, sizeof(bytes), 1, pFile);
+
+	// One plane at a time through a float buffer
+	float *plane = (float*)malloc(sizeof(float)*XY);
+	for (k = 0; k <= k1-k0; k++)
+	{
+		#pragma omp parallel for simd schedule(static)
+		for (o = 0; o < XY; o++) plane[o] = (float)u[XY*k+o];
+		fwrite(plane, sizeof(float), XY, pFile);
+	}
+	free(plane);
+
+	fprintf(pFile, "\n  </AppendedData>\n");
+	fprintf(pFile, "</VTKFile>\n");
+	fclose(pFile);
+}
+
+/*****************************************************************/
+/* Parallel index of the pieces, <base>_<p>.vti, for ParaView    */
+/*****************************************************************/
+void WriteImageIndex(const char *base, int pieces, const unsigned int *k0, const unsigned int *k1,
+	unsigned int nx, unsigned int ny, unsigned int NZ, REAL dx, REAL dy, REAL dz)
+{
+	char name[128];
+	int p;
+
+	sprintf(name, "%s.pvti", base);
+	FILE *pFile = fopen(name, "w");
+	if (pFile == NULL)
+	{
+		printf("Unable to save to file %s\n", name);
+		return;
+	}
+
+	// Pieces are referenced relative to the index
+	const char *file = strrchr(base, '/') ? strrchr(base, '/')+1 : base;
+	fprintf(pFile, "<?xml version=\"1.0\"?>\n");
+	fprintf(pFile, "<VTKFile type=\"PImageData\" version=\"1.0\" byte_order=\"LittleEndian\" header_type=\"UInt64\">\n");
+	fprintf(pFile, "  <PImageData WholeExtent=\"0 %u 0 %u 0 %u\" GhostLevel=\"0\" Origin=\"0 0 0\" Spacing=\"%.9g %.9g %.9g\">\n", nx-1, ny-1, NZ-1, dx, dy, dz);
+	fprintf(pFile, "    <PPointData Scalars=\"u\">\n");
+	fprintf(pFile, "      <PDataArray type=\"Float32\" Name=\"u\"/>\n");
+	fprintf(pFile, "    </PPointData>\n");
+	for (p = 0; p < pieces; p++)
+	{
+		fprintf(pFile, "    <Piece Extent=\"0 %u 0 %u %u %u\" Source=\"%s_%d.vti\"/>\n", nx-1, ny-1, k0[p], k1[p], file, p);
+	}
+	fprintf(pFile, "  </PImageData>\n");
+	fprintf(pFile, "</VTKFile>\n");
+	fclose(pFile);
+}
@@ -0,0 +1,26 @@
+# Hybrid MPI+OpenMP against pure MPI at equal core count
+make
+CORES=${CORES:-4}
+OMP_NUM_THREADS=1 mpirun -np $CORES --bind-to core ./Diffusion3d.run 1.00 2.00 2.00 2.00 200 200 200 100 | grep -E "ranks|Compute time|Halo wait"
+for threads in 2 $CORES; do
+  ranks=$((CORES/threads))
+  for facethreads in 0 1; do
+    OMP_NUM_THREADS=$threads mpirun -np $ranks --map-by slot:PE=$threads ./Diffusion3d.run 1.00 2.00 2.00 2.00 200 200 200 100 -facethreads $facethreads | grep -E "ranks|Optimization|Compute time|Halo wait"
+  done
+done
+# Overdecomposed slabs run by the task scheduler
+for blocks in 2 4 8; do
+  OMP_NUM_THREADS=2 mpirun -np $((CORES/2)) --map-by slot:PE=2 ./Diffusion3d.run 1.00 2.00 2.00 2.00 200 200 200 100 -blocks $blocks | grep -E "ranks|Optimization|Compute time|Halo wait"
+done
+# Snapshots every 10 iterations: gathered on rank 0 against an I/O server rank
+OMP_NUM_THREADS=1 mpirun -np $CORES ./Diffusion3d.run 1.00 2.00 2.00 2.00 200 200 200 100 -output 10 | grep -E "ranks|Compute time|Snapshot"
+OMP_NUM_THREADS=1 mpirun -np $((CORES+1)) --oversubscribe ./Diffusion3d.run 1.00 2.00 2.00 2.00 200 200 200 100 -output 10 -ioservers 1 | grep -E "ranks|Compute time|Snapshot|I/O server"
+# In-core against the out-of-core stream through a file on local disk
+OMP_NUM_THREADS=$CORES mpirun -np 1 ./Diffusion3d.run 1.00 2.00 2.00 2.00 256 256 256 10 | grep -E "Optimization|Compute time"
+OMP_NUM_THREADS=$CORES mpirun -np 1 ./Diffusion3d.run 1.00 2.00 2.00 2.00 256 256 256 10 -ooc ${SCRATCH:-/tmp}/field.dat | grep -E "Optimization|Compute time|Resident|Streamed"
+# Ten short runs: fresh processes against jobs on the solver daemon
+time (for i in $(seq 10); do OMP_NUM_THREADS=$CORES mpirun -np 1 ./Diffusion3d.run 1.00 2.00 2.00 2.00 128 128 128 10 > /dev/null; done)
+OMP_NUM_THREADS=$CORES ./Diffusion3d.daemon -socket /tmp/bench.sock > /dev/null &
+sleep 1
+time (for i in $(seq 10); do ./Diffusion3d.submit -socket /tmp/bench.sock run 1.00 2.00 2.00 2.00 128 128 128 10 | grep done; done)
+./Diffusion3d.submit -socket /tmp/bench.sock shutdown
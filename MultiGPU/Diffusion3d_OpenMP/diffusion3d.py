@@ -0,0 +1,124 @@
+#
+#  diffusion3d.py
+#  Diffusion3d-MPI-OpenMP
+#
+#  Python front end of libdiffusion3d.so (make). Fields are NumPy
+#  arrays over the solver memory: no copies, z slowest, the fixed
+#  boundary planes included; Solver.interior() drops them.
+#
+#      import diffusion3d
+#      s = diffusion3d.Solver(diffusion3d.Config(nx=64, ny=64, nz=64))
+#      s.advance_to(100*s.dt)
+#      print(s.u.max(), s.interior().mean())
+#
+
+import ctypes
+import os
+import numpy as np
+
+_lib = ctypes.CDLL(os.path.join(os.path.dirname(os.path.abspath(__file__)), "libdiffusion3d.so"))
+_lib.SolverCreate.restype = ctypes.c_void_p
+_lib.SolverCreate.argtypes = [ctypes.c_double]*4 + [ctypes.c_uint]*3 + [ctypes.c_char_p, ctypes.c_double, ctypes.c_char_p]
+_lib.SolverReset.restype = ctypes.c_int
+_lib.SolverReset.argtypes = [ctypes.c_void_p] + [ctypes.c_double]*4 + [ctypes.c_char_p, ctypes.c_double, ctypes.c_char_p]
+_lib.SolverDestroy.argtypes = [ctypes.c_void_p]
+_lib.SolverStep.argtypes = [ctypes.c_void_p, ctypes.c_int]
+_lib.SolverAdvanceTo.restype = ctypes.c_int
+_lib.SolverAdvanceTo.argtypes = [ctypes.c_void_p, ctypes.c_double]
+_lib.SolverTime.restype = ctypes.c_double
+_lib.SolverTime.argtypes = [ctypes.c_void_p]
+_lib.SolverSteps.restype = ctypes.c_long
+_lib.SolverSteps.argtypes = [ctypes.c_void_p]
+_lib.SolverDt.restype = ctypes.c_double
+_lib.SolverDt.argtypes = [ctypes.c_void_p]
+_lib.SolverField.restype = ctypes.c_void_p
+_lib.SolverField.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_size_t*3, ctypes.c_size_t*3]
+_lib.SolverSave.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+
+HALO = _lib.SolverHalo()
+REAL = np.float32 if _lib.SolverRealBytes() == 4 else np.float64
+
+
+class Config(object):
+    """Arguments of Diffusion3d.run: conductivity, domain size and cells;
+    integrator and dt as its -integrator and -dt, dt=0 for the SSP-RK3
+    step; ic names a field file (result.fld) whose values start the run.
+    As with the driver's -ic the run starts at t=0: the file's time and
+    step belong to the run that saved it, whose integrator and dt may
+    differ, so they are not continued."""
+
+    def __init__(self, K=1.0, L=2.0, W=2.0, H=2.0, nx=40, ny=40, nz=40, ic=None, integrator="ssprk3", dt=0.0):
+        self.K, self.L, self.W, self.H = K, L, W, H
+        self.nx, self.ny, self.nz = nx, ny, nz
+        self.ic = ic
+        self.integrator, self.dt = integrator, dt
+
+    def __repr__(self):
+        return "Config(K=%g, L=%g, W=%g, H=%g, nx=%d, ny=%d, nz=%d, ic=%r, integrator=%r, dt=%g)" % (
+            self.K, self.L, self.W, self.H, self.nx, self.ny, self.nz, self.ic, self.integrator, self.dt)
+
+
+class Solver(object):
+    """A single-rank solver; its fields stay valid while it lives."""
+
+    def __init__(self, config):
+        self.config = config
+        c = config
+        ic = c.ic.encode() if c.ic else None
+        self._s = _lib.SolverCreate(c.K, c.L, c.W, c.H, c.nx, c.ny, c.nz, c.integrator.encode(), c.dt, ic)
+        if not self._s:
+            raise ValueError("unable to set up %r" % (c,))
+        self.u = self._field(0)    # solution
+        self.uo = self._field(1)   # solution at the start of the step
+        self.Lu = self._field(2)   # Laplacian of the last stage, ADI's scratch
+
+    def _field(self, which):
+        shape, strides = (ctypes.c_size_t*3)(), (ctypes.c_size_t*3)()
+        address = _lib.SolverField(self._s, which, shape, strides)
+        count = shape[0]*strides[0]
+        buffer = (ctypes.c_char*count).from_address(address)
+        # The buffer keeps the solver alive as long as any view of it
+        buffer._owner = self
+        return np.ndarray(tuple(shape), dtype=REAL, buffer=buffer, strides=tuple(strides))
+
+    def interior(self, field=None):
+        """View without the fixed boundary planes."""
+        return (self.u if field is None else field)[HALO:-HALO]
+
+    def reset(self, config):
+        """Starts over with another configuration of the same grid, reusing
+        the arrays: cheaper than a new Solver for ensembles."""
+        c = config
+        if (c.nx, c.ny, c.nz) != (self.config.nx, self.config.ny, self.config.nz):
+            raise ValueError("%r is not on the grid of %r" % (c, self.config))
+        if not _lib.SolverReset(self._s, c.K, c.L, c.W, c.H, c.integrator.encode(), c.dt, c.ic.encode() if c.ic else None):
+            raise ValueError("unable to set up %r" % (c,))
+        self.config = c
+
+    def step(self, n=1):
+        _lib.SolverStep(self._s, n)
+
+    def advance_to(self, t):
+        """Steps while time < t, returns the number of steps taken."""
+        return _lib.SolverAdvanceTo(self._s, t)
+
+    def save(self, name):
+        """Writes the state as a field file, readable by -ic and readField.m."""
+        _lib.SolverSave(self._s, name.encode())
+
+    @property
+    def t(self):
+        return _lib.SolverTime(self._s)
+
+    @property
+    def steps(self):
+        return _lib.SolverSteps(self._s)
+
+    @property
+    def dt(self):
+        return _lib.SolverDt(self._s)
+
+    def __del__(self):
+        if getattr(self, "_s", None):
+            _lib.SolverDestroy(self._s)
+            self._s = None
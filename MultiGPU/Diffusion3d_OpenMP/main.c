@@ -0,0 +1,632 @@
+//
+//  main.c
+//  Diffusion3d-MPI-OpenMP
+//
+//  Created by Manuel Diaz on 7/26/17.
+//  Copyright © 2016 Manuel Diaz. All rights reserved.
+//
+
+#include "DiffusionMPI.h"
+
+/*****************************************************************/
+/* Every rank writes its own VTK pieces, rank 0 adds the index   */
+/*****************************************************************/
+static void OutputVtk(REAL *h_s_u, BlockSet *set, Decomposition *decomp, int blocks, int rank, int numberOfProcesses,
+	unsigned int Nx, unsigned int Ny, REAL dx, REAL dy, REAL dz, int it, int final)
+{
+	const size_t XY = (size_t)Nx*Ny;
+	const unsigned int Nz = decomp->Nz, NZ = Nz+2*RADIUS;
+	char base[64], name[80];
+	unsigned int k0, k1;
+
+	if (final) sprintf(base, "result");
+	else sprintf(base, "snapshot_%06d", it);
+
+	// One piece per block or slab, named after its global index
+	if (blocks > 0)
+	{
+		for (unsigned int g = set->owner.z0[rank]; g < set->owner.z0[rank]+set->owner.nz[rank]; g++)
+		{
+			const Block *b = &set->b[g];
+			PieceExtent(b->z0, b->nz, Nz, &k0, &k1);
+			sprintf(name, "%s_%u.vti", base, g);
+			WriteImagePiece(name, b->u+XY*(k0-b->z0), Nx, Ny, NZ, k0, k1, dx, dy, dz);
+		}
+	}
+	else
+	{
+		PieceExtent(decomp->z0[rank], decomp->nz[rank], Nz, &k0, &k1);
+		sprintf(name, "%s_%d.vti", base, rank);
+		WriteImagePiece(name, h_s_u+XY*(k0-decomp->z0[rank]), Nx, Ny, NZ, k0, k1, dx, dy, dz);
+	}
+
+	// The partition is known everywhere, the index needs no messages
+	if (rank == 0)
+	{
+		const int pieces = blocks > 0 ? (int)set->count : numberOfProcesses;
+		unsigned int *lo = (unsigned int*)malloc(sizeof(unsigned int)*pieces);
+		unsigned int *hi = (unsigned int*)malloc(sizeof(unsigned int)*pieces);
+		for (int p = 0; p < pieces; p++)
+		{
+			if (blocks > 0) PieceExtent(set->b[p].z0, set->b[p].nz, Nz, &lo[p], &hi[p]);
+			else PieceExtent(decomp->z0[p], decomp->nz[p], Nz, &lo[p], &hi[p]);
+		}
+		WriteImageIndex(base, pieces, lo, hi, Nx, Ny, NZ, dx, dy, dz);
+		free(lo); free(hi);
+	}
+}
+
+/*****************************************************************/
+/* Every rank samples the planes it owns, no gather              */
+/*****************************************************************/
+static void Sample(Samples *S, REAL *h_s_u, BlockSet *set, Decomposition *decomp, int blocks, int rank, int it, REAL t)
+{
+	if (blocks > 0)
+	{
+		for (unsigned int g = set->owner.z0[rank]; g < set->owner.z0[rank]+set->owner.nz[rank]; g++)
+		{
+			SamplePiece(S, set->b[g].u, set->b[g].z0, set->b[g].nz);
+		}
+	}
+	else
+	{
+		SamplePiece(S, h_s_u, decomp->z0[rank], decomp->nz[rank]);
+	}
+	SampleRecord(S, it, t);
+}
+
+/*****************************************************************/
+/* Writes the solution: rank 0 gathers, or I/O servers take over */
+/* the dumps while rank 0 still gathers the final result.fld     */
+/*****************************************************************/
+static void Output(IO *io, REAL *h_u, REAL *h_s_u, BlockSet *set, Decomposition *decomp, int blocks,
+	int rank, int numberOfProcesses, unsigned int Nx, unsigned int Ny, int it, REAL t, const FieldHeader *run, int final)
+{
+	char name[64];
+	if (final) sprintf(name, "result.bin");
+	else sprintf(name, "snapshot_%06d.bin", it);
+
+	// Pieces leave with nonblocking sends, the solver carries on
+	if (io->servers > 0)
+	{
+		if (blocks > 0)
+		{
+			for (unsigned int g = set->owner.z0[rank]; g < set->owner.z0[rank]+set->owner.nz[rank]; g++)
+			{
+				IOPost(io, set->b[g].u, set->b[g].z0, set->b[g].nz, it, final);
+			}
+		}
+		else
+		{
+			IOPost(io, h_s_u, decomp->z0[rank], decomp->nz[rank], it, final);
+		}
+		// The servers write the float dumps, result.fld is still gathered below
+		if (!final) return;
+	}
+
+	// Gather results from subdomains
+	if (blocks > 0)
+	{
+		GatherBlocks(set, h_u);
+	}
+	else
+	{
+		const unsigned int _NZ = decomp->nz[rank]+2*RADIUS;
+		MPI_Request gather_send_request;
+		MPI_CHECK(MPI_Isend(h_s_u, Nx*Ny*_NZ, MPI_CUSTOM_REAL, 0, 0, solverComm, &gather_send_request));
+		if (rank == 0)
+		{
+			for (int i = 0; i < numberOfProcesses; i++)
+			{
+				REAL *h_s_recvbuff = (REAL*)malloc(sizeof(REAL)*Nx*Ny*(decomp->nz[i]+2*RADIUS));
+				MPI_CHECK(MPI_Recv(h_s_recvbuff, Nx*Ny*(decomp->nz[i]+2*RADIUS), MPI_CUSTOM_REAL, i, 0, solverComm, MPI_STATUS_IGNORE));
+				Merge_domains(h_s_recvbuff, h_u, decomp->z0[i], Nx, Ny, decomp->nz[i]);
+				free(h_s_recvbuff);
+			}
+		}
+		MPI_CHECK(MPI_Wait(&gather_send_request, MPI_STATUS_IGNORE));
+	}
+	if (DEBUG) printf("Subdomains merged %d\n", rank);
+
+	// Write solution to file, the final one also self-described at full precision
+	if (rank == 0)
+	{
+		const unsigned int NZ = decomp->Nz+2*RADIUS;
+		if (io->servers == 0) SaveBinary3D(h_u, Nx, Ny, NZ, name);
+		if (final)
+		{
+			unsigned int *planes = decomp->nz;
+			if (blocks > 0) { planes = (unsigned int*)malloc(sizeof(unsigned int)*numberOfProcesses); BlockPlanes(set, planes); }
+			FieldHeader state = *run;
+			state.time = t; state.step = it;
+			WriteField("result.fld", h_u, Nx, Ny, NZ, numberOfProcesses, planes, &state);
+			if (blocks > 0) free(planes);
+		}
+	}
+}
+
+/**********************/
+/* Main program entry */
+/**********************/
+int main(int argc, char** argv)
+{
+	REAL K, L, W, H;
+    unsigned int max_iters, Nx, Ny, Nz;
+    double steadyTol;
+    int rank, numberOfProcesses, haloMode, faceThreads, integrator, rkl2, adi, plan, counters, energy, statusEvery, balance, blocks, output, vtk, sampleEvery, preview, previewLevels, previewMax;
+    const char* ioServers;
+    const char* samplers;
+    const char* cacheDir;
+    const char* oocFile;
+    const char* icFile;
+    const char* restartFile;
+    const char* tEndOption;
+    const char* dtOption;
+
+    if (argc >= 9 && argc%2 == 1)
+    {
+        K = atof(argv[1]);			// Heat Conduction
+        L = atof(argv[2]);			// domain lenght
+        W = atof(argv[3]);			// domain width
+        H = atof(argv[4]);			// domain height
+        Nx = atoi(argv[5]);			// number cells in x-direction
+        Ny = atoi(argv[6]);			// number cells in y-direction
+        Nz = atoi(argv[7]);			// number cells in z-direction
+        max_iters = atoi(argv[8]);
+        const char* halo = GetOption(argc,argv,"-halo",NULL);
+        haloMode = halo ? HaloMode(halo) : HALO_MODE;
+        faceThreads = atoi(GetOption(argc,argv,"-facethreads",FACE_THREADS ? "1" : "0"));
+        balance = GetOption(argc,argv,"-balance",NULL) ? atoi(GetOption(argc,argv,"-balance",NULL)) : BALANCE;
+        blocks = GetOption(argc,argv,"-blocks",NULL) ? atoi(GetOption(argc,argv,"-blocks",NULL)) : BLOCKS;
+        output = GetOption(argc,argv,"-output",NULL) ? atoi(GetOption(argc,argv,"-output",NULL)) : OUTPUT;
+        ioServers = GetOption(argc,argv,"-ioservers",IO_SERVERS);
+        vtk = strcmp(GetOption(argc,argv,"-format",OUTPUT_FORMAT),"vtk") == 0;
+        samplers = GetOption(argc,argv,"-samples",NULL);
+        sampleEvery = GetOption(argc,argv,"-sampleevery",NULL) ? atoi(GetOption(argc,argv,"-sampleevery",NULL)) : SAMPLE_EVERY;
+        preview = GetOption(argc,argv,"-preview",NULL) ? atoi(GetOption(argc,argv,"-preview",NULL)) : PREVIEW;
+        previewLevels = GetOption(argc,argv,"-previewlevels",NULL) ? atoi(GetOption(argc,argv,"-previewlevels",NULL)) : PREVIEW_LEVELS;
+        previewMax = strcmp(GetOption(argc,argv,"-previewreduce",PREVIEW_REDUCE),"max") == 0;
+        cacheDir = GetOption(argc,argv,"-cache",CACHE_DIR);
+        oocFile = GetOption(argc,argv,"-ooc",NULL);
+        icFile = GetOption(argc,argv,"-ic",NULL);
+        restartFile = GetOption(argc,argv,"-restart",NULL);
+        tEndOption = GetOption(argc,argv,"-tend",NULL);
+        dtOption = GetOption(argc,argv,"-dt",NULL);
+        integrator = Integrator(GetOption(argc,argv,"-integrator",INTEGRATOR));
+        if (integrator < 0) exit(1);
+        rkl2 = integrator == INTEGRATOR_RKL2;
+        adi = integrator == INTEGRATOR_ADI;
+        plan = GetOption(argc,argv,"-plan",NULL) ? atoi(GetOption(argc,argv,"-plan",NULL)) : PLAN;
+        counters = GetOption(argc,argv,"-counters",NULL) ? atoi(GetOption(argc,argv,"-counters",NULL)) : COUNTERS;
+        energy = GetOption(argc,argv,"-energy",NULL) ? atoi(GetOption(argc,argv,"-energy",NULL)) : ENERGY;
+        if (atoi(GetOption(argc,argv,"-profile",PROFILE ? "1" : "0"))) ProfileEnable();
+        statusEvery = GetOption(argc,argv,"-status",NULL) ? atoi(GetOption(argc,argv,"-status",NULL)) : STATUS;
+        steadyTol = GetOption(argc,argv,"-steady",NULL) ? atof(GetOption(argc,argv,"-steady",NULL)) : STEADY_TOL;
+    }
+    else
+    {
+        printf("Usage: %s K L W H Nx Ny NZ max_iters [-halo p2p|shm|rma|nbr] [-facethreads 0|1] [-balance N] [-blocks B] [-output N] [-ioservers k|node] [-format bin|vtk] [-samples file] [-sampleevery N] [-preview N] [-previewlevels L] [-previewreduce mean|max] [-cache dir] [-ooc file] [-ic field] [-restart field] [-tend T] [-integrator ssprk3|rkl2|adi] [-dt dt] [-steady tol] [-counters 0|1] [-energy 0|1] [-status N] [-profile 0|1] [-plan 0|1|2]\n", argv[0]);
+        exit(1);
+    }
+
+    // Face threads call MPI concurrently and only p2p/shm keep the two faces independent,
+    // block tasks call it from any thread, one at a time
+    if (faceThreads && haloMode != HALO_P2P && haloMode != HALO_SHM) faceThreads = 0;
+    if (blocks > 0) faceThreads = 0;
+    const int blocksAsked = blocks;
+    if (rkl2 || adi) blocks = 0; // the task graph runs SSP-RK3 only
+    if (adi) faceThreads = 0; // line solves take the whole slab
+    int provided = InitializeMPI(&argc, &argv, &rank, &numberOfProcesses, faceThreads ? MPI_THREAD_MULTIPLE : blocks > 0 ? MPI_THREAD_SERIALIZED : MPI_THREAD_FUNNELED);
+    if (provided < MPI_THREAD_MULTIPLE) faceThreads = 0;
+    if (provided < MPI_THREAD_SERIALIZED) blocks = 0;
+
+    // Reserve I/O servers, from here on rank and numberOfProcesses count solver ranks
+    IO io;
+    if (InitializeIO(&io, ioServers, &rank, &numberOfProcesses, Nx, Ny, Nz))
+    {
+        ProfilePhase(PROFILE_OUTPUT);
+        IOServer(&io);
+        FinalizeIO(&io);
+        FinalizeMPI();
+        return 0;
+    }
+    const int numberOfThreads = omp_get_max_threads();
+
+	// Define Constanst
+    const REAL dx = L/(Nx-1);		// dx, cell size
+    const REAL dy = W/(Ny-1);		// dy, cell size
+    const REAL dz = H/(Nz-1);		// dz, cell size
+	const REAL dtExplicit = ExplicitStep(K,dx,dy,dz); // SSP-RK3 step
+	const REAL dt = dtOption ? atof(dtOption) : dtExplicit;
+	const REAL kx = K/(12*dx*dx); // numerical conductivity
+    const REAL ky = K/(12*dy*dy); // numerical conductivity
+    const REAL kz = K/(12*dz*dz); // numerical conductivity
+    const REAL tEnd = tEndOption ? atof(tEndOption) : dt*max_iters;	// final time, max_iters counts from t=0
+
+    // Explicit steps are bounded, super-time-steps take the stages their dt needs, ADI steps one Laplacian
+    const int stages = IntegratorStages(integrator,K,dx,dy,dz,dt);
+    if (!rkl2 && !adi && dt > dtExplicit)
+    {
+        if (rank == 0) printf("dt = %g exceeds the SSP-RK3 limit %g, use '-integrator rkl2|adi' for larger steps\n", dt, dtExplicit);
+        MPI_Abort(solverComm, 1);
+    }
+    if (rkl2 && rank == 0) printf("RKL2: %d stages per step of %g, %.1fx the SSP-RK3 step\n", stages, dt, dt/dtExplicit);
+    if (adi && rank == 0) printf("ADI: steps of %g, %.1fx the SSP-RK3 step\n", dt, dt/dtExplicit);
+    if ((rkl2 || adi) && blocksAsked > 0 && rank == 0) printf("%s runs on slabs, '-blocks %d' is ignored\n", rkl2 ? "RKL2" : "ADI", blocksAsked);
+
+    // Scheme and physics recorded with the state, a continued run must agree with them
+    FieldHeader run; DescribeRun(&run,integrator,K,L,W,H,dt);
+    if (restartFile)
+    {
+        Field state;
+        if (icFile)
+        {
+            if (rank == 0) printf("-restart continues a run, it replaces -ic\n");
+            MPI_Abort(solverComm, 1);
+        }
+        if (!OpenField(&state,restartFile,0) || !FieldMatches(&state,restartFile,Nx,Ny,Nz+2*RADIUS) ||
+            !FieldContinues(&state,restartFile,&run))
+        {
+            fflush(stdout);
+            MPI_Abort(solverComm, 1);
+        }
+        run.time = state.header->time;
+        run.step = state.header->step;
+        CloseField(&state);
+        icFile = restartFile;
+        if (rank == 0) printf("Continuing %s from step %ld, time %g\n", restartFile, (long)run.step, run.time);
+
+        // max_iters counts from t=0, a state already past tEnd would be rewritten without a step
+        if (run.time >= tEnd)
+        {
+            if (rank == 0) printf("%s is at time %g, past the final time %g: raise max_iters above %ld or set '-tend'\n",
+                restartFile, run.time, tEnd, (long)run.step);
+            fflush(stdout);
+            MPI_Abort(solverComm, 1);
+        }
+    }
+    Decomposition decomp; InitializeDecomposition(&decomp,numberOfProcesses,Nz); // Decompose along the z-axis
+
+    // Every slab facing a neighbor holds both of its boundary regions
+    if (numberOfProcesses > 1 && Nz/numberOfProcesses < decomp.min)
+    {
+        if (rank == 0) printf("Nz = %u is too thin for %d ranks of at least %u planes\n", Nz, numberOfProcesses, decomp.min);
+        fflush(stdout);
+        MPI_Abort(solverComm, 1);
+    }
+    unsigned int _Nz = decomp.nz[rank];
+    const unsigned int  NZ = Nz+2*RADIUS;
+    if (rank == 0) printf("dx: %g, dy: %g, dz: %g, final time: %g\n\n",dx,dy,dz,tEnd);
+
+    // Predicted step over rank counts and blocks, from probes of this machine
+    Machine machine;
+    double predicted = 0;
+    if (plan > 0)
+    {
+        CalibrateMachine(&machine,rank,numberOfProcesses,Nx,Ny);
+        if (rank == 0) PrintPlan(&machine,numberOfProcesses,Nx,Ny,Nz);
+        predicted = PredictStep(&machine,numberOfProcesses,blocks,Nx,Ny,Nz,NULL);
+        if (plan == 1)
+        {
+            FinalizeIO(&io);
+            FinalizeMPI();
+            FinalizeDecomposition(&decomp);
+            return 0;
+        }
+    }
+
+    // Grids larger than memory stream through a file on one rank
+    if (oocFile)
+    {
+        if (numberOfProcesses > 1 || rkl2 || adi)
+        {
+            if (rank == 0) printf("The out-of-core solver runs SSP-RK3 on a single rank\n");
+            MPI_Abort(solverComm, 1);
+        }
+        SolveOutOfCore(oocFile, icFile, &run, kx, ky, kz, dt, tEnd, dx, dy, dz, Nx, Ny, Nz, numberOfThreads);
+        FinalizeIO(&io);
+        FinalizeMPI();
+        FinalizeDecomposition(&decomp);
+        return 0;
+    }
+
+    // Runs that only need the final state look it up first: a stored state at
+    // max_iters is the result, an earlier one is continued from its clock instead of the IC
+    Cache cache;
+    const int caching = cacheDir && !restartFile && !tEndOption && !dtOption && !rkl2 && !adi && steadyTol <= 0 && WRITE && !vtk && io.servers == 0 && output == 0 && !samplers && preview == 0;
+    int cached = 0;
+    char cachedField[CACHE_PATH] = "";
+    if (caching)
+    {
+        if (rank == 0)
+        {
+            if (!CacheKey(&cache,cacheDir,K,L,W,H,Nx,Ny,Nz,icFile)) MPI_Abort(solverComm, 1);
+            cached = CacheLookup(&cache,max_iters,cachedField);
+            if (cached == (int)max_iters && !CacheRestore(&cache,cachedField,cached)) cached = 0;
+        }
+        MPI_CHECK(MPI_Bcast(&cached, 1, MPI_INT, 0, solverComm));
+        MPI_CHECK(MPI_Bcast(cachedField, CACHE_PATH, MPI_CHAR, 0, solverComm));
+        if (cached == (int)max_iters)
+        {
+            FinalizeIO(&io);
+            FinalizeMPI();
+            FinalizeDecomposition(&decomp);
+            return 0;
+        }
+        if (cached > 0)
+        {
+            if (rank == 0) printf("Result cache: continuing %s for %d more iterations\n\n", cachedField, max_iters-cached);
+            Field state;
+            if (!OpenField(&state,cachedField,0)) MPI_Abort(solverComm, 1);
+            run.time = state.header->time;
+            run.step = state.header->step;
+            CloseField(&state);
+            icFile = cachedField;
+        }
+    }
+
+    // Initialize solution arrays
+    REAL *h_u; h_u = (REAL*)malloc(sizeof(REAL)*Nx*Ny*NZ);
+
+	// Initial condition built here, or read in place from a mapped field file
+	const REAL *h_ic = h_u;
+	Field ic;
+	if (icFile)
+	{
+		if (!OpenField(&ic,icFile,0) || !FieldMatches(&ic,icFile,Nx,Ny,NZ)) MPI_Abort(solverComm, 1);
+		h_ic = FieldView(&ic,h_u);
+
+		// Merging subdomains fills the interior planes only
+		memcpy(h_u, h_ic, sizeof(REAL)*Nx*Ny*RADIUS);
+		memcpy(h_u+Nx*Ny*(NZ-RADIUS), h_ic+Nx*Ny*(NZ-RADIUS), sizeof(REAL)*Nx*Ny*RADIUS);
+	}
+	else
+	{
+		Init_domain(1,h_u,dx,dy,dz,Nx,Ny,NZ);
+	}
+	if (DEBUG) printf("Domain Initialized rank %d\n",rank);
+
+	// Write solution to file
+	if (rank == 0)
+	{
+    	SaveBinary3D(h_ic,Nx,Ny,NZ,"initial.bin");
+    	printf("IC saved in Host rank %d\n", rank);
+	}
+
+	// Allocate subdomains, first touched by the threads that update them
+	Slab slab; memset(&slab, 0, sizeof(Slab));
+	BlockSet set;
+	if (blocks > 0)
+	{
+		InitializeBlocks(&set,rank,numberOfProcesses,blocks,h_ic,Nx,Ny,Nz);
+	}
+	else
+	{
+		// Initialize subdomains, with the arrays of their integrator
+		if (!InitializeSlab(&slab,Nx,Ny,_Nz)) MPI_Abort(solverComm, 1);
+		Init_subdomain(h_ic,slab.u,decomp.z0[rank],Nx,Ny,_Nz);
+		if (!SlabIntegrator(&slab,integrator,&decomp,rank,K,dx,dy,dz,dt)) MPI_Abort(solverComm, 1);
+		slab.faceThreads = faceThreads;
+	}
+	if (icFile) CloseField(&ic);
+	if (DEBUG) printf("SubDomain %d Initialized\n", rank);
+
+	// Samplers write their records in place from every rank
+	Samples samples;
+	if (!InitializeSamples(&samples,samplers,rank,Nx,Ny,Nz)) MPI_Abort(solverComm, 1);
+	if (samples.count > 0) Sample(&samples, slab.u, &set, &decomp, blocks, rank, run.step, run.time);
+
+	// Coarse levels for watching the run
+	Preview pyramid;
+	if (preview > 0) InitializePreview(&pyramid,previewLevels,previewMax,rank,numberOfProcesses,Nx,Ny,Nz);
+
+	// Node energy around the loop, and hardware counters around each phase of the step
+	Energy rapl; InitializeEnergy(&rapl,energy,rank);
+	Counters pmu; InitializeCounters(&pmu,counters,rank,&rapl);
+	const size_t XY = (size_t)Nx*Ny;
+
+	// Residual history, runs stop once steady
+	Monitor steady; InitializeMonitor(&steady,steadyTol,rank);
+
+	// Allocate left/right receive/send buffers
+	Halo halo; InitializeHalo(&halo,haloMode,rank,numberOfProcesses,Nx,Ny);
+	if (DEBUG) printf("Send/Receive buffers allocated in rank %d\n", rank);
+
+	// Initialize time variables, a continued run picks up its clock
+    const int it0 = run.step;
+    int it =it0;
+    REAL t =run.time;
+
+	if (DEBUG) printf("Begin computation loop in rank %d\n", rank);
+	double compute_timer = 0.;
+	double busy_timer = 0.; // time computing, not waiting on neighbors, since the last rebalance
+	double output_timer = 0.; // time the solver spent on snapshots
+	double sample_timer = 0.; // time the solver spent on samples
+	double preview_timer = 0.; // time the solver spent on previews
+
+	MPI_CHECK(MPI_Barrier(solverComm));
+    compute_timer -= MPI_Wtime();
+    EnergyBegin(&rapl);
+    MPI_CHECK(MPI_Barrier(solverComm));
+
+	// Telemetry for watching the run, status.prom on rank 0
+	Status status; InitializeStatus(&status,statusEvery,rank,numberOfProcesses,it0);
+
+	// Call RK solver
+    while (t < tEnd)
+	{
+        // Update time and iteration counter
+        t+=dt; it+=1;
+        ProfilePhase(PROFILE_HALO);
+        busy_timer -= MPI_Wtime()-halo.wait_time;
+		REAL change = 0; // max|u^(n+1)-u^n| on this rank
+
+		// Phases overlap under tasks, those steps are counted whole
+		if (blocks > 0 || faceThreads || adi) CountersBegin(&pmu, PHASE_STEP);
+
+		if (blocks > 0)
+		{
+			// Task graph over the blocks of this rank
+			change = BlockStep(&set, &halo, kx, ky, kz, dt);
+		}
+		else
+		{
+			// Runge Kutta stages or the line solves on this rank's slab
+			change = SlabStep(&slab, &halo, &pmu);
+		}
+        busy_timer += MPI_Wtime()-halo.wait_time;
+		if (blocks > 0 || faceThreads || adi)
+		{
+			double planes = blocks > 0 ? 0 : _Nz;
+			if (blocks > 0) for (unsigned int g = set.owner.z0[rank]; g < set.owner.z0[rank]+set.owner.nz[rank]; g++) planes += set.b[g].nz;
+			CountersEnd(&pmu, stages*(FLOPS_LAPLACE+(adi ? FLOPS_ADI : rkl2 ? FLOPS_RKL2 : FLOPS_UPDATE))*XY*planes, 0);
+		}
+
+		// Move planes towards the faster ranks
+		if (balance > 0 && it%balance == 0 && t < tEnd)
+		{
+			ProfilePhase(PROFILE_BALANCE);
+			if (blocks > 0)
+			{
+				RebalanceBlocks(&set, busy_timer);
+			}
+			else if (Rebalance(&decomp, rank, busy_timer, &slab.u, &slab.uo, &slab.Lu, Nx, Ny))
+			{
+				ResizeSlab(&slab, &decomp, rank);
+				_Nz = decomp.nz[rank];
+			}
+			busy_timer = 0.;
+		}
+
+		// Time series, written by rank 0 or handed to the I/O servers
+		ProfilePhase(PROFILE_OUTPUT);
+		if (output > 0 && it%output == 0 && t < tEnd)
+		{
+			output_timer -= MPI_Wtime();
+			if (vtk) OutputVtk(slab.u, &set, &decomp, blocks, rank, numberOfProcesses, Nx, Ny, dx, dy, dz, it, 0);
+			else Output(&io, h_u, slab.u, &set, &decomp, blocks, rank, numberOfProcesses, Nx, Ny, it, t, &run, 0);
+			output_timer += MPI_Wtime();
+		}
+
+		// Previews, cheap enough to be written often
+		if (preview > 0 && it%preview == 0)
+		{
+			preview_timer -= MPI_Wtime();
+			WritePreview(&pyramid, slab.u, &set, &decomp, blocks, it);
+			preview_timer += MPI_Wtime();
+		}
+
+		// Samples, a few kilobytes per record
+		if (samples.count > 0 && sampleEvery > 0 && it%sampleEvery == 0)
+		{
+			sample_timer -= MPI_Wtime();
+			Sample(&samples, slab.u, &set, &decomp, blocks, rank, it, t);
+			sample_timer += MPI_Wtime();
+		}
+
+		// Telemetry every few steps, polled in between
+		ProfilePhase(PROFILE_OTHER);
+		if (statusEvery > 0)
+		{
+			const Timers timers = {halo.wait_time, output_timer, sample_timer, preview_timer};
+			StatusStep(&status, it, t, tEnd, dt, &timers, &pmu);
+		}
+
+		// The residual of the previous step arrives, this one leaves
+		if (steadyTol > 0 && MonitorStep(&steady, change, it, t, dt)) break;
+	}
+	FinalizeMonitor(&steady);
+	const Timers timers = {halo.wait_time, output_timer, sample_timer, preview_timer};
+	FinalizeStatus(&status, it, t, tEnd, dt, &timers, &pmu);
+
+	MPI_CHECK(MPI_Barrier(solverComm));
+	compute_timer += MPI_Wtime();
+	EnergyEnd(&rapl);
+	MPI_CHECK(MPI_Barrier(solverComm));
+
+	// Report final dt and iterations
+	if (rank == 0) printf("dt: %g, iterations: %d, final time: %g\n\n",dt,it,t);
+
+	// Gather results from subdomains and write them, or hand them to the I/O servers
+	ProfilePhase(PROFILE_OUTPUT);
+	if (WRITE && vtk) OutputVtk(slab.u, &set, &decomp, blocks, rank, numberOfProcesses, Nx, Ny, dx, dy, dz, it, 1);
+	else if (WRITE) Output(&io, h_u, slab.u, &set, &decomp, blocks, rank, numberOfProcesses, Nx, Ny, it, t, &run, 1);
+	if (DEBUG) printf("Solution saved from rank %d\n", rank);
+	ProfilePhase(PROFILE_OTHER);
+
+	// Slowest rank waiting on its neighbors
+	double halo_timer = 0;
+	MPI_CHECK(MPI_Reduce(&halo.wait_time, &halo_timer, 1, MPI_DOUBLE, MPI_MAX, 0, solverComm));
+
+	// Slowest rank writing snapshots
+	double output_time = 0;
+	MPI_CHECK(MPI_Reduce(&output_timer, &output_time, 1, MPI_DOUBLE, MPI_MAX, 0, solverComm));
+
+	// Slowest rank sampling, and the volume sampled
+	double sample_time = 0, sample_bytes = 0;
+	MPI_CHECK(MPI_Reduce(&sample_timer, &sample_time, 1, MPI_DOUBLE, MPI_MAX, 0, solverComm));
+	MPI_CHECK(MPI_Reduce(&samples.bytes, &sample_bytes, 1, MPI_DOUBLE, MPI_SUM, 0, solverComm));
+
+	// Slowest rank building previews, and their volume
+	double preview_time = 0, preview_bytes = 0;
+	MPI_CHECK(MPI_Reduce(&preview_timer, &preview_time, 1, MPI_DOUBLE, MPI_MAX, 0, solverComm));
+	if (preview > 0) MPI_CHECK(MPI_Reduce(&pyramid.bytes, &preview_bytes, 1, MPI_DOUBLE, MPI_SUM, 0, solverComm));
+
+	// Load imbalance since the last rebalance
+	Decomposition *load = blocks > 0 ? &set.owner : &decomp;
+	MPI_CHECK(MPI_Gather(&busy_timer, 1, MPI_DOUBLE, load->busy, 1, MPI_DOUBLE, 0, solverComm));
+
+	// Final Report
+	if (rank == 0)
+	{
+		float gflops = CalcGflops(compute_timer, it-it0, stages, Nx, Ny, NZ);
+		PrintSummary("Diffusion-3D MPI-OpenMP-FD4", blocks > 0 ? "Block tasks" : faceThreads ? "Face threads" : "Bulk synchronous", compute_timer, gflops, it-it0, stages, Nx, Ny, NZ, numberOfProcesses, numberOfThreads);
+		if (rkl2) printf("Integrator                                   :  RKL2, %d stages, dt %.1fx SSP-RK3, %.0f Laplacians where SSP-RK3 takes %.0f\n",
+			stages, dt/dtExplicit, (double)stages*(it-it0), 3*ceil((t-run.time)/dtExplicit));
+		if (adi) printf("Integrator                                   :  Douglas ADI, theta %.2f, dt %.1fx SSP-RK3, %d steps where SSP-RK3 takes %.0f\n",
+			ADI_THETA, dt/dtExplicit, it-it0, ceil((t-run.time)/dtExplicit));
+		printf("Halo exchange                                :  %s\n", HaloModeName(haloMode));
+		printf("Halo wait time (max over ranks)              :  %lf seconds\n", halo_timer);
+		if (blocks > 0) printf("Blocks per rank (initial)                    :  %d\n", blocks);
+		printf("Load imbalance (last interval)               :  %.1f%%\n", 100*Imbalance(load->busy,numberOfProcesses));
+		if (output > 0) printf("Snapshot time (max over ranks)               :  %lf seconds, %s\n", output_time, vtk ? "VTK pieces per rank" : io.servers > 0 ? "I/O servers" : "gathered on rank 0");
+		if (preview > 0) printf("Previews (max time over ranks)               :  %d of %d levels, %.1f MB, %lf seconds\n", pyramid.count, pyramid.levels, preview_bytes/1e6, preview_time);
+		if (steadyTol > 0 && steady.reached > 0) printf("Steady state                                 :  residual below %g at iteration %d, stopped at %d\n", steadyTol, steady.reached, it);
+		if (steadyTol > 0 && steady.reached == 0) printf("Steady state                                 :  not reached, residual above %g\n", steadyTol);
+		if (steadyTol > 0) printf("Residual history                             :  %g to %g, x%.6f per iteration, residual.txt\n", steady.first, steady.last, MonitorRate(&steady));
+		if (plan > 0) printf("Performance model                            :  %.3f ms/step predicted, %.3f ms/step measured (%+.1f%%)\n",
+			1e3*predicted, 1e3*compute_timer/MAX(1, it-it0), 100*(predicted/(compute_timer/MAX(1, it-it0))-1));
+		if (samples.count > 0) printf("Samples (max time over ranks)                :  %d samplers, %d records, %.1f kB, %lf seconds\n", samples.count, samples.records, sample_bytes/1e3, sample_time);
+		printf("===================================================================\n");
+
+		// The stored state answers later runs of this configuration
+		if (caching)
+		{
+			// A continued run times its own iterations, not those of the stored state it started from
+			char diagnostics[256], from[64] = "";
+			if (cached > 0) snprintf(from, sizeof(from), " (continuation from iteration %d only)", cached);
+			snprintf(diagnostics, sizeof(diagnostics), "%d iterations%s on %d ranks x %d threads: %lf seconds, %.2f GFLOPS, final time %g\n",
+				it-it0, from, numberOfProcesses, numberOfThreads, compute_timer, gflops, (double)t);
+			CacheStore(&cache, "result.fld", max_iters, diagnostics);
+		}
+	}
+
+	// Energy of the loop and phases of every rank, after the summary
+	ReportEnergy(&rapl, compute_timer, (double)Nx*Ny*Nz*(it-it0), rank);
+	ReportCounters(&pmu, rank, numberOfProcesses);
+	FinalizeCounters(&pmu);
+	FinalizeEnergy(&rapl);
+
+	FinalizeHalo(&halo);
+	FinalizeSamples(&samples);
+	if (preview > 0) FinalizePreview(&pyramid);
+	FinalizeIO(&io);
+	FinalizeMPI();
+
+	// Free memory on all hosts
+	FinalizeSlab(&slab);
+	free(h_u);
+	if (blocks > 0) FinalizeBlocks(&set);
+	FinalizeDecomposition(&decomp);
+	return 0;
+}
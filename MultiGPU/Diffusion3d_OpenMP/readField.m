@@ -0,0 +1,28 @@
+function [u,info] = readField(name)
+% Reads a field file written by the solver: dimensions, precision, time
+% and decomposition come from its header, nothing is known out of band.
+%
+%  >> [u,info] = readField('result.fld');
+%  >> myplot(u(:),info.nx,info.ny,info.nz,L,W,H);
+
+fID = fopen(name,'r','l');
+magic = fread(fID,[1,8],'*char');
+if ~strcmp(deblank(magic),'FIELD3D'), error('%s is not a field file',name); end
+h = fread(fID,8,'uint32');
+info.version = h(1); info.offset = h(2);
+info.nx = h(3); info.ny = h(4); info.nz = h(5);
+info.bytes = h(6); info.halo = h(7); info.ranks = h(8);
+info.time = fread(fID,1,'double');
+info.step = fread(fID,1,'int64');
+info.dt   = fread(fID,1,'double');
+if info.version >= 2
+    info.scheme = deblank(fread(fID,[1,16],'*char'));
+    p = fread(fID,4,'double');
+    info.K = p(1); info.L = p(2); info.W = p(3); info.H = p(4);
+end
+info.planes = fread(fID,info.ranks,'uint32')';
+
+if info.bytes == 4, precision = 'single'; else precision = 'double'; end
+fseek(fID,info.offset,'bof');
+u = reshape(fread(fID,info.nx*info.ny*info.nz,['*' precision]),info.nx,info.ny,info.nz);
+fclose(fID);
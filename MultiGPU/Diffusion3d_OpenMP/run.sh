@@ -0,0 +1,2 @@
+make
+OMP_NUM_THREADS=4 mpirun -np 2 --map-by socket --bind-to socket ./Diffusion3d.run 1.00 2.00 2.00 2.00 400 200 200 1000
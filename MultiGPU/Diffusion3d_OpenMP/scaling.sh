@@ -0,0 +1,82 @@
+#!/bin/bash
+# Strong and weak scaling of Diffusion3d.run over localhost MPI ranks
+#   ./scaling.sh [strong|weak|both]
+# strong: the global grid N x N x N is split over more ranks
+# weak:   every rank keeps N x N x NZ_RANK planes, the domain grows in z
+# Each run writes status.prom (-status) with per-phase times (-counters)
+# in its own directory; scaling_report.txt collects time per step,
+# speedup, parallel efficiency and the share spent on halo exchange.
+# Runs beyond the cores of this machine are oversubscribed and flagged.
+MODE=${1:-both}
+RANKS=${RANKS:-"1 2 4"}
+N=${N:-64}
+NZ_RANK=${NZ_RANK:-32}
+ITERS=${ITERS:-50}
+THREADS=${THREADS:-1}
+MPIRUN=${MPIRUN:-mpirun}
+MPIFLAGS=${MPIFLAGS:-}
+EXTRA=${EXTRA:-} # more solver options, e.g. "-halo p2p" or "-blocks 2"
+OUT=${OUT:-scaling}
+CORES=$(nproc)
+[ "$(id -u)" = 0 ] && MPIFLAGS="$MPIFLAGS --allow-run-as-root"
+
+make -s Diffusion3d.run || exit 1
+BIN=$(pwd)/Diffusion3d.run
+mkdir -p $OUT
+REPORT=$OUT/scaling_report.txt
+
+# Value of a status.prom series, 0 when absent
+metric() { awk -v key="$2" 'index($0,key)==1 {v=$NF} END {print v+0}' $1; }
+
+# One run: mode ranks nx ny nz H, prints the report line
+run() {
+  local mode=$1 r=$2 nx=$3 ny=$4 nz=$5 H=$6
+  local dir=$OUT/${mode}_np$r flags=$MPIFLAGS note=""
+  if [ $((r*THREADS)) -gt $CORES ]; then flags="$flags --oversubscribe"; note="oversubscribed"; fi
+  mkdir -p $dir
+  (cd $dir && OMP_NUM_THREADS=$THREADS $MPIRUN -np $r $flags $BIN 1.00 2.00 2.00 $H $nx $ny $nz $ITERS \
+    -status 1000000000 -counters 1 $EXTRA > run.log 2>&1) || { echo "$mode $r: run failed, see $dir/run.log" >&2; return; }
+  local s=$dir/status.prom
+  local steps=$(metric $s 'diffusion3d_step ')
+  local elapsed=$(metric $s 'diffusion3d_elapsed_seconds')
+  local comm=$(metric $s 'diffusion3d_halo_wait_fraction{stat="max"}')
+  local phases=""
+  for p in compute halo_wait laplacian pack exchange unpack rk_update; do
+    phases="$phases $(metric $s "diffusion3d_phase_seconds{phase=\"$p\",stat=\"max\"}")"
+  done
+  echo "$mode $r ${nx}x${ny}x${nz} $steps $elapsed $comm$phases $note"
+}
+
+# Columns: mode ranks grid steps seconds comm compute halo_wait laplacian pack exchange unpack rk_update [note]
+{
+  if [ $MODE = strong ] || [ $MODE = both ]; then
+    for r in $RANKS; do run strong $r $N $N $N 2.00; done
+  fi
+  if [ $MODE = weak ] || [ $MODE = both ]; then
+    for r in $RANKS; do
+      nz=$((NZ_RANK*r))
+      # dz, and with it dt, stays that of the one-rank run
+      H=$(awk -v n=$nz -v n1=$NZ_RANK 'BEGIN {printf "%.6f", 2.00*(n-1)/(n1-1)}')
+      run weak $r $N $N $nz $H
+    done
+  fi
+} > $OUT/runs.txt
+
+awk -v cores=$CORES -v threads=$THREADS -v iters=$ITERS '
+BEGIN {
+  printf "Scaling of Diffusion3d.run, %d OpenMP threads per rank, %d iterations, %d cores\n", threads, iters, cores
+  printf "efficiency: strong T1/(p*Tp), weak T1/Tp; comm: halo wait over the loop, max over ranks\n"
+  printf "phases: milliseconds per step, max over ranks\n\n"
+  printf "%-6s %5s %-12s %9s %8s %8s %6s %9s %9s %9s %9s %9s %9s %9s\n", "mode", "ranks", "grid", "ms/step", "speedup", "effic.", "comm%", "compute", "halo", "laplace", "pack", "exchange", "unpack", "update"
+}
+{
+  step = $5/$4
+  if (!($1 in t1)) t1[$1] = $1 == "strong" ? step*$2 : step
+  speedup = t1[$1]/step
+  eff = $1 == "strong" ? speedup/$2 : t1[$1]/step
+  if ($1 == "weak") speedup = eff*$2
+  printf "%-6s %5d %-12s %9.3f %8.2f %7.1f%% %6.1f", $1, $2, $3, 1e3*step, speedup, 100*eff, 100*$6
+  for (i = 7; i <= 13; i++) printf " %9.3g", 1e3*$i/$4
+  printf " %s\n", $14
+}' $OUT/runs.txt | tee $REPORT
+echo "Report: $REPORT, runs in $OUT/"